@@ -0,0 +1,277 @@
+#include <stdbool.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+#include "aesdummy.h"
+
+// Byte oriented AES-128 for the 8 bit AVR: no T-tables, the S-boxes are
+// the only tables and live in flash. MixColumns uses xtime, decryption
+// reduces InvMixColumns to a cheap pre-step plus MixColumns. Encryption and
+// decryption share the same (forward) expanded key.
+
+#define AES_ROUNDS		10
+#define AES_RK_SIZE		(AES_BLOCK_SIZE * (AES_ROUNDS + 1))
+
+static const uint8_t sbox[256] PROGMEM = {
+	0x63, 0x7C, 0x77, 0x7B, 0xF2, 0x6B, 0x6F, 0xC5, 0x30, 0x01, 0x67, 0x2B, 0xFE, 0xD7, 0xAB, 0x76,
+	0xCA, 0x82, 0xC9, 0x7D, 0xFA, 0x59, 0x47, 0xF0, 0xAD, 0xD4, 0xA2, 0xAF, 0x9C, 0xA4, 0x72, 0xC0,
+	0xB7, 0xFD, 0x93, 0x26, 0x36, 0x3F, 0xF7, 0xCC, 0x34, 0xA5, 0xE5, 0xF1, 0x71, 0xD8, 0x31, 0x15,
+	0x04, 0xC7, 0x23, 0xC3, 0x18, 0x96, 0x05, 0x9A, 0x07, 0x12, 0x80, 0xE2, 0xEB, 0x27, 0xB2, 0x75,
+	0x09, 0x83, 0x2C, 0x1A, 0x1B, 0x6E, 0x5A, 0xA0, 0x52, 0x3B, 0xD6, 0xB3, 0x29, 0xE3, 0x2F, 0x84,
+	0x53, 0xD1, 0x00, 0xED, 0x20, 0xFC, 0xB1, 0x5B, 0x6A, 0xCB, 0xBE, 0x39, 0x4A, 0x4C, 0x58, 0xCF,
+	0xD0, 0xEF, 0xAA, 0xFB, 0x43, 0x4D, 0x33, 0x85, 0x45, 0xF9, 0x02, 0x7F, 0x50, 0x3C, 0x9F, 0xA8,
+	0x51, 0xA3, 0x40, 0x8F, 0x92, 0x9D, 0x38, 0xF5, 0xBC, 0xB6, 0xDA, 0x21, 0x10, 0xFF, 0xF3, 0xD2,
+	0xCD, 0x0C, 0x13, 0xEC, 0x5F, 0x97, 0x44, 0x17, 0xC4, 0xA7, 0x7E, 0x3D, 0x64, 0x5D, 0x19, 0x73,
+	0x60, 0x81, 0x4F, 0xDC, 0x22, 0x2A, 0x90, 0x88, 0x46, 0xEE, 0xB8, 0x14, 0xDE, 0x5E, 0x0B, 0xDB,
+	0xE0, 0x32, 0x3A, 0x0A, 0x49, 0x06, 0x24, 0x5C, 0xC2, 0xD3, 0xAC, 0x62, 0x91, 0x95, 0xE4, 0x79,
+	0xE7, 0xC8, 0x37, 0x6D, 0x8D, 0xD5, 0x4E, 0xA9, 0x6C, 0x56, 0xF4, 0xEA, 0x65, 0x7A, 0xAE, 0x08,
+	0xBA, 0x78, 0x25, 0x2E, 0x1C, 0xA6, 0xB4, 0xC6, 0xE8, 0xDD, 0x74, 0x1F, 0x4B, 0xBD, 0x8B, 0x8A,
+	0x70, 0x3E, 0xB5, 0x66, 0x48, 0x03, 0xF6, 0x0E, 0x61, 0x35, 0x57, 0xB9, 0x86, 0xC1, 0x1D, 0x9E,
+	0xE1, 0xF8, 0x98, 0x11, 0x69, 0xD9, 0x8E, 0x94, 0x9B, 0x1E, 0x87, 0xE9, 0xCE, 0x55, 0x28, 0xDF,
+	0x8C, 0xA1, 0x89, 0x0D, 0xBF, 0xE6, 0x42, 0x68, 0x41, 0x99, 0x2D, 0x0F, 0xB0, 0x54, 0xBB, 0x16
+};
+
+static const uint8_t rsbox[256] PROGMEM = {
+	0x52, 0x09, 0x6A, 0xD5, 0x30, 0x36, 0xA5, 0x38, 0xBF, 0x40, 0xA3, 0x9E, 0x81, 0xF3, 0xD7, 0xFB,
+	0x7C, 0xE3, 0x39, 0x82, 0x9B, 0x2F, 0xFF, 0x87, 0x34, 0x8E, 0x43, 0x44, 0xC4, 0xDE, 0xE9, 0xCB,
+	0x54, 0x7B, 0x94, 0x32, 0xA6, 0xC2, 0x23, 0x3D, 0xEE, 0x4C, 0x95, 0x0B, 0x42, 0xFA, 0xC3, 0x4E,
+	0x08, 0x2E, 0xA1, 0x66, 0x28, 0xD9, 0x24, 0xB2, 0x76, 0x5B, 0xA2, 0x49, 0x6D, 0x8B, 0xD1, 0x25,
+	0x72, 0xF8, 0xF6, 0x64, 0x86, 0x68, 0x98, 0x16, 0xD4, 0xA4, 0x5C, 0xCC, 0x5D, 0x65, 0xB6, 0x92,
+	0x6C, 0x70, 0x48, 0x50, 0xFD, 0xED, 0xB9, 0xDA, 0x5E, 0x15, 0x46, 0x57, 0xA7, 0x8D, 0x9D, 0x84,
+	0x90, 0xD8, 0xAB, 0x00, 0x8C, 0xBC, 0xD3, 0x0A, 0xF7, 0xE4, 0x58, 0x05, 0xB8, 0xB3, 0x45, 0x06,
+	0xD0, 0x2C, 0x1E, 0x8F, 0xCA, 0x3F, 0x0F, 0x02, 0xC1, 0xAF, 0xBD, 0x03, 0x01, 0x13, 0x8A, 0x6B,
+	0x3A, 0x91, 0x11, 0x41, 0x4F, 0x67, 0xDC, 0xEA, 0x97, 0xF2, 0xCF, 0xCE, 0xF0, 0xB4, 0xE6, 0x73,
+	0x96, 0xAC, 0x74, 0x22, 0xE7, 0xAD, 0x35, 0x85, 0xE2, 0xF9, 0x37, 0xE8, 0x1C, 0x75, 0xDF, 0x6E,
+	0x47, 0xF1, 0x1A, 0x71, 0x1D, 0x29, 0xC5, 0x89, 0x6F, 0xB7, 0x62, 0x0E, 0xAA, 0x18, 0xBE, 0x1B,
+	0xFC, 0x56, 0x3E, 0x4B, 0xC6, 0xD2, 0x79, 0x20, 0x9A, 0xDB, 0xC0, 0xFE, 0x78, 0xCD, 0x5A, 0xF4,
+	0x1F, 0xDD, 0xA8, 0x33, 0x88, 0x07, 0xC7, 0x31, 0xB1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xEC, 0x5F,
+	0x60, 0x51, 0x7F, 0xA9, 0x19, 0xB5, 0x4A, 0x0D, 0x2D, 0xE5, 0x7A, 0x9F, 0x93, 0xC9, 0x9C, 0xEF,
+	0xA0, 0xE0, 0x3B, 0x4D, 0xAE, 0x2A, 0xF5, 0xB0, 0xC8, 0xEB, 0xBB, 0x3C, 0x83, 0x53, 0x99, 0x61,
+	0x17, 0x2B, 0x04, 0x7E, 0xBA, 0x77, 0xD6, 0x26, 0xE1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0C, 0x7D
+};
+
+#define S(x)	pgm_read_byte(&sbox[(x)])
+#define R(x)	pgm_read_byte(&rsbox[(x)])
+
+typedef struct {
+	uint8_t rk[AES_RK_SIZE];
+	// 0 = most recently used
+	uint8_t age;
+	bool valid;
+} aes_cache_entry;
+
+static aes_cache_entry aes_cache[AES_KEY_CACHE_SIZE];
+
+static uint8_t xtime(uint8_t x){
+	return (x << 1) ^ ((x & 0x80) ? 0x1B : 0x00);
+}
+
+static void expand_key(uint8_t *rk, const uint8_t *key){
+	uint8_t rcon = 0x01;
+	uint8_t i, t0, t1, t2, t3, t;
+	
+	memcpy(rk, key, AES_BLOCK_SIZE);
+	for (i = AES_BLOCK_SIZE; i < AES_RK_SIZE; i += 4) {
+		t0 = rk[i - 4];
+		t1 = rk[i - 3];
+		t2 = rk[i - 2];
+		t3 = rk[i - 1];
+		if ((i & 0x0F) == 0) {
+			// RotWord, SubWord, Rcon
+			t = t0;
+			t0 = S(t1) ^ rcon;
+			t1 = S(t2);
+			t2 = S(t3);
+			t3 = S(t);
+			rcon = xtime(rcon);
+		}
+		rk[i] = rk[i - 16] ^ t0;
+		rk[i + 1] = rk[i - 15] ^ t1;
+		rk[i + 2] = rk[i - 14] ^ t2;
+		rk[i + 3] = rk[i - 13] ^ t3;
+	}
+}
+
+static void touch(aes_cache_entry *e){
+	uint8_t i;
+	
+	for (i = 0; i < AES_KEY_CACHE_SIZE; i++) {
+		if (aes_cache[i].age < e->age)
+			aes_cache[i].age++;
+	}
+	e->age = 0;
+}
+
+static const uint8_t *lookup_key(const uint8_t *key){
+	aes_cache_entry *e = NULL;
+	uint8_t i;
+	
+	for (i = 0; i < AES_KEY_CACHE_SIZE; i++) {
+		if (aes_cache[i].valid && !memcmp(aes_cache[i].rk, key, AES_BLOCK_SIZE)) {
+			touch(&aes_cache[i]);
+			return aes_cache[i].rk;
+		}
+		// the oldest entry is replaced
+		if (aes_cache[i].age == AES_KEY_CACHE_SIZE - 1)
+			e = &aes_cache[i];
+	}
+	expand_key(e->rk, key);
+	e->valid = true;
+	touch(e);
+	return e->rk;
+}
+
+void aes_key_cache_clear(void){
+	uint8_t i;
+	
+	memset(aes_cache, 0, sizeof(aes_cache));
+	for (i = 0; i < AES_KEY_CACHE_SIZE; i++)
+		aes_cache[i].age = i;
+}
+
+int AES_set_encrypt_key(const unsigned char *userKey, const int bits, AES_KEY *key){
+	static bool initialized;
+	
+	if (!userKey || !key)
+		return -1;
+	if (bits != 128)
+		return -2;
+	if (!initialized) {
+		aes_key_cache_clear();
+		initialized = true;
+	}
+	key->rd_key = lookup_key(userKey);
+	return 0;
+}
+
+int AES_set_decrypt_key(const unsigned char *userKey, const int bits, AES_KEY *key){
+	return AES_set_encrypt_key(userKey, bits, key);
+}
+
+static void add_round_key(uint8_t *s, const uint8_t *rk){
+	uint8_t i;
+	
+	for (i = 0; i < AES_BLOCK_SIZE; i++)
+		s[i] ^= rk[i];
+}
+
+// SubBytes and ShiftRows in one pass, the state is column major
+static void sub_shift(uint8_t *s){
+	uint8_t t;
+	
+	s[0] = S(s[0]);
+	s[4] = S(s[4]);
+	s[8] = S(s[8]);
+	s[12] = S(s[12]);
+	
+	t = s[1];
+	s[1] = S(s[5]);
+	s[5] = S(s[9]);
+	s[9] = S(s[13]);
+	s[13] = S(t);
+	
+	t = s[2];
+	s[2] = S(s[10]);
+	s[10] = S(t);
+	t = s[6];
+	s[6] = S(s[14]);
+	s[14] = S(t);
+	
+	t = s[15];
+	s[15] = S(s[11]);
+	s[11] = S(s[7]);
+	s[7] = S(s[3]);
+	s[3] = S(t);
+}
+
+static void inv_sub_shift(uint8_t *s){
+	uint8_t t;
+	
+	s[0] = R(s[0]);
+	s[4] = R(s[4]);
+	s[8] = R(s[8]);
+	s[12] = R(s[12]);
+	
+	t = s[13];
+	s[13] = R(s[9]);
+	s[9] = R(s[5]);
+	s[5] = R(s[1]);
+	s[1] = R(t);
+	
+	t = s[2];
+	s[2] = R(s[10]);
+	s[10] = R(t);
+	t = s[6];
+	s[6] = R(s[14]);
+	s[14] = R(t);
+	
+	t = s[3];
+	s[3] = R(s[7]);
+	s[7] = R(s[11]);
+	s[11] = R(s[15]);
+	s[15] = R(t);
+}
+
+static void mix_columns(uint8_t *s){
+	uint8_t i, a0, t;
+	
+	for (i = 0; i < AES_BLOCK_SIZE; i += 4, s += 4) {
+		a0 = s[0];
+		t = s[0] ^ s[1] ^ s[2] ^ s[3];
+		s[0] ^= t ^ xtime(s[0] ^ s[1]);
+		s[1] ^= t ^ xtime(s[1] ^ s[2]);
+		s[2] ^= t ^ xtime(s[2] ^ s[3]);
+		s[3] ^= t ^ xtime(s[3] ^ a0);
+	}
+}
+
+// InvMixColumns = MixColumns after this pre-step
+static void inv_mix_columns(uint8_t *s){
+	uint8_t *c = s;
+	uint8_t i, u, v;
+	
+	for (i = 0; i < AES_BLOCK_SIZE; i += 4, c += 4) {
+		u = xtime(xtime(c[0] ^ c[2]));
+		v = xtime(xtime(c[1] ^ c[3]));
+		c[0] ^= u;
+		c[1] ^= v;
+		c[2] ^= u;
+		c[3] ^= v;
+	}
+	mix_columns(s);
+}
+
+void AES_encrypt(const unsigned char *in, unsigned char *out, const AES_KEY *key){
+	const uint8_t *rk = key->rd_key;
+	uint8_t s[AES_BLOCK_SIZE];
+	uint8_t round;
+	
+	memcpy(s, in, AES_BLOCK_SIZE);
+	add_round_key(s, rk);
+	for (round = 1; round < AES_ROUNDS; round++) {
+		rk += AES_BLOCK_SIZE;
+		sub_shift(s);
+		mix_columns(s);
+		add_round_key(s, rk);
+	}
+	sub_shift(s);
+	add_round_key(s, rk + AES_BLOCK_SIZE);
+	memcpy(out, s, AES_BLOCK_SIZE);
+}
+
+void AES_decrypt(const unsigned char *in, unsigned char *out, const AES_KEY *key){
+	const uint8_t *rk = key->rd_key + AES_RK_SIZE - AES_BLOCK_SIZE;
+	uint8_t s[AES_BLOCK_SIZE];
+	uint8_t round;
+	
+	memcpy(s, in, AES_BLOCK_SIZE);
+	add_round_key(s, rk);
+	for (round = 1; round < AES_ROUNDS; round++) {
+		rk -= AES_BLOCK_SIZE;
+		inv_sub_shift(s);
+		add_round_key(s, rk);
+		inv_mix_columns(s);
+	}
+	inv_sub_shift(s);
+	add_round_key(s, rk - AES_BLOCK_SIZE);
+	memcpy(out, s, AES_BLOCK_SIZE);
+}
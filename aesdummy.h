@@ -0,0 +1,36 @@
+#ifndef __AESDUMMY_H_
+#define __AESDUMMY_H_
+
+// The subset of OpenSSL's AES API used by libfreefare, AES-128 only.
+//
+// Expanded keys are kept in a small cache: libfreefare sets the key again
+// for every block it ciphers, with the cache this is a 16 byte compare
+// unless the key changed. An AES_KEY refers to its cache entry and stays
+// valid until AES_KEY_CACHE_SIZE other keys have been set.
+
+#include <stdint.h>
+
+#define AES_ENCRYPT	1
+#define AES_DECRYPT	0
+#define AES_BLOCK_SIZE	16
+
+// the keydiv master key, the diversified card key and the session key of
+// a tap, and the card key of a second, stacked card. With fewer a tap
+// evicts the key it needs next.
+#ifndef AES_KEY_CACHE_SIZE
+	#define AES_KEY_CACHE_SIZE	4
+#endif
+
+typedef struct aes_key_st {
+	const uint8_t *rd_key;
+} AES_KEY;
+
+int AES_set_encrypt_key(const unsigned char *userKey, const int bits, AES_KEY *key);
+int AES_set_decrypt_key(const unsigned char *userKey, const int bits, AES_KEY *key);
+void AES_encrypt(const unsigned char *in, unsigned char *out, const AES_KEY *key);
+void AES_decrypt(const unsigned char *in, unsigned char *out, const AES_KEY *key);
+
+// Drops all cached key schedules, e.g. to wipe session keys
+void aes_key_cache_clear(void);
+
+#endif
@@ -0,0 +1,399 @@
+#include <stdbool.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include "bench.h"
+#include "uart.h"
+#include "desdummy.h"
+#include "aesdummy.h"
+#include "sm.h"
+#include "spi.h"
+#include "denylist.h"
+#include "crc.h"
+
+#ifdef BENCH
+
+#ifdef TRACE
+	#error "BENCH and TRACE both use Timer1"
+#endif
+
+static volatile uint16_t bench_overflows;
+
+ISR(TIMER1_OVF_vect) {
+	bench_overflows++;
+}
+
+static void bench_puts(const char *s){
+	while (*s)
+		uart_putc(*s++);
+}
+
+static void bench_putu(uint32_t v){
+	char buf[11];
+	uint8_t i = sizeof(buf);
+	
+	buf[--i] = 0;
+	do {
+		buf[--i] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	bench_puts(&buf[i]);
+}
+
+static uint32_t bench_now(void){
+	uint16_t hi, lo;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		lo = TCNT1;
+		hi = bench_overflows;
+		if ((TIFR1 & _BV(TOV1)) && lo < 0x8000)
+			hi++;
+	}
+	return ((uint32_t)hi << 16) | lo;
+}
+
+static uint32_t bench_started;
+
+static void bench_start(void){
+	bench_started = bench_now();
+}
+
+// CPU cycles since bench_start
+static uint32_t bench_stop(void){
+	return bench_now() - bench_started;
+}
+
+static void bench_report(const char *name, uint32_t cycles, const char *unit){
+	bench_puts(name);
+	bench_puts(": ");
+	bench_putu(cycles);
+	bench_puts(" cycles");
+	bench_puts(unit);
+	bench_puts("\r\n");
+}
+
+static void bench_check(const char *name, bool ok){
+	bench_puts(name);
+	bench_puts(ok ? ": ok\r\n" : ": FAIL\r\n");
+}
+
+/************** DES */
+
+static const uint8_t des_kat[][3][8] PROGMEM = {
+	// key, plaintext, ciphertext
+	{{0x13, 0x34, 0x57, 0x79, 0x9B, 0xBC, 0xDF, 0xF1},
+	 {0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF},
+	 {0x85, 0xE8, 0x13, 0x54, 0x0F, 0x0A, 0xB4, 0x05}},
+	{{0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF},
+	 {0x4E, 0x6F, 0x77, 0x20, 0x69, 0x73, 0x20, 0x74},
+	 {0x3F, 0xA4, 0x0E, 0x8A, 0x98, 0x4D, 0x48, 0x15}},
+};
+
+// 3DES EDE with keys k1 k2 k1, and 3K3DES with k1 k2 k3
+static const uint8_t tdes_key[3][8] PROGMEM = {
+	{0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF},
+	{0xFE, 0xDC, 0xBA, 0x98, 0x76, 0x54, 0x32, 0x10},
+	{0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF, 0x01, 0x23},
+};
+static const uint8_t tdes_plain[8] PROGMEM = {0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF};
+static const uint8_t tdes_cipher[8] PROGMEM = {0x1A, 0x4D, 0x67, 0x2D, 0xCA, 0x6C, 0xB3, 0x35};
+
+static void tdes_ecb(DES_cblock *block, DES_key_schedule *k1, DES_key_schedule *k2, DES_key_schedule *k3, int enc){
+	if (enc == DES_ENCRYPT) {
+		DES_ecb_encrypt(block, block, k1, DES_ENCRYPT);
+		DES_ecb_encrypt(block, block, k2, DES_DECRYPT);
+		DES_ecb_encrypt(block, block, k3, DES_ENCRYPT);
+	} else {
+		DES_ecb_encrypt(block, block, k3, DES_DECRYPT);
+		DES_ecb_encrypt(block, block, k2, DES_ENCRYPT);
+		DES_ecb_encrypt(block, block, k1, DES_DECRYPT);
+	}
+}
+
+static void bench_des(void){
+	DES_key_schedule ks[3];
+	DES_cblock key, block, expect;
+	uint32_t cycles;
+	bool ok = true;
+	uint8_t i;
+	
+	for (i = 0; i < sizeof(des_kat) / sizeof(des_kat[0]); i++) {
+		memcpy_P(key, des_kat[i][0], 8);
+		memcpy_P(block, des_kat[i][1], 8);
+		memcpy_P(expect, des_kat[i][2], 8);
+		DES_set_key(&key, &ks[0]);
+		DES_ecb_encrypt(&block, &block, &ks[0], DES_ENCRYPT);
+		ok &= !memcmp(block, expect, 8);
+		DES_ecb_encrypt(&block, &block, &ks[0], DES_DECRYPT);
+		memcpy_P(expect, des_kat[i][1], 8);
+		ok &= !memcmp(block, expect, 8);
+	}
+	bench_check("des kat", ok);
+	
+	for (i = 0; i < 3; i++) {
+		memcpy_P(key, tdes_key[i], 8);
+		bench_start();
+		DES_set_key(&key, &ks[i]);
+		cycles = bench_stop();
+	}
+	bench_report("des set_key", cycles, "");
+	
+	memcpy_P(block, tdes_plain, 8);
+	memcpy_P(expect, tdes_cipher, 8);
+	tdes_ecb(&block, &ks[0], &ks[1], &ks[0], DES_ENCRYPT);
+	ok = !memcmp(block, expect, 8);
+	tdes_ecb(&block, &ks[0], &ks[1], &ks[0], DES_DECRYPT);
+	memcpy_P(expect, tdes_plain, 8);
+	ok &= !memcmp(block, expect, 8);
+	bench_check("3des kat", ok);
+	
+	bench_start();
+	DES_ecb_encrypt(&block, &block, &ks[0], DES_ENCRYPT);
+	cycles = bench_stop();
+	bench_report("des ecb encrypt", cycles, "/block");
+	bench_start();
+	DES_ecb_encrypt(&block, &block, &ks[0], DES_DECRYPT);
+	cycles = bench_stop();
+	bench_report("des ecb decrypt", cycles, "/block");
+	bench_start();
+	tdes_ecb(&block, &ks[0], &ks[1], &ks[2], DES_ENCRYPT);
+	cycles = bench_stop();
+	bench_report("3k3des ecb encrypt", cycles, "/block");
+}
+
+/************** AES */
+
+// FIPS-197 appendix C.1
+static const uint8_t aes_kat[3][16] PROGMEM = {
+	{0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F},
+	{0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF},
+	{0x69, 0xC4, 0xE0, 0xD8, 0x6A, 0x7B, 0x04, 0x30, 0xD8, 0xCD, 0xB7, 0x80, 0x70, 0xB4, 0xC5, 0x5A},
+};
+
+static void bench_aes(void){
+	uint8_t key[16], block[16], expect[16];
+	AES_KEY k;
+	uint32_t cycles;
+	bool ok;
+	
+	memcpy_P(key, aes_kat[0], 16);
+	memcpy_P(block, aes_kat[1], 16);
+	memcpy_P(expect, aes_kat[2], 16);
+	aes_key_cache_clear();
+	bench_start();
+	AES_set_encrypt_key(key, 128, &k);
+	cycles = bench_stop();
+	bench_report("aes set_key (expand)", cycles, "");
+	bench_start();
+	AES_set_encrypt_key(key, 128, &k);
+	cycles = bench_stop();
+	bench_report("aes set_key (cached)", cycles, "");
+	
+	bench_start();
+	AES_encrypt(block, block, &k);
+	cycles = bench_stop();
+	bench_report("aes encrypt", cycles, "/block");
+	ok = !memcmp(block, expect, 16);
+	bench_start();
+	AES_decrypt(block, block, &k);
+	cycles = bench_stop();
+	bench_report("aes decrypt", cycles, "/block");
+	memcpy_P(expect, aes_kat[1], 16);
+	ok &= !memcmp(block, expect, 16);
+	bench_check("aes kat", ok);
+}
+
+/************** Secure messaging */
+
+#define BENCH_SM_BYTES		64
+
+// RFC 4493 example 3: key, 40 byte message, CMAC
+static const uint8_t sm_kat_key[16] PROGMEM = {
+	0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6, 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C
+};
+static const uint8_t sm_kat_msg[40] PROGMEM = {
+	0x6B, 0xC1, 0xBE, 0xE2, 0x2E, 0x40, 0x9F, 0x96, 0xE9, 0x3D, 0x7E, 0x11, 0x73, 0x93, 0x17, 0x2A,
+	0xAE, 0x2D, 0x8A, 0x57, 0x1E, 0x03, 0xAC, 0x9C, 0x9E, 0xB7, 0x6F, 0xAC, 0x45, 0xAF, 0x8E, 0x51,
+	0x30, 0xC8, 0x1C, 0x46, 0xA3, 0x5C, 0xE4, 0x11
+};
+static const uint8_t sm_kat_mac[16] PROGMEM = {
+	0xDF, 0xA6, 0x67, 0x47, 0xDE, 0x9A, 0xE6, 0x30, 0x30, 0xCA, 0x32, 0x61, 0x14, 0x97, 0xC8, 0x27
+};
+
+static void bench_sm(void){
+	uint8_t key[16], k1[16], mac[16], iv[16];
+	uint8_t buf[BENCH_SM_BYTES];
+	sm_cmac_t c;
+	uint32_t cycles;
+	bool ok;
+	
+	memcpy_P(key, sm_kat_key, 16);
+	memcpy_P(buf, sm_kat_msg, sizeof(sm_kat_msg));
+	sm_cmac_subkey(key, k1);
+	// fed in two parts that do not end on a block
+	sm_cmac_init(&c, key, k1, NULL);
+	sm_cmac_update(&c, buf, 7);
+	sm_cmac_update(&c, buf + 7, sizeof(sm_kat_msg) - 7);
+	sm_cmac_final(&c, mac);
+	ok = !memcmp_P(mac, sm_kat_mac, 16);
+	
+	memset(iv, 0, 16);
+	sm_cbc_encipher(key, iv, buf, 32);
+	memset(iv, 0, 16);
+	sm_cbc_decipher(key, iv, buf, 16);
+	sm_cbc_decipher(key, iv, buf + 16, 16);
+	ok &= !memcmp_P(buf, sm_kat_msg, 32);
+	bench_check("sm kat", ok);
+	
+	memset(buf, 0x55, sizeof(buf));
+	bench_start();
+	sm_cmac_init(&c, key, k1, NULL);
+	sm_cmac_update(&c, buf, BENCH_SM_BYTES);
+	sm_cmac_final(&c, mac);
+	cycles = bench_stop();
+	bench_report("sm cmac", cycles / (BENCH_SM_BYTES / AES_BLOCK_SIZE), "/block");
+	bench_start();
+	sm_cbc_encipher(key, iv, buf, BENCH_SM_BYTES);
+	cycles = bench_stop();
+	bench_report("sm cbc encipher", cycles / (BENCH_SM_BYTES / AES_BLOCK_SIZE), "/block");
+	bench_start();
+	sm_cbc_decipher(key, iv, buf, BENCH_SM_BYTES);
+	cycles = bench_stop();
+	bench_report("sm cbc decipher", cycles / (BENCH_SM_BYTES / AES_BLOCK_SIZE), "/block");
+}
+
+/************** SPI */
+
+#define BENCH_SPI_BYTES		64
+
+// Per byte cost of the ways to clock bytes out, with the PN532 deselected
+static void bench_spi(void){
+	uint8_t buf[BENCH_SPI_BYTES];
+	uint32_t cycles;
+	uint8_t i;
+	
+	memset(buf, 0x55, sizeof(buf));
+	spi_init();
+	bench_start();
+	for (i = 0; i < BENCH_SPI_BYTES; i++)
+		spi_transfer(buf[i]);
+	cycles = bench_stop();
+	bench_report("spi_transfer (call)", cycles / BENCH_SPI_BYTES, "/byte");
+	bench_start();
+	for (i = 0; i < BENCH_SPI_BYTES; i++)
+		spi_write(buf[i]);
+	cycles = bench_stop();
+	bench_report("spi_write (inline)", cycles / BENCH_SPI_BYTES, "/byte");
+	bench_start();
+	spi_write_burst(buf, BENCH_SPI_BYTES);
+	cycles = bench_stop();
+	bench_report("spi_write_burst", cycles / BENCH_SPI_BYTES, "/byte");
+	bench_start();
+	spi_read_burst(buf, BENCH_SPI_BYTES);
+	cycles = bench_stop();
+	bench_report("spi_read_burst", cycles / BENCH_SPI_BYTES, "/byte");
+}
+
+/************** CRC */
+
+#define BENCH_CRC_BYTES		64
+
+static const uint8_t crc_check[9] PROGMEM = "123456789";
+
+// Known answers: CRC_A of 12 34 (ISO/IEC 14443-3 annex B), CRC32 of
+// "123456789" without the final inversion
+#define CRC_A_CHECK			0xCF26
+#define CRC32_CHECK			0x340BC6D9
+
+static void bench_crc(void){
+	static const char *const names[3] = {"bits", "nibbles", "bytes"};
+	uint16_t (*const crc_a[3])(uint16_t, const uint8_t *, size_t) = {crc_a_bits, crc_a_nibbles, crc_a_bytes};
+	uint32_t (*const crc32[3])(uint32_t, const uint8_t *, size_t) = {crc32_bits, crc32_nibbles, crc32_bytes};
+	uint8_t buf[BENCH_CRC_BYTES];
+	uint32_t cycles;
+	bool ok = true;
+	uint8_t i;
+	
+	memcpy_P(buf, crc_check, sizeof(crc_check));
+	for (i = 0; i < 3; i++) {
+		ok &= crc32[i](CRC32_INIT, buf, sizeof(crc_check)) == CRC32_CHECK;
+		// fed in two parts
+		ok &= crc32[i](crc32[i](CRC32_INIT, buf, 4), buf + 4, sizeof(crc_check) - 4) == CRC32_CHECK;
+	}
+	buf[0] = 0x12;
+	buf[1] = 0x34;
+	for (i = 0; i < 3; i++)
+		ok &= crc_a[i](CRC_A_INIT, buf, 2) == CRC_A_CHECK;
+	bench_check("crc kat", ok);
+	
+	memset(buf, 0x55, sizeof(buf));
+	for (i = 0; i < 3; i++) {
+		bench_start();
+		crc_a[i](CRC_A_INIT, buf, BENCH_CRC_BYTES);
+		cycles = bench_stop();
+		bench_puts("crc_a ");
+		bench_report(names[i], cycles / BENCH_CRC_BYTES, "/byte");
+	}
+	for (i = 0; i < 3; i++) {
+		bench_start();
+		crc32[i](CRC32_INIT, buf, BENCH_CRC_BYTES);
+		cycles = bench_stop();
+		bench_puts("crc32 ");
+		bench_report(names[i], cycles / BENCH_CRC_BYTES, "/byte");
+	}
+}
+
+/************** Denylist */
+
+// Lookups of the first and the last UID of the flash table and of one that
+// is not in it, against the table linked in (tools/denylist -r builds a
+// full one)
+static void bench_denylist(void){
+	uint8_t uid[DENYLIST_UID_LEN];
+	uint16_t n = denylist_size();
+	uint32_t cycles;
+	bool ok = true;
+	
+	memset(uid, 0, sizeof(uid));
+	uid[0] = DENYLIST_MANUFACTURER;
+	bench_puts("denylist uids: ");
+	bench_putu(n);
+	bench_puts("\r\n");
+	if (n) {
+		denylist_entry(0, uid);
+		bench_start();
+		ok &= denylist_denied(uid, sizeof(uid));
+		cycles = bench_stop();
+		bench_report("denylist hit (first)", cycles, "");
+		denylist_entry(n - 1, uid);
+		bench_start();
+		ok &= denylist_denied(uid, sizeof(uid));
+		cycles = bench_stop();
+		bench_report("denylist hit (last)", cycles, "");
+		uid[DENYLIST_UID_LEN - 1] ^= 0x5A;
+	}
+	bench_start();
+	ok &= !denylist_denied(uid, sizeof(uid));
+	cycles = bench_stop();
+	bench_report("denylist miss", cycles, "");
+	bench_check("denylist lookup", ok);
+}
+
+void bench_run(void){
+	// Timer1 free-running at the CPU clock
+	TCCR1A = 0;
+	TCCR1B = _BV(CS10);
+	TIMSK1 |= _BV(TOIE1);
+	uart_init();
+	sei();
+	bench_des();
+	bench_aes();
+	bench_sm();
+	bench_spi();
+	bench_crc();
+	bench_denylist();
+}
+
+#endif
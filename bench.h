@@ -0,0 +1,16 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+// Known-answer checks and cycle counts of the crypto code, run once at
+// startup when built with -DBENCH. The results are written to the UART as
+// text, one line per measurement. In the simulator the checks run as well
+// but the cycle counts are 0, only SPI and delays take virtual time.
+
+#ifdef BENCH
+void bench_run(void);
+	#define BENCH_RUN()		bench_run()
+#else
+	#define BENCH_RUN()		do {} while (0)
+#endif
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef _CRC_H_
+#define _CRC_H_
+
+// CRC_A of ISO/IEC 14443-3, the 16 bit CRC of the frames and of DESFire's
+// legacy DES mode, and the CRC32 of DESFire's native and AES modes (IEEE
+// 802.3 without the final inversion). Both are fed a chunk at a time, so
+// a frame is checked while its bytes come in:
+//
+//   crc = crc_a_update(CRC_A_INIT, part, n);
+//   crc = crc_a_update(crc, next_part, m);
+//
+// There are three kernels each, CRC_TABLE picks the one behind the
+// _update names: 0 shifts bit by bit without a table, 4 looks up a nibble
+// at a time (16 entry tables, 96 bytes of flash for both CRCs), 8 a byte
+// at a time (256 entry tables, 1.5 KB). Only the picked one is built, a
+// BENCH build has all of them for bench.c to measure.
+//
+// CRC_A checks the frames (nfcdummy.c). The CRC32 protects the enciphered
+// commands of an AES session, the debit among them, and ChangeKey:
+// sm_freefare.c takes them over from libfreefare.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef CRC_TABLE
+	#define CRC_TABLE		4
+#endif
+
+#define CRC_A_INIT			0x6363
+#define CRC32_INIT			0xFFFFFFFF
+
+#ifdef BENCH
+	#define CRC_KERNEL(n)	1
+#else
+	#define CRC_KERNEL(n)	(CRC_TABLE == (n))
+#endif
+
+#if CRC_KERNEL(0)
+uint16_t crc_a_bits(uint16_t crc, const uint8_t *data, size_t len);
+uint32_t crc32_bits(uint32_t crc, const uint8_t *data, size_t len);
+#endif
+#if CRC_KERNEL(4)
+uint16_t crc_a_nibbles(uint16_t crc, const uint8_t *data, size_t len);
+uint32_t crc32_nibbles(uint32_t crc, const uint8_t *data, size_t len);
+#endif
+#if CRC_KERNEL(8)
+uint16_t crc_a_bytes(uint16_t crc, const uint8_t *data, size_t len);
+uint32_t crc32_bytes(uint32_t crc, const uint8_t *data, size_t len);
+#endif
+
+#if CRC_TABLE == 0
+	#define crc_a_update	crc_a_bits
+	#define crc32_update	crc32_bits
+#elif CRC_TABLE == 4
+	#define crc_a_update	crc_a_nibbles
+	#define crc32_update	crc32_nibbles
+#elif CRC_TABLE == 8
+	#define crc_a_update	crc_a_bytes
+	#define crc32_update	crc32_bytes
+#else
+	#error "CRC_TABLE must be 0, 4 or 8"
+#endif
+
+#endif
@@ -0,0 +1,191 @@
+#include <stddef.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+#include <avr/eeprom.h>
+#include "denylist.h"
+
+typedef struct {
+	uint8_t uid[DENYLIST_UID_LEN];
+	uint8_t deny;
+} denylist_overlay_entry;
+
+typedef struct {
+	uint8_t slot;
+	denylist_overlay_entry e;
+} denylist_write;
+
+static denylist_overlay_entry EEMEM ee_denylist_overlay[DENYLIST_OVERLAY];
+// Written after the entry, an entry torn by a reset is not counted.
+// Erased it reads 0xFF, as empty.
+static uint8_t EEMEM ee_denylist_count;
+
+// Changes not yet in the EEPROM, a ring oldest first. Lookups see them
+// before the EEPROM.
+static denylist_write denylist_pending[DENYLIST_PENDING];
+static uint8_t denylist_tail, denylist_queued, denylist_pos;
+// Slots the lookups read from the EEPROM, and those plus the new slots
+// of queued changes
+static uint8_t denylist_stored, denylist_slots;
+// A clear waits to zero the count byte before the queued changes
+static bool denylist_clearing;
+
+static uint_farptr_t denylist_index(uint8_t bucket){
+	return pgm_get_far_address(denylist_table) + bucket * sizeof(uint16_t);
+}
+
+static uint_farptr_t denylist_entries(void){
+	return pgm_get_far_address(denylist_table) + offsetof(denylist_table_t, entries);
+}
+
+void denylist_init(void){
+	uint8_t n = eeprom_read_byte(&ee_denylist_count);
+	
+	denylist_stored = denylist_slots = n > DENYLIST_OVERLAY ? 0 : n;
+}
+
+uint8_t denylist_overlay_size(void){
+	return denylist_slots;
+}
+
+// The newest queued change of the UID, NULL if there is none
+static denylist_write *denylist_pending_find(const uint8_t *uid){
+	denylist_write *w;
+	uint8_t i;
+	
+	for (i = denylist_queued; i--; ) {
+		w = &denylist_pending[(denylist_tail + i) % DENYLIST_PENDING];
+		if (!memcmp(w->e.uid, uid, DENYLIST_UID_LEN))
+			return w;
+	}
+	return NULL;
+}
+
+// Overlay slot of the UID in the EEPROM, -1 if it has none. The last
+// byte is compared first, it differs between cards of one batch.
+static int8_t denylist_overlay_find(const uint8_t *uid){
+	denylist_overlay_entry e;
+	uint8_t i;
+	
+	for (i = 0; i < denylist_stored; i++) {
+		if (eeprom_read_byte(&ee_denylist_overlay[i].uid[DENYLIST_UID_LEN - 1]) != uid[DENYLIST_UID_LEN - 1])
+			continue;
+		eeprom_read_block(&e, &ee_denylist_overlay[i], sizeof(e));
+		if (!memcmp(e.uid, uid, DENYLIST_UID_LEN))
+			return i;
+	}
+	return -1;
+}
+
+static bool denylist_table_find(const uint8_t *uid){
+	uint_farptr_t entries = denylist_entries();
+	uint16_t lo, hi, mid;
+	int c;
+	
+	if (uid[0] != DENYLIST_MANUFACTURER)
+		return false;
+	lo = pgm_read_word_far(denylist_index(uid[1]));
+	hi = pgm_read_word_far(denylist_index(uid[1]) + sizeof(uint16_t));
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		c = memcmp_PF(uid + 2, entries + (uint32_t)mid * DENYLIST_ENTRY, DENYLIST_ENTRY);
+		if (!c)
+			return true;
+		if (c < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return false;
+}
+
+bool denylist_denied(const uint8_t *uid, uint8_t uid_len){
+	denylist_write *w;
+	int8_t slot;
+	
+	if (uid_len != DENYLIST_UID_LEN)
+		return false;
+	w = denylist_pending_find(uid);
+	if (w)
+		return w->e.deny;
+	slot = denylist_overlay_find(uid);
+	if (slot >= 0)
+		return eeprom_read_byte(&ee_denylist_overlay[slot].deny);
+	return denylist_table_find(uid);
+}
+
+bool denylist_set(const uint8_t *uid, bool deny){
+	denylist_write *w = denylist_pending_find(uid);
+	int8_t slot;
+	
+	if (w) {
+		slot = w->slot;
+	} else {
+		slot = denylist_overlay_find(uid);
+		if (slot < 0) {
+			if (denylist_slots == DENYLIST_OVERLAY)
+				return false;
+			slot = denylist_slots;
+		}
+	}
+	if (denylist_queued == DENYLIST_PENDING)
+		return false;
+	if (slot == denylist_slots)
+		denylist_slots++;
+	w = &denylist_pending[(denylist_tail + denylist_queued++) % DENYLIST_PENDING];
+	w->slot = slot;
+	memcpy(w->e.uid, uid, DENYLIST_UID_LEN);
+	w->e.deny = deny;
+	return true;
+}
+
+// The queued changes would be cleared with the rest, they are dropped.
+// An entry half written stays beyond the count.
+void denylist_clear(void){
+	denylist_queued = 0;
+	denylist_pos = 0;
+	denylist_stored = denylist_slots = 0;
+	denylist_clearing = true;
+}
+
+bool denylist_flush(void){
+	denylist_write *w = &denylist_pending[denylist_tail];
+	
+	if (!denylist_clearing && !denylist_queued)
+		return false;
+	if (!eeprom_is_ready())
+		return true;
+	if (denylist_clearing) {
+		eeprom_update_byte(&ee_denylist_count, 0);
+		denylist_clearing = false;
+		return denylist_queued;
+	}
+	// the entry a byte at a time, then the count if the slot is new
+	if (denylist_pos < sizeof(w->e)) {
+		eeprom_update_byte((uint8_t *)&ee_denylist_overlay[w->slot] + denylist_pos, ((const uint8_t *)&w->e)[denylist_pos]);
+		denylist_pos++;
+		return true;
+	}
+	if (w->slot == denylist_stored) {
+		eeprom_update_byte(&ee_denylist_count, w->slot + 1);
+		denylist_stored++;
+	}
+	denylist_pos = 0;
+	if (++denylist_tail == DENYLIST_PENDING)
+		denylist_tail = 0;
+	denylist_queued--;
+	return denylist_queued;
+}
+
+uint16_t denylist_size(void){
+	return pgm_read_word_far(denylist_index(0) + 256 * sizeof(uint16_t));
+}
+
+void denylist_entry(uint16_t i, uint8_t *uid){
+	uint16_t b = 0;
+	
+	while (b < 255 && pgm_read_word_far(denylist_index(b + 1)) <= i)
+		b++;
+	uid[0] = DENYLIST_MANUFACTURER;
+	uid[1] = b;
+	memcpy_PF(uid + 2, denylist_entries() + (uint32_t)i * DENYLIST_ENTRY, DENYLIST_ENTRY);
+}
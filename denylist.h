@@ -0,0 +1,64 @@
+#ifndef _DENYLIST_H_
+#define _DENYLIST_H_
+
+// Cards turned away as soon as their UID is read, before any crypto.
+//
+// The list is a table in flash plus an overlay in EEPROM. The table is
+// denylist_table.c, built by tools/denylist from a list of UIDs and
+// flashed with the firmware. It takes 5 bytes per UID: the 7 byte UIDs
+// of NXP (0x04) cards without the manufacturer byte and bucketed by the
+// second byte. An index of 257 words holds the first entry of every
+// bucket, a lookup is a binary search within one bucket, read straight
+// from flash. The table sits in the upper 64 KB of the flash (see the
+// Makefile), room for about 13000 UIDs.
+//
+// Up to DENYLIST_OVERLAY entries in EEPROM, changed over the serial line
+// (main.c), deny or allow further cards without reflashing. They take
+// precedence over the table. A change is queued in RAM and counts at
+// once, denylist_flush writes it to the EEPROM a byte at a time.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define DENYLIST_UID_LEN		7
+#define DENYLIST_MANUFACTURER	0x04
+// the UID bytes after the bucket byte
+#define DENYLIST_ENTRY			5
+
+#ifndef DENYLIST_OVERLAY
+	#define DENYLIST_OVERLAY	32
+#endif
+
+// Overlay changes waiting for the EEPROM, 9 bytes of RAM each
+#ifndef DENYLIST_PENDING
+	#define DENYLIST_PENDING	4
+#endif
+
+typedef struct {
+	// the UIDs with bucket byte b are entries[index[b]] up to, but not
+	// including, entries[index[b + 1]]
+	uint16_t index[257];
+	uint8_t entries[][DENYLIST_ENTRY];
+} denylist_table_t;
+
+// Placed by the linker, read with far accesses
+#define DENYLIST_SECTION		__attribute__((section(".denylist")))
+
+extern const denylist_table_t denylist_table DENYLIST_SECTION;
+
+// Reads the overlay count, before the first lookup
+void denylist_init(void);
+bool denylist_denied(const uint8_t *uid, uint8_t uid_len);
+// Overlay changes, false when the overlay or the queue is full
+bool denylist_set(const uint8_t *uid, bool deny);
+void denylist_clear(void);
+// Writes one byte of the queued changes if the EEPROM is ready, false
+// when nothing is left
+bool denylist_flush(void);
+// UIDs in the table and entries in the overlay
+uint16_t denylist_size(void);
+uint8_t denylist_overlay_size(void);
+// The UID of table entry i, for the benchmark
+void denylist_entry(uint16_t i, uint8_t *uid);
+
+#endif
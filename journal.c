@@ -0,0 +1,176 @@
+#include <string.h>
+#include <avr/eeprom.h>
+#include "journal.h"
+#include "uart.h"
+
+_Static_assert(sizeof(journal_record) == 16, "journal records are 16 bytes");
+_Static_assert(!(JOURNAL_RECORDS & (JOURNAL_RECORDS - 1)) && JOURNAL_RECORDS <= 0x8000, "JOURNAL_RECORDS must be a power of two");
+
+#define JOURNAL_SLOT(seq)		((seq) & (JOURNAL_RECORDS - 1))
+
+static journal_record EEMEM ee_journal[JOURNAL_RECORDS];
+
+// Queue of records not yet in EEPROM, the oldest one at journal_tail is
+// written from byte journal_pos on
+static journal_record journal_pending[JOURNAL_PENDING];
+static uint8_t journal_tail;
+static uint8_t journal_queued;
+static uint8_t journal_pos;
+// Sequence number of the next record
+static uint16_t journal_seq;
+static uint16_t journal_valid;
+static uint16_t journal_lost_count;
+
+// Export in progress: the count of the records from export_first up to,
+// but not including, export_end is sent first, then the records one by
+// one from export_seq on
+#define EXPORT_IDLE				0
+#define EXPORT_COUNT			1
+#define EXPORT_HEADER			2
+#define EXPORT_RECORDS			3
+static uint8_t export_state;
+static uint16_t export_first, export_end, export_seq, export_count;
+
+static uint8_t crc8(const uint8_t *p, uint8_t len){
+	uint8_t crc = 0xff, i;
+	
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+	}
+	return crc;
+}
+
+static bool journal_read(uint16_t slot, journal_record *r){
+	eeprom_read_block(r, &ee_journal[slot], sizeof(*r));
+	return crc8((const uint8_t *)r, sizeof(*r) - 1) == r->crc && JOURNAL_SLOT(r->seq) == slot;
+}
+
+// The records are never more than JOURNAL_RECORDS apart, so sequence
+// numbers compare across the 16 bit wrap
+void journal_init(void){
+	journal_record r;
+	uint16_t slot;
+	bool found = false;
+	
+	journal_valid = 0;
+	for (slot = 0; slot < JOURNAL_RECORDS; slot++) {
+		if (!journal_read(slot, &r))
+			continue;
+		journal_valid++;
+		if (!found || (int16_t)(r.seq - journal_seq) >= 0) {
+			journal_seq = r.seq + 1;
+			found = true;
+		}
+	}
+}
+
+// Record seq from the queue or the EEPROM, false if there is none. A
+// record being written is still in the queue.
+static bool journal_get(uint16_t seq, journal_record *r){
+	uint16_t back = journal_seq - seq;
+	
+	if (back && back <= journal_queued) {
+		*r = journal_pending[(journal_tail + journal_queued - back) % JOURNAL_PENDING];
+		return true;
+	}
+	return journal_read(JOURNAL_SLOT(seq), r) && r->seq == seq;
+}
+
+bool journal_add(const uint8_t *uid, uint8_t uid_len, int32_t amount, int8_t result, uint8_t reader){
+	journal_record *r;
+	
+	if (journal_queued == JOURNAL_PENDING) {
+		journal_lost_count++;
+		return false;
+	}
+	r = &journal_pending[(journal_tail + journal_queued) % JOURNAL_PENDING];
+	memset(r, 0, sizeof(*r));
+	r->amount = amount;
+	r->seq = journal_seq++;
+	memcpy(r->uid, uid, uid_len < JOURNAL_UID_LEN ? uid_len : JOURNAL_UID_LEN);
+	r->result = result;
+	r->reader = reader;
+	r->crc = crc8((const uint8_t *)r, sizeof(*r) - 1);
+	journal_queued++;
+	return true;
+}
+
+// Starts the write of the next byte, false once the queue is in EEPROM.
+// The CRC goes last, a record is only valid once it is complete.
+bool journal_flush(void){
+	journal_record *r = &journal_pending[journal_tail];
+	uint8_t *ee;
+	
+	if (!journal_queued)
+		return false;
+	// an export counted on the EEPROM as it is
+	if (export_state != EXPORT_IDLE || !eeprom_is_ready())
+		return true;
+	ee = (uint8_t *)&ee_journal[JOURNAL_SLOT(r->seq)];
+	// unchanged bytes are not written again
+	eeprom_update_byte(ee + journal_pos, ((const uint8_t *)r)[journal_pos]);
+	if (++journal_pos < sizeof(*r))
+		return true;
+	journal_pos = 0;
+	if (++journal_tail == JOURNAL_PENDING)
+		journal_tail = 0;
+	journal_queued--;
+	if (journal_valid < JOURNAL_RECORDS)
+		journal_valid++;
+	return journal_queued;
+}
+
+// The JOURNAL_RECORDS before the queued ones, then those. Restarts an
+// export that is under way.
+void journal_export(void){
+	export_end = journal_seq;
+	export_first = journal_seq - journal_queued - JOURNAL_RECORDS;
+	export_seq = export_first;
+	export_count = 0;
+	export_state = EXPORT_COUNT;
+}
+
+// One slot is looked at or one record sent per call, each is a CRC over
+// 16 bytes
+bool journal_export_next(void){
+	journal_record r;
+	uint8_t header[5];
+	
+	switch (export_state) {
+	case EXPORT_COUNT:
+		if (journal_get(export_seq, &r))
+			export_count++;
+		if (++export_seq == export_end)
+			export_state = EXPORT_HEADER;
+		return true;
+	case EXPORT_HEADER:
+		header[0] = JOURNAL_SYNC1;
+		header[1] = JOURNAL_SYNC2;
+		header[2] = JOURNAL_VERSION;
+		header[3] = (uint8_t)export_count;
+		header[4] = (uint8_t)(export_count >> 8);
+		if (uart_try_write(header, sizeof(header))) {
+			export_seq = export_first;
+			export_state = EXPORT_RECORDS;
+		}
+		return true;
+	case EXPORT_RECORDS:
+		if (journal_get(export_seq, &r) && !uart_try_write(&r, sizeof(r)))
+			return true;
+		if (++export_seq == export_end)
+			export_state = EXPORT_IDLE;
+		return true;
+	default:
+		return false;
+	}
+}
+
+uint16_t journal_count(void){
+	return journal_valid;
+}
+
+uint16_t journal_lost(void){
+	return journal_lost_count;
+}
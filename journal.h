@@ -0,0 +1,65 @@
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+// Transaction journal in EEPROM. Every debit is recorded with the card's
+// UID, the amount, the result and a sequence number in a 16 byte record.
+// journal_add only queues the record in RAM, journal_flush writes the
+// queue to EEPROM one byte per call while the EEPROM is ready (a byte
+// takes 3.4 ms), so a tap never waits for the EEPROM.
+//
+// The records form a ring over JOURNAL_RECORDS slots, record n goes to
+// slot n % JOURNAL_RECORDS. Every slot is written once per round, the
+// writes are spread evenly, and no head pointer wears out a cell of its
+// own: journal_init finds the newest record by its sequence number. A
+// record torn by a reset fails its CRC and is skipped.
+//
+// journal_export starts sending all records, oldest first, to the UART,
+// see tools/journaldecode.c. journal_export_next then sends the dump a
+// record at a time, as far as the UART ring has room, so it never waits
+// for the UART. Meanwhile journal_flush leaves the EEPROM alone, new
+// records wait in the queue.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Slots in EEPROM, a power of two
+#ifndef JOURNAL_RECORDS
+	#define JOURNAL_RECORDS		128
+#endif
+// Records waiting in RAM for the EEPROM
+#ifndef JOURNAL_PENDING
+	#define JOURNAL_PENDING		8
+#endif
+// 4 and 7 byte UIDs, longer ones are cut
+#define JOURNAL_UID_LEN			7
+
+// Dump format: JOURNAL_SYNC1 JOURNAL_SYNC2 version count(2), then count
+// records as stored, all little endian
+#define JOURNAL_SYNC1			0xA5
+#define JOURNAL_SYNC2			0x4A
+#define JOURNAL_VERSION			1
+
+typedef struct {
+	int32_t amount;
+	uint16_t seq;
+	// zero padded
+	uint8_t uid[JOURNAL_UID_LEN];
+	// of the debit and commit, 0 or a libfreefare error
+	int8_t result;
+	uint8_t reader;
+	// CRC-8 (polynomial 0x07, initial 0xFF) of the bytes before, neither an
+	// erased nor a zeroed slot passes
+	uint8_t crc;
+} journal_record;
+
+void journal_init(void);
+bool journal_add(const uint8_t *uid, uint8_t uid_len, int32_t amount, int8_t result, uint8_t reader);
+bool journal_flush(void);
+void journal_export(void);
+// false when no export is under way
+bool journal_export_next(void);
+// Valid records in EEPROM, records lost to a full queue
+uint16_t journal_count(void);
+uint16_t journal_lost(void);
+
+#endif
@@ -0,0 +1,180 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <avr/eeprom.h>
+#include "keydiv.h"
+#include "sm.h"
+
+typedef struct {
+	uint8_t uid[KEYDIV_UID_MAX];
+	// 0 = empty
+	uint8_t uidLen;
+	uint32_t aid;
+	uint8_t key[AES_BLOCK_SIZE];
+} keydiv_entry;
+
+static uint8_t keydiv_master[AES_BLOCK_SIZE];
+static uint8_t keydiv_k1[AES_BLOCK_SIZE];
+static keydiv_entry keydiv_cache[KEYDIV_CACHE_SIZE];
+// 0 = most recently used
+static uint8_t keydiv_age[KEYDIV_CACHE_SIZE];
+static keydiv_stats_t keydiv_counters;
+
+#ifdef KEYDIV_EEPROM
+_Static_assert(KEYDIV_CACHE_SIZE <= 8, "the dirty mask has 8 bits");
+// check value of the master key the persisted entries were derived with
+static uint8_t EEMEM ee_keydiv_kcv[3];
+static keydiv_entry EEMEM ee_keydiv_cache[KEYDIV_CACHE_SIZE];
+// Entries changed since they were written, keydiv_flush writes them a
+// byte at a time: first uidLen 0, then the entry, then its uidLen, so a
+// reset never leaves a UID with another card's key
+static uint8_t keydiv_dirty;
+static uint8_t keydiv_slot, keydiv_pos;
+// A new check value is written once the entries of the old master key
+// are wiped, kcv_left bytes are still to go
+static uint8_t keydiv_kcv[sizeof(ee_keydiv_kcv)];
+static uint8_t keydiv_kcv_left;
+#endif
+
+// CMAC of 0x01 || m, AN10922 pads to 32 bytes, not to the end of the block
+static void keydiv_cmac(const uint8_t *m, uint8_t len, uint8_t *key){
+	static const uint8_t div_const = 0x01;
+	sm_cmac_t c;
+	
+	sm_cmac_init(&c, keydiv_master, keydiv_k1, NULL);
+	sm_cmac_update(&c, &div_const, 1);
+	sm_cmac_update(&c, m, len);
+	if (++len < 2 * AES_BLOCK_SIZE)
+		sm_cmac_pad(&c, 2 * AES_BLOCK_SIZE - len - 1);
+	sm_cmac_final(&c, key);
+}
+
+void keydiv_init(const uint8_t *master){
+	#ifdef KEYDIV_EEPROM
+		uint8_t l[AES_BLOCK_SIZE];
+		AES_KEY k;
+	#endif
+	uint8_t i;
+	
+	memcpy(keydiv_master, master, AES_BLOCK_SIZE);
+	sm_cmac_subkey(keydiv_master, keydiv_k1);
+	
+	memset(keydiv_cache, 0, sizeof(keydiv_cache));
+	for (i = 0; i < KEYDIV_CACHE_SIZE; i++)
+		keydiv_age[i] = i;
+	#ifdef KEYDIV_EEPROM
+		// l[0..2] is the key check value, AES(master, 0)
+		memset(l, 0, AES_BLOCK_SIZE);
+		AES_set_encrypt_key(keydiv_master, 128, &k);
+		AES_encrypt(l, l, &k);
+		for (i = 0; i < sizeof(ee_keydiv_kcv); i++) {
+			if (eeprom_read_byte(&ee_keydiv_kcv[i]) != l[i])
+				break;
+		}
+		if (i == sizeof(ee_keydiv_kcv)) {
+			eeprom_read_block(keydiv_cache, ee_keydiv_cache, sizeof(keydiv_cache));
+		} else {
+			// other master key or blank EEPROM, the empty cache and then
+			// the check value go out through keydiv_flush
+			keydiv_dirty = (1 << KEYDIV_CACHE_SIZE) - 1;
+			keydiv_pos = 0;
+			memcpy(keydiv_kcv, l, sizeof(keydiv_kcv));
+			keydiv_kcv_left = sizeof(keydiv_kcv);
+		}
+	#endif
+}
+
+static void touch(uint8_t n){
+	uint8_t i;
+	
+	for (i = 0; i < KEYDIV_CACHE_SIZE; i++) {
+		if (keydiv_age[i] < keydiv_age[n])
+			keydiv_age[i]++;
+	}
+	keydiv_age[n] = 0;
+}
+
+void keydiv_derive(const uint8_t *uid, uint8_t uidLen, uint32_t aid, uint8_t *key){
+	uint8_t m[KEYDIV_UID_MAX + 3];
+	keydiv_entry *e;
+	uint8_t i, victim = 0;
+	
+	if (uidLen > KEYDIV_UID_MAX)
+		uidLen = KEYDIV_UID_MAX;
+	for (i = 0; i < KEYDIV_CACHE_SIZE; i++) {
+		e = &keydiv_cache[i];
+		if (e->uidLen == uidLen && e->aid == aid && !memcmp(e->uid, uid, uidLen)) {
+			keydiv_counters.hits++;
+			touch(i);
+			memcpy(key, e->key, AES_BLOCK_SIZE);
+			return;
+		}
+		if (keydiv_age[i] == KEYDIV_CACHE_SIZE - 1)
+			victim = i;
+	}
+	keydiv_counters.misses++;
+	
+	// M = UID || AID, the AID LSB first as on the wire
+	memcpy(m, uid, uidLen);
+	m[uidLen] = aid;
+	m[uidLen + 1] = aid >> 8;
+	m[uidLen + 2] = aid >> 16;
+	keydiv_cmac(m, uidLen + 3, key);
+	
+	e = &keydiv_cache[victim];
+	memcpy(e->uid, uid, uidLen);
+	e->uidLen = uidLen;
+	e->aid = aid;
+	memcpy(e->key, key, AES_BLOCK_SIZE);
+	touch(victim);
+	#ifdef KEYDIV_EEPROM
+		// only queued, the tap does not wait for the EEPROM. An entry
+		// half written starts over.
+		keydiv_dirty |= 1 << victim;
+		if (victim == keydiv_slot)
+			keydiv_pos = 0;
+	#endif
+}
+
+bool keydiv_flush(void){
+	#ifdef KEYDIV_EEPROM
+		uint8_t *ee;
+		uint8_t i;
+		
+		if (!keydiv_dirty && !keydiv_kcv_left)
+			return false;
+		if (!eeprom_is_ready())
+			return true;
+		if (!keydiv_dirty) {
+			i = sizeof(keydiv_kcv) - keydiv_kcv_left--;
+			eeprom_update_byte(&ee_keydiv_kcv[i], keydiv_kcv[i]);
+			return keydiv_kcv_left;
+		}
+		if (!keydiv_pos) {
+			for (keydiv_slot = 0; !(keydiv_dirty & (1 << keydiv_slot)); keydiv_slot++)
+				;
+		}
+		ee = (uint8_t *)&ee_keydiv_cache[keydiv_slot];
+		// 0 wipes uidLen, 1 .. sizeof writes the entry with uidLen still
+		// 0, after that uidLen
+		if (!keydiv_pos) {
+			eeprom_update_byte(ee + offsetof(keydiv_entry, uidLen), 0);
+		} else if (keydiv_pos <= sizeof(keydiv_entry)) {
+			i = keydiv_pos - 1;
+			eeprom_update_byte(ee + i, i == offsetof(keydiv_entry, uidLen) ? 0 : ((const uint8_t *)&keydiv_cache[keydiv_slot])[i]);
+		} else {
+			eeprom_update_byte(ee + offsetof(keydiv_entry, uidLen), keydiv_cache[keydiv_slot].uidLen);
+			keydiv_dirty &= ~(1 << keydiv_slot);
+			keydiv_pos = 0;
+			return true;
+		}
+		keydiv_pos++;
+		return true;
+	#else
+		return false;
+	#endif
+}
+
+void keydiv_stats(keydiv_stats_t *stats){
+	*stats = keydiv_counters;
+}
@@ -0,0 +1,33 @@
+#ifndef _KEYDIV_H_
+#define _KEYDIV_H_
+
+// NXP AN10922 AES-128 key diversification: a card's application key is the
+// CMAC of 0x01 || UID || AID under the master key. The keys of recently
+// seen cards are kept in an LRU cache, so a repeated tap skips the
+// derivation. Built with -DKEYDIV_EEPROM the cache is written through to
+// EEPROM and survives a reset (keep the lock bits set then, the EEPROM
+// holds card keys). keydiv_derive only queues the write, keydiv_flush
+// does it a byte at a time.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef KEYDIV_CACHE_SIZE
+	#define KEYDIV_CACHE_SIZE	8
+#endif
+// 4, 7 or 10 byte UIDs
+#define KEYDIV_UID_MAX			10
+
+typedef struct {
+	uint16_t hits;
+	uint16_t misses;
+} keydiv_stats_t;
+
+void keydiv_init(const uint8_t *master);
+void keydiv_derive(const uint8_t *uid, uint8_t uidLen, uint32_t aid, uint8_t *key);
+void keydiv_stats(keydiv_stats_t *stats);
+// Writes one byte of the changed cache entries if the EEPROM is ready,
+// false when nothing is left, always without KEYDIV_EEPROM
+bool keydiv_flush(void);
+
+#endif
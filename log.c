@@ -0,0 +1,84 @@
+#include <avr/pgmspace.h>
+#include "log.h"
+#include "uart.h"
+
+// Longer names are cut
+#define LOG_NAME_MAX		24
+// name, ": ", the values and the newline
+#define LOG_RECORD_MAX		(LOG_NAME_MAX + 2 + LOG_MAX_VALUES * 12 + 1)
+
+static uint16_t log_dropped_count;
+
+// The UART is set up by main(), the console needs it without the log too
+void log_init(void){
+	log_dropped_count = 0;
+}
+
+// Starts a record in buf with the name from flash, returns its length
+static uint8_t log_name(char *buf, const char *name){
+	uint8_t n = 0;
+	char c;
+	
+	while (n < LOG_NAME_MAX && (c = pgm_read_byte(name++)))
+		buf[n++] = c;
+	return n;
+}
+
+static void log_send(char *buf, uint8_t n){
+	buf[n++] = '\n';
+	if (!uart_try_write(buf, n))
+		log_dropped_count++;
+}
+
+void log_text(const char *name){
+	char buf[LOG_RECORD_MAX];
+	
+	log_send(buf, log_name(buf, name));
+}
+
+void log_ints(const char *name, const int32_t *values, uint8_t n){
+	char buf[LOG_RECORD_MAX];
+	char digits[11];
+	uint8_t len = log_name(buf, name);
+	uint8_t i, d;
+	uint32_t v;
+	
+	buf[len++] = ':';
+	if (n > LOG_MAX_VALUES)
+		n = LOG_MAX_VALUES;
+	for (i = 0; i < n; i++) {
+		buf[len++] = ' ';
+		if (values[i] < 0)
+			buf[len++] = '-';
+		v = values[i] < 0 ? -(uint32_t)values[i] : (uint32_t)values[i];
+		d = 0;
+		do {
+			digits[d++] = '0' + v % 10;
+			v /= 10;
+		} while (v);
+		while (d)
+			buf[len++] = digits[--d];
+	}
+	log_send(buf, len);
+}
+
+void log_hex(const char *name, const void *data, uint8_t len){
+	static const char hex[16] PROGMEM = "0123456789abcdef";
+	char buf[LOG_RECORD_MAX];
+	const uint8_t *p = data;
+	uint8_t n = log_name(buf, name);
+	
+	buf[n++] = ':';
+	buf[n++] = ' ';
+	if (len > LOG_MAX_BYTES)
+		len = LOG_MAX_BYTES;
+	while (len--) {
+		buf[n++] = pgm_read_byte(&hex[*p >> 4]);
+		buf[n++] = pgm_read_byte(&hex[*p++ & 0x0f]);
+	}
+	log_send(buf, n);
+}
+
+uint16_t log_dropped(void){
+	return log_dropped_count;
+}
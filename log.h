@@ -0,0 +1,44 @@
+#ifndef _LOG_H_
+#define _LOG_H_
+
+// Log records for the serial console, one text line each: the name, then
+// decimal values or hex bytes, e.g. "Auth: 0" or "UID: 04a1b2c3d4e5f6".
+// A record is queued for the UART interrupt as a whole or dropped when
+// the ring buffer is full, logging never waits for the UART. Names are
+// kept in flash.
+//
+// LOG_LEVEL is the highest level built in, the calls of the levels above
+// it are removed with their arguments. A release build with
+// -DLOG_LEVEL=0 has no logging at all.
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+#define LOG_ERROR		1
+#define LOG_INFO		2
+#define LOG_DEBUG		3
+
+#ifndef LOG_LEVEL
+	#define LOG_LEVEL		LOG_DEBUG
+#endif
+
+// Values per record, bytes of a hex record
+#define LOG_MAX_VALUES		4
+#define LOG_MAX_BYTES		10
+
+void log_init(void);
+void log_text(const char *name);
+void log_ints(const char *name, const int32_t *values, uint8_t n);
+void log_hex(const char *name, const void *data, uint8_t len);
+// Records dropped for a full ring buffer since the start
+uint16_t log_dropped(void);
+
+#define LOG_ON(level)		((level) <= LOG_LEVEL)
+
+#define LOG_INIT()						do { if (LOG_ON(LOG_ERROR)) log_init(); } while (0)
+#define LOG_TEXT(level, name)				do { if (LOG_ON(level)) log_text(PSTR(name)); } while (0)
+#define LOG_INT(level, name, value)		do { if (LOG_ON(level)) { int32_t v_ = (value); log_ints(PSTR(name), &v_, 1); } } while (0)
+#define LOG_INTS(level, name, values, n)	do { if (LOG_ON(level)) log_ints(PSTR(name), (values), (n)); } while (0)
+#define LOG_HEX(level, name, data, len)	do { if (LOG_ON(level)) log_hex(PSTR(name), (data), (len)); } while (0)
+
+#endif
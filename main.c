@@ -1,75 +1,531 @@
 #include <avr/io.h>
+#include <stdlib.h>
 #include <freefare.h>
 #include <nfcPN532.h>
+#include "trace.h"
+#include "bench.h"
+#include "keydiv.h"
+#include "sched.h"
+#include "tick.h"
+#include "pool.h"
+#include "stack.h"
+#include "log.h"
+#include "journal.h"
+#include "denylist.h"
+#include "uart.h"
 
 #define IKAFKAPAYMENT_AID 				0xf7
 #define IKAFKAPAYMENT_VALFILENO 	1
 #define IKAFKAPAYMENT_DEBITVALUE	100
 
-nfc_device* openNfcDevice(void){
+// Card detection is left to the PN532 (InAutoPoll): NFC_POLL_COUNT rounds
+// (0xFF = endless) every NFC_POLL_PERIOD * 150 ms
+#define NFC_POLL_COUNT				0xFF
+#define NFC_POLL_PERIOD				1
+
+// Serial commands: 'J' sends the journal back (journal.h), 'D' or 'A'
+// followed by a 7 byte UID denies or allows a card, 'C' drops those
+// entries again (denylist.h, tools/denylist.c sends them)
+#define CMD_JOURNAL_EXPORT			'J'
+#define CMD_DENY					'D'
+#define CMD_ALLOW					'A'
+#define CMD_CLEAR					'C'
+
+// A card is debited once per tap. Its session then stays open, connected
+// and authenticated, as long as it is in the field, and the reader only
+// checks that it is still there: the card is not charged again however
+// long it is held. A denied card is watched the same way, without a
+// session, so it is not read again while it is held. Once all cards of
+// the tap have left, the reader polls for the next one. Stacked cards are
+// activated together, the PN532 inlists up to two, and each gets its own
+// session.
+#define CARD_SESSIONS		PN532_MAX_TARGETS
+
+typedef struct {
+	// NULL while the card has no open session
+	MifareTag tag;
+	nfc_target target;
+	// the card is in the field, checked for until it leaves
+	bool present;
+} card_session;
+
+// What the next run of a reader task does. A tap is taken a step per run,
+// each step one or two exchanges with a card, and the task posts itself
+// again for the next one.
+typedef enum {
+	// InAutoPoll runs, or is to be started
+	READER_POLL,
+	// the steps of the tap for the card in reader.card
+	READER_OPEN,
+	READER_AUTH,
+	READER_DEBIT,
+	// the cards of the tap are done and only watched until they leave
+	READER_WATCH
+} reader_step;
+
+// Every PN532 is served by a task of its own, posted once per ms by the
+// tick. While no card is in its field the PN532 polls by itself and the
+// task only looks for the result, so a tap on one reader is picked up
+// while another one is busy with its cards: the scheduler runs the other
+// readers between the steps of a tap. With PN532_USE_IRQ a polling reader
+// is only posted when its IRQ line changes, not by the tick.
+typedef struct {
+	nfc_device *d;
+	uint8_t task_id;
+	// InAutoPoll is running, read by the IRQ hook
+	volatile bool polling;
+	reader_step step;
+	// the card of the tap the step is for
+	uint8_t card;
+	MifareTag *session_tags;
+	card_session sessions[CARD_SESSIONS];
+} reader;
+
+static reader readers[PN532_READERS];
+static uint8_t reader_count;
+static uint8_t background_task_id;
+// the payment application, the same for every card
+static MifareDESFireAID payment_aid;
+static uint8_t key_data[16]  = {0xf9,0x28,0x7d,0x1f,0xe8,0xb0,0xf2,0xf2,0x70,0xf0,0xe1,0x9f,0x05,0x8a,0xe0,0x51};
+#ifdef TRACE
+static uint8_t trace_task_id;
+// the UART buffer ran full, the tick posts trace_task for the rest
+static volatile bool trace_dumping;
+#endif
+
+// Opens all PN532s there are, returns how many
+static uint8_t openNfcDevices(void){
 	nfc_context *context;
-	nfc_connstring devices[8];
-	size_t device_count;
+	nfc_connstring devices[PN532_READERS];
+	size_t device_count, i;
+	uint8_t n = 0;
 	
-	/*nfc_init (&context);
-  if (context == NULL)
-		return -1;
-	device_count = nfc_list_devices (context, devices, 8);
-	if (device_count <= 0)
-		return NULL;
-	return nfc_open (context, devices[0]);*/
-	Adafruit_PN532_begin();
-	Adafruit_PN532_setPassiveActivationRetries(0xFF);
-	//SAMConfig();
-	return NULL;
+	nfc_init (&context);
+	if (context == NULL)
+		return 0;
+	device_count = nfc_list_devices (context, devices, PN532_READERS);
+	for (i = 0; i < device_count; i++) {
+		if ((readers[n].d = nfc_open (context, devices[i])))
+			n++;
+	}
+	return n;
 }
- 
-int main (void) {
- 
-  int res;
-	unsigned char* uid;
-	uint8_t key_data[16]  = {0xf9,0x28,0x7d,0x1f,0xe8,0xb0,0xf2,0xf2,0x70,0xf0,0xe1,0x9f,0x05,0x8a,0xe0,0x51};
-	uint8_t buffer[512];
-	nfc_device *d;
-	MifareTag tag;
-	MifareDESFireAID aid;
+
+#ifdef TRACE
+// Sends the trace of the last tap, while the readers wait for the next
+// card, a piece per run as the UART buffer has room
+static void trace_task(void *arg){
+	sched_stats_t stats;
+	uint8_t id;
+	int32_t v[4];
+	
+	trace_dumping = TRACE_DUMP();
+	if (trace_dumping)
+		return;
+	for (id = 0; id <= readers[reader_count - 1].task_id; id++) {
+		sched_stats(id, &stats);
+		// id, runs, max latency and max run in us
+		v[0] = id;
+		v[1] = stats.runs;
+		v[2] = stats.max_latency * 1000 / (TRACE_TICK_HZ / 1000);
+		v[3] = stats.max_run * 1000 / (TRACE_TICK_HZ / 1000);
+		LOG_INTS(LOG_DEBUG, "Task", v, 4);
+	}
+}
+#endif
+
+// Peak use of the allocation pools and of the stack, a pool that ran full
+// shows as overflows
+static void mem_report(void){
+	pool_stats_t stats;
+	int32_t v[4];
+	uint8_t i;
+	
+	for (i = 0; i < POOL_CLASSES; i++) {
+		pool_stats(i, &stats);
+		// block size, blocks used, of, peak
+		v[0] = stats.size;
+		v[1] = stats.used;
+		v[2] = stats.count;
+		v[3] = stats.peak;
+		LOG_INTS(LOG_DEBUG, "Pool", v, 4);
+	}
+	LOG_INT(LOG_DEBUG, "Pool overflows", pool_overflows());
+	// peak and never used bytes
+	v[0] = stack_peak();
+	v[1] = stack_unused();
+	LOG_INTS(LOG_DEBUG, "Stack", v, 2);
+}
+
+static const nfc_modulation nmMifare = { .nmt = NMT_ISO14443A, .nbr = NBR_106 };
+
+static void session_end(card_session *s){
+	if (!s->tag)
+		return;
+	mifare_desfire_disconnect (s->tag);
+	s->tag = NULL;
+}
+
+// Frees the tags once all cards have left
+static bool sessions_left(reader *r){
+	uint8_t i;
+	
+	for (i = 0; i < CARD_SESSIONS; i++) {
+		if (r->sessions[i].present)
+			return true;
+	}
+	freefare_free_tags (r->session_tags);
+	r->session_tags = NULL;
+	return false;
+}
+
+static uint8_t hex_nibble(char c){
+	return (c <= '9') ? c - '0' : (c | 0x20) - 'a' + 10;
+}
+
+// freefare_get_tag_uid hands out the UID as hex string
+static uint8_t uid_from_hex(const char *hex, uint8_t *uid, uint8_t size){
+	uint8_t n;
+	
+	for (n = 0; n < size && hex[0] && hex[1]; n++, hex += 2)
+		uid[n] = hex_nibble(hex[0]) << 4 | hex_nibble(hex[1]);
+	return n;
+}
+
+// Connects to one of the cards just polled and selects the payment
+// application
+static bool session_open(reader *r, card_session *s, MifareTag tag){
+	int res;
+	char* uid;
+	uint8_t uid_bytes[10];
+	uint8_t uid_len;
+	
+	TRACE_BEGIN(TRACE_GETUID, 0);
+	uid = freefare_get_tag_uid(tag);
+	TRACE_FINISH(TRACE_GETUID, 0);
+	if (!uid)
+		return false;
+	uid_len = uid_from_hex(uid, uid_bytes, sizeof(uid_bytes));
+	free (uid);
+	LOG_HEX(LOG_INFO, "UID", uid_bytes, uid_len);
+	// routes the following exchanges to this card and fills in the
+	// target, it is inlisted, so this needs no RF round trip
+	if (nfc_initiator_select_passive_target(r->d, nmMifare, uid_bytes, uid_len, &s->target) <= 0)
+		return false;
+	// from here on the card is watched until it leaves. A session that
+	// fails disconnects, that deselects the card and the next presence
+	// check lets it go, to be read again.
+	s->present = true;
+	// known bad cards are turned away before any crypto
+	if (denylist_denied(uid_bytes, uid_len)) {
+		LOG_TEXT(LOG_INFO, "Denied");
+		return false;
+	}
+	s->tag = tag;
+
+	TRACE_BEGIN(TRACE_CONNECT, 0);
+	res = mifare_desfire_connect (s->tag);
+	TRACE_FINISH(TRACE_CONNECT, res);
+	LOG_INT(LOG_INFO, "Connect", res);
+	if (res < 0) {
+		session_end(s);
+		return false;
+	}
+	LOG_INT(LOG_DEBUG, "Bit rate kbps", 106u << (s->target.nm.nbr - NBR_106));
+
+	TRACE_BEGIN(TRACE_SELECT, 0);
+	res = mifare_desfire_select_application (s->tag, payment_aid);
+	TRACE_FINISH(TRACE_SELECT, res);
+	LOG_INT(LOG_INFO, "Select App", res);
+	// no key derivation and authentication for a card that failed
+	if (res < 0) {
+		session_end(s);
+		return false;
+	}
+	return true;
+}
+
+// Authenticates the card of an open session with its diversified key
+static bool session_auth(card_session *s){
+	int res;
 	MifareDESFireKey key;
-	printf("This is test");
-  MifareTag *tags = NULL;
-  
-	d = openNfcDevice();
-	  
-	if (!d) {
-		return -1;
+	uint8_t card_key[16];
+	keydiv_stats_t keydiv;
+	int32_t v[2];
+	
+	//Key berechnen
+	TRACE_BEGIN(TRACE_KEYDIV, 0);
+	keydiv_derive(s->target.nti.nai.abtUid, s->target.nti.nai.szUidLen, IKAFKAPAYMENT_AID, card_key);
+	TRACE_FINISH(TRACE_KEYDIV, 0);
+	// cached and derived keys
+	keydiv_stats(&keydiv);
+	v[0] = keydiv.hits;
+	v[1] = keydiv.misses;
+	LOG_INTS(LOG_DEBUG, "Keys", v, 2);
+
+	key = mifare_desfire_aes_key_new (card_key);
+	TRACE_BEGIN(TRACE_AUTH, 0);
+	res = mifare_desfire_authenticate (s->tag, 1, key);
+	TRACE_FINISH(TRACE_AUTH, res);
+	LOG_INT(LOG_INFO, "Auth", res);
+	mifare_desfire_key_free (key);
+	if (res < 0) {
+		session_end(s);
+		return false;
 	}
-	while(1) {	
-		tags = freefare_get_tags(d);
-		while (!(tags[0])){
-			freefare_free_tags (tags);
-			tags = freefare_get_tags(d);
-		}
-		tag = tags[0];
+	return true;
+}
 
-		res = mifare_desfire_connect (tag);
-		printf("Connect: %i\n", res);
+// Debits the card of an open session, the PN532 talks to it
+static void session_transaction(reader *r, card_session *s){
+	int res;
 	
-		aid = mifare_desfire_aid_new (IKAFKAPAYMENT_AID);
-		res = mifare_desfire_select_application (tag, aid);
-		printf("Select App: %i\n", res);
+	TRACE_BEGIN(TRACE_DEBIT, 0);
+	res = mifare_desfire_debit_ex (s->tag, IKAFKAPAYMENT_VALFILENO, IKAFKAPAYMENT_DEBITVALUE, MDCM_ENCIPHERED);
+	TRACE_FINISH(TRACE_DEBIT, res);
+	if (res >= 0) {
+		TRACE_BEGIN(TRACE_COMMIT, 0);
+		res = mifare_desfire_commit_transaction (s->tag);
+		TRACE_FINISH(TRACE_COMMIT, res);
+	}
+	// only queued, the journal task writes it in the background
+	if (!journal_add(s->target.nti.nai.abtUid, s->target.nti.nai.szUidLen, IKAFKAPAYMENT_DEBITVALUE, res < -128 ? -128 : res, r - readers))
+		LOG_INT(LOG_ERROR, "Journal lost", journal_lost());
+	// an error ends the authentication on the card
+	if (res < 0) {
+		TRACE_BEGIN(TRACE_DISCONNECT, 0);
+		session_end(s);
+		TRACE_FINISH(TRACE_DISCONNECT, 0);
+	}
+}
+
+// Starts the next poll, the following runs look for its result. Polling
+// is set first, the IRQ of the ACK may come before poll_start returns.
+static void reader_poll(reader *r){
+	r->polling = true;
+	r->polling = nfc_initiator_poll_start (r->d, &nmMifare, 1, NFC_POLL_COUNT, NFC_POLL_PERIOD) == NFC_SUCCESS;
+}
+
+// ms tick hook. A reader busy with its cards is not started again, its
+// post is taken up once it is done.
+static void readers_tick(void){
+	uint8_t i;
 	
-		uid = freefare_get_tag_uid(tag);
-		printf("GetUid: %i\n", res);
-		printf("%i %i %i %i %i %i\n", uid[0], uid[1], uid[2], uid[3], uid[4], uid[5]);
+	for (i = 0; i < reader_count; i++) {
+		#ifdef PN532_USE_IRQ
+			// left to readers_irq, the tick would read the status for nothing
+			if (readers[i].polling)
+				continue;
+		#endif
+		sched_post(readers[i].task_id);
+	}
+	sched_post(background_task_id);
+	#ifdef TRACE
+		if (trace_dumping)
+			sched_post(trace_task_id);
+	#endif
+}
+
+#ifdef PN532_USE_IRQ
+// IRQ hook, a PN532 has a frame ready: the ACK of the poll or a card. The
+// polling readers look, for them that is reading their IRQ line.
+static void readers_irq(void){
+	uint8_t i;
 	
-		//Key berechnen
+	for (i = 0; i < reader_count; i++) {
+		if (readers[i].polling)
+			sched_post(readers[i].task_id);
+	}
+}
+#endif
+
+// Takes the serial commands as their bytes come in. A denylist change
+// counts at once, denylist_flush writes it later.
+static void console_poll(void){
+	static uint8_t cmd, len, uid[DENYLIST_UID_LEN];
+	int16_t c;
 	
-		key = mifare_desfire_aes_key_new (key_data);
-		res = mifare_desfire_authenticate (tag, 1, key);
-		printf("Auth: %i\n", res);
+	while ((c = uart_getc()) >= 0) {
+		if (cmd) {
+			uid[len++] = c;
+			if (len < DENYLIST_UID_LEN)
+				continue;
+			if (!denylist_set(uid, cmd == CMD_DENY))
+				LOG_TEXT(LOG_ERROR, "Denylist full");
+			LOG_INT(LOG_INFO, "Denylist overlay", denylist_overlay_size());
+			cmd = 0;
+		} else if (c == CMD_DENY || c == CMD_ALLOW) {
+			cmd = c;
+			len = 0;
+		} else if (c == CMD_CLEAR) {
+			denylist_clear();
+			LOG_INT(LOG_INFO, "Denylist overlay", denylist_overlay_size());
+		} else if (c == CMD_JOURNAL_EXPORT) {
+			journal_export();
+		}
+	}
+}
+
+// Lowest priority, runs when no reader has anything to do: serves the
+// serial commands, sends the next piece of a journal export and writes
+// the denylist changes, the cached card keys and the journal to EEPROM
+// a byte at a time. It may run while a reader waits for its PN532, none
+// of this waits for the UART or the EEPROM.
+static void background_task(void *arg){
+	console_poll();
+	journal_export_next();
+	denylist_flush();
+	keydiv_flush();
+	journal_flush();
+}
+
+// The cards of the tap are done, they are watched until they leave
+static void reader_tap_end(reader *r){
+	// frees the tags when no card has a session left
+	r->step = sessions_left(r) ? READER_WATCH : READER_POLL;
+	TRACE_FINISH(TRACE_TAP, r - readers);
+	// the tap is over, whether its cards are still held or not
+	mem_report();
+	#ifdef TRACE
+		sched_post(trace_task_id);
+	#endif
+}
+
+// Moves the tap on to its next card, or ends it
+static void reader_next_card(reader *r){
+	if (++r->card < CARD_SESSIONS && r->session_tags[r->card]) {
+		r->step = READER_OPEN;
+		return;
+	}
+	reader_tap_end(r);
+}
+
+// One transaction per card that enters the field of reader arg, later
+// runs only check it is still there. Polling does not block, a tap is
+// taken a step at a time: each run does one step and posts the task
+// again, so between two steps the other readers and the background run.
+// They never run inside this reader's waits for the PN532.
+static void reader_task(void *arg){
+	reader *r = arg;
+	uint8_t id = r - readers;
+	card_session *s = &r->sessions[r->card];
+	int res;
+	nfc_target nt;
+	uint8_t i;
 	
-		res = mifare_desfire_debit_ex (tag, IKAFKAPAYMENT_VALFILENO, IKAFKAPAYMENT_DEBITVALUE, MDCM_ENCIPHERED);
-		res = mifare_desfire_commit_transaction (tag);
-		
-		return 0;
+	switch (r->step) {
+	case READER_POLL:
+		if (!r->polling) {
+			reader_poll(r);
+			return;
+		}
+		// the PN532 reports a card in the field
+		res = nfc_initiator_poll_result (r->d, &nt);
+		if (res == 0)
+			return;
+		r->polling = false;
+		if (res < 0) {
+			reader_poll(r);
+			return;
+		}
+		TRACE_BEGIN(TRACE_TAP, id);
+		// picks up the polled targets without another InListPassiveTarget
+		TRACE_BEGIN(TRACE_GETTAGS, id);
+		r->session_tags = freefare_get_tags(r->d);
+		TRACE_FINISH(TRACE_GETTAGS, 0);
+		r->card = 0;
+		if (!r->session_tags || !r->session_tags[0]) {
+			// nothing to read, the next run polls again
+			reader_tap_end(r);
+			return;
+		}
+		r->step = READER_OPEN;
+		break;
+	case READER_OPEN:
+		if (session_open(r, s, r->session_tags[r->card]))
+			r->step = READER_AUTH;
+		else
+			reader_next_card(r);
+		break;
+	case READER_AUTH:
+		if (session_auth(s))
+			r->step = READER_DEBIT;
+		else
+			reader_next_card(r);
+		break;
+	case READER_DEBIT:
+		session_transaction(r, s);
+		reader_next_card(r);
+		break;
+	case READER_WATCH:
+		for (i = 0; i < CARD_SESSIONS; i++) {
+			if (!r->sessions[i].present)
+				continue;
+			TRACE_BEGIN(TRACE_PRESENCE, id);
+			res = nfc_initiator_target_is_present(r->d, &r->sessions[i].target);
+			TRACE_FINISH(TRACE_PRESENCE, res);
+			if (res < 0) {
+				session_end(&r->sessions[i]);
+				r->sessions[i].present = false;
+			}
+		}
+		if (!sessions_left(r)) {
+			r->step = READER_POLL;
+			reader_poll(r);
+		}
+		return;
 	}
-}
\ No newline at end of file
+	// the next step of the tap, once the other readers had their turn
+	sched_post(r->task_id);
+}
+ 
+int main (void) {
+	uint8_t i;
+	
+	// the log, the journal export and the denylist commands, also in
+	// builds without logging
+	uart_init();
+	LOG_INIT();
+	LOG_TEXT(LOG_INFO, "This is test");
+  
+	TRACE_INIT();
+	BENCH_RUN();
+	reader_count = openNfcDevices();
+	  
+	if (!reader_count) {
+		return -1;
+	}
+	// key_data is the master key the card keys are diversified from
+	keydiv_init(key_data);
+	payment_aid = mifare_desfire_aid_new (IKAFKAPAYMENT_AID);
+	// picks up after the newest record that made it to the EEPROM
+	journal_init();
+	LOG_INT(LOG_INFO, "Journal", journal_count());
+	denylist_init();
+	LOG_INT(LOG_INFO, "Denylist table", denylist_size());
+	
+	// Tasks in order of priority, the readers and the background come last.
+	// While a reader waits for its PN532 the driver runs the trace and the
+	// background, the other readers wait for their turn.
+	#ifdef TRACE
+		trace_task_id = sched_add(trace_task, NULL);
+	#endif
+	for (i = 0; i < reader_count; i++)
+		readers[i].task_id = sched_add(reader_task, &readers[i]);
+	background_task_id = sched_add(background_task, NULL);
+	// the last one added fails first
+	if (background_task_id == SCHED_NO_TASK) {
+		LOG_TEXT(LOG_ERROR, "Too many tasks");
+		return -1;
+	}
+	for (i = 0; i < reader_count; i++)
+		sched_waits(readers[i].task_id);
+	Adafruit_PN532_setIdleHook(sched_idle);
+	#ifdef PN532_USE_IRQ
+		Adafruit_PN532_setIrqHook(readers_irq);
+	#endif
+	tick_set_hook(readers_tick);
+	while(1) {
+		sched_run();
+	}
+}
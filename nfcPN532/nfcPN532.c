@@ -42,83 +42,142 @@
              uint8_t mifareultralight_ReadPage (uint8_t page, uint8_t * buffer)	
 */
 /**************************************************************************/
+#ifndef F_CPU
+	#define F_CPU F_OSC
+#endif
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/delay.h>
 #include "nfcPN532.h"
-
-byte pn532ack[] = {0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00};
-byte pn532response_firmwarevers[] = {0x00, 0xFF, 0x06, 0xFA, 0xD5, 0x03};
+#include <avr/pgmspace.h>
+#include "spi.h"
+#include "tick.h"
+#include "trace.h"
 
 // Uncomment these lines to enable debug output for PN532(SPI) and/or MIFARE related code
 // #define PN532DEBUG
 // #define MIFAREDEBUG
 
-// Hardware SPI-specific configuration:
-#define PN532_SPI_SETTING SPISettings(1000000, LSBFIRST, SPI_MODE0)
-#define PN532_SPI_CLOCKDIV SPI_CLOCK_DIV16
-
-#define PN532_PACKBUFFSIZ 64
-byte pn532_packetbuffer[PN532_PACKBUFFSIZ];
+// Hardware SPI-specific configuration (mode 0, LSB first, F_OSC / 2) is
+// done by spi_init(), see spi.h
 
 #ifndef _BV
     #define _BV(bit) (1<<(bit))
 #endif
 
 
-/**************************************************************************/
-/*! 
-    @brief  Instantiates a new PN532 class using hardware SPI.
-
-    @param  ss        SPI chip select pin (CS/SSEL)
-*/
-/**************************************************************************/
-uint8_t _ss;
 #define LOW 0
 #define HIGH 1
 #define true 1
 #define false 0
-uint8_t _inListedTag;
 
-void Adafruit_PN532_Adafruit_PN532(uint8_t ss){
- /* _clk(0),
-  _miso(0),
-  _mosi(0),
-  _ss(ss),
-  _irq(0),
-  _reset(0),
-  _usingSPI(true),
-  _hardwareSPI(true)
-{
-  pinMode(_ss, OUTPUT);
-}*/
+// Shared by all PN532s, the state of each one is in its pn532_dev_t
+static bool (*_idleHook)(void);
+#ifdef PN532_USE_IRQ
+static void (*_irqHook)(void);
+#endif
+
+// Response deadlines in ms, counted from writing the command. A command
+// gets twice its slowest recent response plus PN532_DEADLINE_MARGIN, but
+// no less than its floor. The floors are the p99 response times seen
+// with tools/tracedecode plus headroom, InDataExchange covers the frame
+// waiting time of a DESFire EV1 (FWI 8, 77 ms). The caller's timeout
+// stays the upper bound, commands not listed only have that.
+typedef struct {
+  uint8_t command;
+  uint8_t floor;
+} pn532_deadline_t;
+
+static const pn532_deadline_t _deadlines[] PROGMEM = {
+  { PN532_COMMAND_GETFIRMWAREVERSION,  10 },
+  { PN532_COMMAND_SAMCONFIGURATION,    10 },
+  { PN532_COMMAND_RFCONFIGURATION,     10 },
+  { PN532_COMMAND_INLISTPASSIVETARGET, 60 },
+  { PN532_COMMAND_INDATAEXCHANGE,      100 },
+  { PN532_COMMAND_INDESELECT,          20 },
+  { PN532_COMMAND_INSELECT,            20 },
+  { PN532_COMMAND_INPSL,               20 },
+  { PN532_COMMAND_DIAGNOSE,            20 },
+};
+_Static_assert(sizeof(_deadlines) / sizeof(_deadlines[0]) == PN532_DEADLINES, "PN532_DEADLINES does not match _deadlines");
+#define PN532_DEADLINE_MARGIN 5
+
+static void Adafruit_PN532_advanceCommand(pn532_dev_t *dev);
+static void Adafruit_PN532_response(pn532_dev_t *dev, uint8_t command, uint16_t ms);
+static bool Adafruit_PN532_waitsince(pn532_dev_t *dev, uint16_t start, uint16_t timeout);
+static bool Adafruit_PN532_runCommand(pn532_dev_t *dev, const uint8_t *cmd, uint8_t cmdlen, const uint8_t *data, uint16_t datalen, uint16_t timeout);
+bool Adafruit_PN532_isready(pn532_dev_t *dev);
+
+#ifdef PN532_USE_IRQ
+// Wakes the CPU from sleep and tells the IRQ hook, the IRQ line itself
+// tells which PN532 is ready
+ISR(PN532_IRQ_vect) {
+  if (_irqHook)
+    _irqHook();
+}
+
+#if PN532_READERS > 1
+// Both edges of the other PN532s' lines, the hook looks at the levels
+ISR(PN532_PCINT_vect) {
+  if (_irqHook)
+    _irqHook();
+}
+#endif
+#endif
+
+/**************************************************************************/
+/*! 
+    @brief  Instantiates a new PN532 using hardware SPI. One MCU drives
+            several of them, each on its own chip select (and IRQ) line.
+
+    @param  dev       Context of this PN532, used by all driver calls
+    @param  pins      Its chip select and IRQ lines
+*/
+/**************************************************************************/
+void Adafruit_PN532_Adafruit_PN532(pn532_dev_t *dev, const pn532_pins_t *pins){
+  memset(dev, 0, sizeof(*dev));
+  dev->pins = pins;
 }
 /**************************************************************************/
 /*! 
     @brief  Setups the HW
 */
 /**************************************************************************/
-void Adafruit_PN532_begin(void) {
-	SPI_begin();
-	//SPI_setDataMode(SPI_MODE0);
-	//SPI_setBitOrder(LSBFIRST);
-	//SPI_setClockDivider(PN532_SPI_CLOCKDIV);
-
-	#ifdef SPI_HAS_TRANSACTION
-		//SPI_beginTransaction(PN532_SPI_SETTING);
+void Adafruit_PN532_begin(pn532_dev_t *dev) {
+	spi_init();
+	tick_init();
+	#ifdef PN532_USE_IRQ
+		// IRQ pin as input with pull-up, the wake-up interrupt on the
+		// falling edge
+		*dev->pins->irq_ddr &= ~_BV(dev->pins->irq_bit);
+		*dev->pins->irq_port |= _BV(dev->pins->irq_bit);
+		if (dev->pins->irq_pin == &PN532_IRQ_PIN) {
+			EICRA = (EICRA & ~(_BV(PN532_IRQ_ISC0) | _BV(PN532_IRQ_ISC1))) | _BV(PN532_IRQ_ISC1);
+			EIFR = _BV(PN532_IRQ_INTF);
+			EIMSK |= _BV(PN532_IRQ_INT);
+		} else {
+			PN532_PCINT_MSK |= _BV(dev->pins->irq_bit);
+			PCICR |= _BV(PN532_PCINT_IE);
+		}
+		sei();
 	#endif
 
-	digitalWrite(_ss, LOW);
+	// NSS idles high, then is held low to power up and wake the PN532
+	PN532_DESELECT(dev);
+	*dev->pins->ss_ddr |= _BV(dev->pins->ss_bit);
+	PN532_SELECT(dev);
 	
-	delay(1000);
+	_delay_ms(1000);
 
 	// not exactly sure why but we have to send a dummy command to get synced up
-	pn532_packetbuffer[0] = PN532_COMMAND_GETFIRMWAREVERSION;
-	Adafruit_PN532_sendCommandCheckAck(pn532_packetbuffer, 1, 1000);
+	dev->packetbuffer[0] = PN532_COMMAND_GETFIRMWAREVERSION;
+	Adafruit_PN532_sendCommandCheckAck(dev, dev->packetbuffer, 1, 1000);
 
 	// ignore response!
 
-	digitalWrite(_ss, HIGH);
-	#ifdef SPI_HAS_TRANSACTION
-		SPI_endTransaction();
-	#endif
+	PN532_DESELECT(dev);
 }
 
 /**************************************************************************/
@@ -128,33 +187,30 @@ void Adafruit_PN532_begin(void) {
     @returns  The chip's firmware version and ID
 */
 /**************************************************************************/
-uint32_t Adafruit_PN532_getFirmwareVersion(void) {
+uint32_t Adafruit_PN532_getFirmwareVersion(pn532_dev_t *dev) {
   uint32_t response;
 
-  pn532_packetbuffer[0] = PN532_COMMAND_GETFIRMWAREVERSION;
+  dev->packetbuffer[0] = PN532_COMMAND_GETFIRMWAREVERSION;
   
-  if (! Adafruit_PN532_sendCommandCheckAck(pn532_packetbuffer, 1, 1000))
+  if (! Adafruit_PN532_sendCommandCheckAck(dev, dev->packetbuffer, 1, 1000))
     return 0;
   
-  // read data packet
-  Adafruit_PN532_readdata(pn532_packetbuffer, 12);
-  
-  // check some basic stuff
-  if (0 != strncmp((char *)pn532_packetbuffer, (char *)pn532response_firmwarevers, 6)) {
+  // read data packet: IC, Ver, Rev, Support
+  if (Adafruit_PN532_readframe(dev, PN532_COMMAND_GETFIRMWAREVERSION, dev->packetbuffer, 4, NULL, NULL) != PN532_FRAME_DATA) {
     #ifdef PN532DEBUG
       Serial.println(F("Firmware doesn't match!"));
     #endif
     return 0;
   }
   
-  int offset = 6;  // Skip a response byte when using I2C to ignore extra data.
-  response = pn532_packetbuffer[offset++];
+  int offset = 0;
+  response = dev->packetbuffer[offset++];
   response <<= 8;
-  response |= pn532_packetbuffer[offset++];
+  response |= dev->packetbuffer[offset++];
   response <<= 8;
-  response |= pn532_packetbuffer[offset++];
+  response |= dev->packetbuffer[offset++];
   response <<= 8;
-  response |= pn532_packetbuffer[offset++];
+  response |= dev->packetbuffer[offset++];
 
   return response;
 }
@@ -173,38 +229,222 @@ uint32_t Adafruit_PN532_getFirmwareVersion(void) {
 */
 /**************************************************************************/
 // default timeout of one second
-bool Adafruit_PN532_sendCommandCheckAck(uint8_t *cmd, uint8_t cmdlen, uint16_t timeout) {
-  uint16_t timer = 0;
-  
-  // write the command
-  Adafruit_PN532_writecommand(cmd, cmdlen);
+bool Adafruit_PN532_sendCommandCheckAck(pn532_dev_t *dev, uint8_t *cmd, uint8_t cmdlen, uint16_t timeout) {
+  return Adafruit_PN532_sendCommandDataCheckAck(dev, cmd, cmdlen, NULL, 0, timeout);
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Sends a command followed by a block of data and waits a
+            specified period for the ACK
+
+    @param  cmd       Pointer to the command buffer
+    @param  cmdlen    The size of the command in bytes 
+    @param  data      Pointer to the data following the command
+    @param  datalen   The size of the data in bytes 
+    @param  timeout   timeout before giving up
+    
+    @returns  1 if everything is OK, 0 if timeout occured before an
+              ACK was recieved
+*/
+/**************************************************************************/
+bool Adafruit_PN532_sendCommandDataCheckAck(pn532_dev_t *dev, const uint8_t *cmd, uint8_t cmdlen, const uint8_t *data, uint16_t datalen, uint16_t timeout) {
+  if (timeout != 0)
+    timeout = Adafruit_PN532_deadline(dev, cmd[0], timeout);
+  return Adafruit_PN532_runCommand(dev, cmd, cmdlen, data, datalen, timeout);
+}
+
+// Sends a command and waits for its ACK and response, timeout ms at most
+// as it is, without the command's deadline
+static bool Adafruit_PN532_runCommand(pn532_dev_t *dev, const uint8_t *cmd, uint8_t cmdlen, const uint8_t *data, uint16_t datalen, uint16_t timeout) {
+  Adafruit_PN532_startCommand(dev, cmd, cmdlen, data, datalen);
   
-  // Wait for chip to say its ready!
-  if (!Adafruit_PN532_waitready(timeout)) {
-    return false;
+  // Wait for chip to say its ready, once for the ACK and once for the
+  // response, both within the deadline
+  while (dev->cmdState == PN532_CMD_WAIT_ACK || dev->cmdState == PN532_CMD_WAIT_RESPONSE) {
+    if (!Adafruit_PN532_waitsince(dev, dev->cmdStart, timeout)) {
+      // don't let the PN532 keep the card busy, the next command can go
+      // out right away
+      Adafruit_PN532_abort(dev);
+      dev->cmdState = PN532_CMD_FAILED;
+      return false;
+    }
+    Adafruit_PN532_advanceCommand(dev);
   }
 
   #ifdef PN532DEBUG
-    if (!_usingSPI) {
-      Serial.println(F("IRQ received"));
+    if (dev->cmdState != PN532_CMD_READY) {
+      Serial.println(F("No ACK frame received!"));
     }
   #endif
+  return dev->cmdState == PN532_CMD_READY; // ack'd command
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Starts a command without waiting for the PN532. The command
+            is then progressed by Adafruit_PN532_pollCommand until its
+            response can be read with Adafruit_PN532_readframe.
+
+    @param  cmd       Pointer to the command buffer
+    @param  cmdlen    The size of the command in bytes 
+    @param  data      Pointer to the data following the command
+    @param  datalen   The size of the data in bytes 
+*/
+/**************************************************************************/
+void Adafruit_PN532_startCommand(pn532_dev_t *dev, const uint8_t *cmd, uint8_t cmdlen, const uint8_t *data, uint16_t datalen) {
+  dev->cmdCode = cmd[0];
+  dev->cmdStart = tick_ms();
   
-  // read acknowledgement
-  if (!Adafruit_PN532_readack()) {
-    #ifdef PN532DEBUG
-      Serial.println(F("No ACK frame received!"));
-    #endif
-    return false;
+  // write the command
+  TRACE_BEGIN(TRACE_PN532_WRITE, dev->cmdCode);
+  Adafruit_PN532_writecommanddata(dev, cmd, cmdlen, data, datalen);
+  TRACE_FINISH(TRACE_PN532_WRITE, dev->cmdCode);
+  
+  TRACE_BEGIN(TRACE_PN532_ACK, dev->cmdCode);
+  dev->cmdState = PN532_CMD_WAIT_ACK;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Takes the started command one step further, once the PN532
+            has said it is ready
+*/
+/**************************************************************************/
+static void Adafruit_PN532_advanceCommand(pn532_dev_t *dev) {
+  switch (dev->cmdState) {
+  case PN532_CMD_WAIT_ACK:
+    // read acknowledgement
+    if (!Adafruit_PN532_readack(dev)) {
+      dev->cmdState = PN532_CMD_FAILED;
+      break;
+    }
+    TRACE_FINISH(TRACE_PN532_ACK, dev->cmdCode);
+    // For SPI only wait for the chip to be ready again.
+    TRACE_BEGIN(TRACE_PN532_READY, dev->cmdCode);
+    dev->cmdState = PN532_CMD_WAIT_RESPONSE;
+    break;
+  case PN532_CMD_WAIT_RESPONSE:
+    TRACE_FINISH(TRACE_PN532_READY, dev->cmdCode);
+    Adafruit_PN532_response(dev, dev->cmdCode, tick_elapsed(dev->cmdStart));
+    dev->cmdState = PN532_CMD_READY;
+    break;
+  default:
+    break;
   }
+}
 
-  // For SPI only wait for the chip to be ready again.
-  // This is unnecessary with I2C.
-  if (!Adafruit_PN532_waitready(timeout)) {
-    return false;
+/**************************************************************************/
+/*! 
+    @brief  Looks up the deadline of a command
+
+    @param  command   Command code
+    @param  timeout   Upper bound given by the caller
+
+    @returns  The deadline in ms
+*/
+/**************************************************************************/
+uint16_t Adafruit_PN532_deadline(pn532_dev_t *dev, uint8_t command, uint16_t timeout) {
+  uint16_t deadline;
+  uint8_t i;
+
+  for (i = 0; i < PN532_DEADLINES; i++) {
+    if (pgm_read_byte(&_deadlines[i].command) == command) {
+      deadline = 2 * dev->slowest[i] + PN532_DEADLINE_MARGIN;
+      if (deadline < pgm_read_byte(&_deadlines[i].floor))
+        deadline = pgm_read_byte(&_deadlines[i].floor);
+      if (deadline < timeout)
+        timeout = deadline;
+      break;
+    }
   }
-  
-  return true; // ack'd command
+  return timeout;
+}
+
+// Takes the response time of a command into its deadline
+static void Adafruit_PN532_response(pn532_dev_t *dev, uint8_t command, uint16_t ms) {
+  uint8_t i;
+
+  for (i = 0; i < PN532_DEADLINES; i++) {
+    if (pgm_read_byte(&_deadlines[i].command) == command) {
+      if (ms > dev->slowest[i])
+        dev->slowest[i] = ms;
+      else
+        dev->slowest[i] -= dev->slowest[i] >> 3;
+      break;
+    }
+  }
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Aborts the command the PN532 is working on by sending it an
+            ACK frame
+*/
+/**************************************************************************/
+void Adafruit_PN532_abort(pn532_dev_t *dev) {
+  static const uint8_t ack[] = { 0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00 };
+
+  PN532_SELECT(dev);
+  spi_write(PN532_SPI_DATAWRITE);
+  spi_write_burst(ack, sizeof(ack));
+  PN532_DESELECT(dev);
+  dev->cmdState = PN532_CMD_IDLE;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Progresses the command started by Adafruit_PN532_startCommand
+            without blocking
+
+    @returns  PN532_CMD_READY once the response is waiting to be read,
+              PN532_CMD_FAILED if the PN532 did not ACK the command or
+              missed the command's deadline
+*/
+/**************************************************************************/
+pn532_cmd_t Adafruit_PN532_pollCommand(pn532_dev_t *dev) {
+  if (dev->cmdState == PN532_CMD_WAIT_ACK || dev->cmdState == PN532_CMD_WAIT_RESPONSE) {
+    if (Adafruit_PN532_isready(dev)) {
+      Adafruit_PN532_advanceCommand(dev);
+    } else if (tick_elapsed(dev->cmdStart) > Adafruit_PN532_deadline(dev, dev->cmdCode, 0xFFFF)) {
+      Adafruit_PN532_abort(dev);
+      dev->cmdState = PN532_CMD_FAILED;
+    }
+  }
+  return dev->cmdState;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Sets the function run while waiting for the PN532
+
+    @param  hook      Called with interrupts disabled, and must return
+                      with them disabled. It returns false if there was
+                      nothing to do, the wait may then sleep until the
+                      next interrupt. It must not use the PN532 that
+                      is waited for, nor wait for another one: the
+                      waits would nest.
+*/
+/**************************************************************************/
+void Adafruit_PN532_setIdleHook(bool (*hook)(void)) {
+  _idleHook = hook;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Sets the function called from the IRQ interrupts, with
+            PN532_USE_IRQ
+
+    @param  hook      Called in interrupt context whenever the IRQ line
+                      of a PN532 falls (or, for all but the first
+                      PN532, changes), e.g. to post the task that waits
+                      for it
+*/
+/**************************************************************************/
+void Adafruit_PN532_setIrqHook(void (*hook)(void)) {
+  #ifdef PN532_USE_IRQ
+    _irqHook = hook;
+  #endif
 }
 
 
@@ -213,20 +453,17 @@ bool Adafruit_PN532_sendCommandCheckAck(uint8_t *cmd, uint8_t cmdlen, uint16_t t
     @brief  Configures the SAM (Secure Access Module)
 */
 /**************************************************************************/
-bool Adafruit_PN532_SAMConfig(void) {
-  pn532_packetbuffer[0] = PN532_COMMAND_SAMCONFIGURATION;
-  pn532_packetbuffer[1] = 0x01; // normal mode;
-  pn532_packetbuffer[2] = 0x14; // timeout 50ms * 20 = 1 second
-  pn532_packetbuffer[3] = 0x01; // use IRQ pin!
+bool Adafruit_PN532_SAMConfig(pn532_dev_t *dev) {
+  dev->packetbuffer[0] = PN532_COMMAND_SAMCONFIGURATION;
+  dev->packetbuffer[1] = 0x01; // normal mode;
+  dev->packetbuffer[2] = 0x14; // timeout 50ms * 20 = 1 second
+  dev->packetbuffer[3] = 0x01; // use IRQ pin!
   
-  if (! Adafruit_PN532_sendCommandCheckAck(pn532_packetbuffer, 4, 1000))
+  if (! Adafruit_PN532_sendCommandCheckAck(dev, dev->packetbuffer, 4, 1000))
     return false;
 
   // read data packet
-  Adafruit_PN532_readdata(pn532_packetbuffer, 8);
-  
-  int offset = 5;
-  return  (pn532_packetbuffer[offset] == 0x15);
+  return Adafruit_PN532_readframe(dev, PN532_COMMAND_SAMCONFIGURATION, NULL, 0, NULL, NULL) == PN532_FRAME_DATA;
 }
 
 /**************************************************************************/
@@ -239,21 +476,21 @@ bool Adafruit_PN532_SAMConfig(void) {
     @returns 1 if everything executed properly, 0 for an error
 */
 /**************************************************************************/
-bool Adafruit_PN532_setPassiveActivationRetries(uint8_t maxRetries) {
-  pn532_packetbuffer[0] = PN532_COMMAND_RFCONFIGURATION;
-  pn532_packetbuffer[1] = 5;    // Config item 5 (MaxRetries)
-  pn532_packetbuffer[2] = 0xFF; // MxRtyATR (default = 0xFF)
-  pn532_packetbuffer[3] = 0x01; // MxRtyPSL (default = 0x01)
-  pn532_packetbuffer[4] = maxRetries;
+bool Adafruit_PN532_setPassiveActivationRetries(pn532_dev_t *dev, uint8_t maxRetries) {
+  dev->packetbuffer[0] = PN532_COMMAND_RFCONFIGURATION;
+  dev->packetbuffer[1] = 5;    // Config item 5 (MaxRetries)
+  dev->packetbuffer[2] = 0xFF; // MxRtyATR (default = 0xFF)
+  dev->packetbuffer[3] = 0x01; // MxRtyPSL (default = 0x01)
+  dev->packetbuffer[4] = maxRetries;
 
   #ifdef MIFAREDEBUG
     Serial.print(F("Setting MxRtyPassiveActivation to ")); Serial.print(maxRetries, DEC); Serial.println(F(" "));
   #endif
   
-  if (! Adafruit_PN532_sendCommandCheckAck(pn532_packetbuffer, 5, 1000))
+  if (! Adafruit_PN532_sendCommandCheckAck(dev, dev->packetbuffer, 5, 1000))
     return 0x0;  // no ACK
   
-  return 1;
+  return Adafruit_PN532_readframe(dev, PN532_COMMAND_RFCONFIGURATION, NULL, 0, NULL, NULL) == PN532_FRAME_DATA;
 }
 
 /***** ISO14443A Commands ******/
@@ -271,12 +508,10 @@ bool Adafruit_PN532_setPassiveActivationRetries(uint8_t maxRetries) {
     @returns 1 if everything executed properly, 0 for an error
 */
 /**************************************************************************/
-bool Adafruit_PN532_readPassiveTargetID(uint8_t cardbaudrate, uint8_t * uid, uint8_t * uidLength, uint16_t timeout) {
-  pn532_packetbuffer[0] = PN532_COMMAND_INLISTPASSIVETARGET;
-  pn532_packetbuffer[1] = 1;  // max 1 cards at once (we can set this to 2 later)
-  pn532_packetbuffer[2] = cardbaudrate;
-  
-  if (!Adafruit_PN532_sendCommandCheckAck(pn532_packetbuffer, 3, timeout))
+bool Adafruit_PN532_readPassiveTargetID(pn532_dev_t *dev, uint8_t cardbaudrate, uint8_t * uid, uint8_t * uidLength, uint16_t timeout) {
+  uint8_t length = PN532_PACKBUFFSIZ;
+
+  if (!Adafruit_PN532_inListPassiveTargetData(dev, cardbaudrate, NULL, 0, dev->packetbuffer, &length, timeout))
   {
     #ifdef PN532DEBUG
       Serial.println(F("No card(s) read"));
@@ -284,46 +519,34 @@ bool Adafruit_PN532_readPassiveTargetID(uint8_t cardbaudrate, uint8_t * uid, uin
     return 0x0;  // no cards read
   }
 
-  // wait for a card to enter the field (only possible with I2C)
-    
-  // read data packet
-  Adafruit_PN532_readdata(pn532_packetbuffer, 20);
-  // check some basic stuff
-
-  /* ISO14443A card response should be in the following format:
+  /* ISO14443A target data should be in the following format:
   
     byte            Description
     -------------   ------------------------------------------
-    b0..6           Frame header and preamble
-    b7              Tags Found
-    b8              Tag Number (only one used in this example)
-    b9..10          SENS_RES
-    b11             SEL_RES
-    b12             NFCID Length
-    b13..NFCIDLen   NFCID                                      */
+    b0..1           SENS_RES
+    b2              SEL_RES
+    b3              NFCID Length
+    b4..NFCIDLen    NFCID                                      */
   
-  #ifdef MIFAREDEBUG
-    Serial.print(F("Found ")); Serial.print(pn532_packetbuffer[7], DEC); Serial.println(F(" tags"));
-  #endif
-  if (pn532_packetbuffer[7] != 1) 
+  if (length < 4 || length < 4 + dev->packetbuffer[3])
     return 0;
     
-  uint16_t sens_res = pn532_packetbuffer[9];
+  uint16_t sens_res = dev->packetbuffer[0];
   sens_res <<= 8;
-  sens_res |= pn532_packetbuffer[10];
+  sens_res |= dev->packetbuffer[1];
   #ifdef MIFAREDEBUG
     Serial.print(F("ATQA: 0x"));  Serial.println(sens_res, HEX); 
-    Serial.print(F("SAK: 0x"));  Serial.println(pn532_packetbuffer[11], HEX); 
+    Serial.print(F("SAK: 0x"));  Serial.println(dev->packetbuffer[2], HEX); 
   #endif
   
   /* Card appears to be Mifare Classic */
-  *uidLength = pn532_packetbuffer[12];
+  *uidLength = dev->packetbuffer[3];
   #ifdef MIFAREDEBUG
     Serial.print(F("UID:")); 
   #endif
-  for (uint8_t i=0; i < pn532_packetbuffer[12]; i++) 
+  for (uint8_t i=0; i < dev->packetbuffer[3]; i++) 
   {
-    uid[i] = pn532_packetbuffer[13+i];
+    uid[i] = dev->packetbuffer[4+i];
     #ifdef MIFAREDEBUG
       Serial.print(F(" 0x"));Serial.print(uid[i], HEX); 
     #endif
@@ -337,83 +560,91 @@ bool Adafruit_PN532_readPassiveTargetID(uint8_t cardbaudrate, uint8_t * uid, uin
 
 /**************************************************************************/
 /*! 
-    @brief  Exchanges an APDU with the currently inlisted peer
-
+    @brief  Exchanges an APDU with an inlisted peer.
+            The APDU is sent from and the response received into the
+            caller's buffers, so their size is not limited by
+            dev->packetbuffer. Data that does not fit into a single
+            PN532 frame is chained with the MI bit in both directions.
+
+    @param  tg              Logical number of the target (from
+                            Adafruit_PN532_inListPassiveTargets)
     @param  send            Pointer to data to send
     @param  sendLength      Length of the data to send
     @param  response        Pointer to response data
-    @param  responseLength  Pointer to the response data length
+    @param  responseLength  In: size of response, out: the response
+                            data length
+    @param  timeout         Response time in ms allowed for each frame
+                            in place of the deadline of InDataExchange,
+                            0 keeps the deadline
 */
 /**************************************************************************/
-bool Adafruit_PN532_inDataExchange(uint8_t * send, uint8_t sendLength, uint8_t * response, uint8_t * responseLength) {
-  if (sendLength > PN532_PACKBUFFSIZ-2) {
-    #ifdef PN532DEBUG
-      Serial.println(F("APDU length too long for packet buffer"));
-    #endif
-    return false;
-  }
-  uint8_t i;
-  
-  pn532_packetbuffer[0] = 0x40; // PN532_COMMAND_INDATAEXCHANGE;
-  pn532_packetbuffer[1] = _inListedTag;
-  for (i=0; i<sendLength; ++i) {
-    pn532_packetbuffer[i+2] = send[i];
-  }
+bool Adafruit_PN532_inDataExchange(pn532_dev_t *dev, uint8_t tg, uint8_t * send, uint16_t sendLength, uint8_t * response, uint16_t * responseLength, uint16_t timeout) {
+  uint8_t cmd[2];
+  uint8_t status;
+  uint16_t chunk, length;
+  uint16_t received = 0;
   
-  if (!Adafruit_PN532_sendCommandCheckAck(pn532_packetbuffer,sendLength+2,1000)) {
-    #ifdef PN532DEBUG
-      Serial.println(F("Could not send ADPU"));
-    #endif
-    return false;
-  }
-
-  if (!Adafruit_PN532_waitready(1000)) {
-    #ifdef PN532DEBUG
-      Serial.println(F("Response never received for ADPU..."));
-    #endif
-    return false;
-  }
-
-  Adafruit_PN532_readdata(pn532_packetbuffer,sizeof(pn532_packetbuffer));
+  cmd[0] = PN532_COMMAND_INDATAEXCHANGE;
+  dev->currentTg = tg;
+  do {
+    // more information to follow from our side: set MI in the Tg byte
+    chunk = sendLength;
+    cmd[1] = tg;
+    if (chunk > PN532_MAX_DATAEXCHANGE) {
+      chunk = PN532_MAX_DATAEXCHANGE;
+      cmd[1] |= PN532_MI;
+    }
   
-  if (pn532_packetbuffer[0] == 0 && pn532_packetbuffer[1] == 0 && pn532_packetbuffer[2] == 0xff) {
-    uint8_t length = pn532_packetbuffer[3];
-    if (pn532_packetbuffer[4]!=(uint8_t)(~length+1)) {
+    if (timeout ? !Adafruit_PN532_runCommand(dev, cmd, 2, send, chunk, timeout) : !Adafruit_PN532_sendCommandDataCheckAck(dev, cmd, 2, send, chunk, 1000)) {
       #ifdef PN532DEBUG
-        Serial.println(F("Length check invalid"));
-        Serial.println(length,HEX);
-        Serial.println((~length)+1,HEX);
+        Serial.println(F("Could not send ADPU"));
       #endif
       return false;
     }
-    if (pn532_packetbuffer[5]==PN532_PN532TOHOST && pn532_packetbuffer[6]==PN532_RESPONSE_INDATAEXCHANGE) {
-      if ((pn532_packetbuffer[7] & 0x3f)!=0) {
+    send += chunk;
+    sendLength -= chunk;
+
+    for (;;) {
+      if (!Adafruit_PN532_waitready(dev, 1000)) {
+        #ifdef PN532DEBUG
+          Serial.println(F("Response never received for ADPU..."));
+        #endif
+        return false;
+      }
+
+      // the response data goes straight into the caller's buffer
+      length = *responseLength - received;
+      if (Adafruit_PN532_readframe(dev, PN532_COMMAND_INDATAEXCHANGE, &status, 1, response + received, &length) != PN532_FRAME_DATA) {
+        #ifdef PN532DEBUG
+          Serial.println(F("Unexpected response to ADPU"));
+        #endif
+        return false;
+      }
+      if ((status & 0x3f)!=0) {
         #ifdef PN532DEBUG
           Serial.println(F("Status code indicates an error"));
         #endif
         return false;
       }
       
-      length -= 3;
-      
-      if (length > *responseLength) {
-        length = *responseLength; // silent truncation...
+      if (length > *responseLength - received) {
+        length = *responseLength - received; // silent truncation...
       }
-      
-      for (i=0; i<length; ++i) {
-        response[i] = pn532_packetbuffer[8+i];
+      received += length;
+
+      // the target has more information for us: ask for the next part
+      if (!(status & PN532_MI) || sendLength) {
+        break;
       }
-      *responseLength = length;
-      
-      return true;
-    } 
-    else {
-      return false;
-    } 
-  } 
-  else {
-    return false;
-  }
+      cmd[1] = tg;
+      if (timeout ? !Adafruit_PN532_runCommand(dev, cmd, 2, NULL, 0, timeout) : !Adafruit_PN532_sendCommandCheckAck(dev, cmd, 2, 1000)) {
+        return false;
+      }
+    }
+  } while (sendLength);
+  *responseLength = received;
+  
+  return true;
 }
 
 /**************************************************************************/
@@ -422,66 +653,369 @@ bool Adafruit_PN532_inDataExchange(uint8_t * send, uint8_t sendLength, uint8_t *
             peer acting as card/responder.
 */
 /**************************************************************************/
-bool Adafruit_PN532_inListPassiveTarget(void) {
-  pn532_packetbuffer[0] = PN532_COMMAND_INLISTPASSIVETARGET;
-  pn532_packetbuffer[1] = 1;
-  pn532_packetbuffer[2] = 0;
-  
+bool Adafruit_PN532_inListPassiveTarget(pn532_dev_t *dev) {
+  uint8_t length = 0;
+
   #ifdef PN532DEBUG 
     Serial.print(F("About to inList passive target"));
   #endif
 
-  if (!Adafruit_PN532_sendCommandCheckAck(pn532_packetbuffer,3,1000)) {
+  return Adafruit_PN532_inListPassiveTargetData(dev, PN532_MIFARE_ISO14443A, NULL, 0, NULL, &length, 30000);
+}
+
+/**************************************************************************/
+/*! 
+    @brief  'InLists' a passive target and hands its target data
+            (SENS_RES, SEL_RES, NFCID length, NFCID and ATS) to the caller.
+
+    @param  cardbaudrate  Baud rate and modulation type (BrTy) to use
+    @param  initData      Initiator data, e.g. the UID of the card that
+                          should be selected, or NULL
+    @param  initLength    Length of the initiator data
+    @param  target        Buffer receiving the target data
+    @param  targetLength  In: size of target, out: bytes stored
+    @param  timeout       Timeout before giving up, 0 waits forever
+
+    @returns 1 if a target was inlisted, 0 otherwise
+*/
+/**************************************************************************/
+bool Adafruit_PN532_inListPassiveTargetData(pn532_dev_t *dev, uint8_t cardbaudrate, const uint8_t * initData, uint8_t initLength, uint8_t * target, uint8_t * targetLength, uint16_t timeout) {
+  pn532_target_t t;
+
+  if (!Adafruit_PN532_inListPassiveTargets(dev, cardbaudrate, 1, initData, initLength, &t, timeout)) {
+    return false;
+  }
+  if (*targetLength > t.length) {
+    *targetLength = t.length;
+  }
+  memcpy(target, t.data, (*targetLength < sizeof(t.data)) ? *targetLength : sizeof(t.data));
+
+  return true;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Length of the ISO14443A target data at data: SENS_RES,
+            SEL_RES, NFCID length, NFCID and, if SEL_RES announces
+            ISO14443-4, the ATS whose first byte counts itself.
+
+    @returns the length, 0 if length bytes do not hold the target
+*/
+/**************************************************************************/
+static uint8_t Adafruit_PN532_targetLength(const uint8_t * data, uint8_t length) {
+  uint8_t n;
+
+  if (length < 4) {
+    return 0;
+  }
+  n = 4 + data[3];
+  if (n < length && (data[2] & PN532_SEL_RES_ISO14443_4)) {
+    n += data[n];
+  }
+  return (n > length) ? 0 : n;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Copies one target of a response into target, taking at most
+            length bytes of target data (SENS_RES onwards).
+*/
+/**************************************************************************/
+static void Adafruit_PN532_storeTarget(pn532_target_t * target, uint8_t tg, const uint8_t * data, uint8_t length) {
+  target->tg = tg;
+  if (length > PN532_TARGETDATA_SIZE) {
+    length = PN532_TARGETDATA_SIZE;
+  }
+  target->length = length;
+  memcpy(target->data, data, length);
+}
+
+/**************************************************************************/
+/*! 
+    @brief  'InLists' up to maxTg passive targets in one activation
+            cycle, so stacked cards are all found by a single command.
+            Each target keeps the logical number (Tg) the PN532 gave it
+            for the following In... commands.
+
+    @param  cardbaudrate  Baud rate and modulation type (BrTy) to use
+    @param  maxTg         Number of targets to inlist, 1 or 2
+    @param  initData      Initiator data, e.g. the UID of the card that
+                          should be selected, or NULL
+    @param  initLength    Length of the initiator data
+    @param  targets       Room for maxTg targets
+    @param  timeout       Timeout before giving up, 0 waits forever
+
+    @returns the number of targets inlisted
+*/
+/**************************************************************************/
+uint8_t Adafruit_PN532_inListPassiveTargets(pn532_dev_t *dev, uint8_t cardbaudrate, uint8_t maxTg, const uint8_t * initData, uint8_t initLength, pn532_target_t * targets, uint16_t timeout) {
+  if (initLength > PN532_PACKBUFFSIZ-3 || maxTg < 1 || maxTg > PN532_MAX_TARGETS) {
+    return 0;
+  }
+  uint8_t i, n, nbTg;
+  uint16_t length = PN532_PACKBUFFSIZ;
+  uint8_t *p = dev->packetbuffer;
+
+  dev->packetbuffer[0] = PN532_COMMAND_INLISTPASSIVETARGET;
+  dev->packetbuffer[1] = maxTg;
+  dev->packetbuffer[2] = cardbaudrate;
+  for (i=0; i<initLength; ++i) {
+    dev->packetbuffer[i+3] = initData[i];
+  }
+
+  dev->currentTg = 0;
+  if (!Adafruit_PN532_sendCommandCheckAck(dev, dev->packetbuffer,initLength+3,timeout)) {
     #ifdef PN532DEBUG
       Serial.println(F("Could not send inlist message"));
     #endif
+    return 0;
+  }
+
+  // NbTg, then Tg and the target data of each target
+  if (Adafruit_PN532_readframe(dev, PN532_COMMAND_INLISTPASSIVETARGET, &nbTg, 1, dev->packetbuffer, &length) != PN532_FRAME_DATA) {
+    #ifdef PN532DEBUG
+      Serial.print(F("Unexpected response to inlist passive host"));
+    #endif
+    return 0;
+  }
+  if (nbTg > maxTg) {
+    #ifdef PN532DEBUG
+      Serial.println(F("Unhandled number of targets inlisted"));
+    #endif
+    return 0;
+  }
+  if (length > PN532_PACKBUFFSIZ) {
+    length = PN532_PACKBUFFSIZ;
+  }
+
+  for (i = 0; i < nbTg && length > 1; i++) {
+    // the last target takes the rest of the frame
+    n = (i == nbTg - 1) ? length - 1 : Adafruit_PN532_targetLength(p + 1, length - 1);
+    if (n == 0) {
+      break;
+    }
+    Adafruit_PN532_storeTarget(&targets[i], p[0], p + 1, n);
+    p += n + 1;
+    length -= n + 1;
+  }
+
+  return i;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Hands polling for targets over to the PN532 (InAutoPoll).
+            The host only hears from the chip again when a target has
+            been activated or all polls are done, so with PN532_USE_IRQ
+            neither the CPU nor the SPI bus are busy while no card is
+            in the field.
+
+    @param  pollNr        Number of polling rounds, 0xFF polls endlessly
+    @param  period        Pause between two rounds in units of 150 ms
+    @param  types         Target types to poll for (PN532_AUTOPOLL_...)
+    @param  typesLength   Number of target types
+    @param  type          Receives the type of the first target found
+    @param  targets       Room for PN532_MAX_TARGETS targets, the PN532
+                          activates stacked cards together
+    @param  timeout       Timeout before giving up, 0 waits forever
+
+    @returns the number of targets found and activated
+*/
+/**************************************************************************/
+uint8_t Adafruit_PN532_inAutoPoll(pn532_dev_t *dev, uint8_t pollNr, uint8_t period, const uint8_t * types, uint8_t typesLength, uint8_t * type, pn532_target_t * targets, uint16_t timeout) {
+  uint8_t cmd[3];
+
+  cmd[0] = PN532_COMMAND_INAUTOPOLL;
+  cmd[1] = pollNr;
+  cmd[2] = period;
+
+  dev->currentTg = 0;
+  if (!Adafruit_PN532_sendCommandDataCheckAck(dev, cmd, 3, types, typesLength, timeout)) {
+    return 0;
+  }
+  return Adafruit_PN532_readAutoPoll(dev, type, targets);
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Starts InAutoPoll without waiting for the PN532, the command
+            is progressed by Adafruit_PN532_pollCommand. Several PN532s
+            can poll at the same time this way.
+
+    @param  pollNr        Number of polling rounds, 0xFF polls endlessly
+    @param  period        Pause between two rounds in units of 150 ms
+    @param  types         Target types to poll for (PN532_AUTOPOLL_...)
+    @param  typesLength   Number of target types
+*/
+/**************************************************************************/
+void Adafruit_PN532_startAutoPoll(pn532_dev_t *dev, uint8_t pollNr, uint8_t period, const uint8_t * types, uint8_t typesLength) {
+  uint8_t cmd[3];
+
+  cmd[0] = PN532_COMMAND_INAUTOPOLL;
+  cmd[1] = pollNr;
+  cmd[2] = period;
+
+  dev->currentTg = 0;
+  Adafruit_PN532_startCommand(dev, cmd, 3, types, typesLength);
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Reads the response to InAutoPoll once the PN532 is ready
+
+    @param  type          Receives the type of the first target found
+    @param  targets       Room for PN532_MAX_TARGETS targets
+
+    @returns the number of targets found and activated
+*/
+/**************************************************************************/
+uint8_t Adafruit_PN532_readAutoPoll(pn532_dev_t *dev, uint8_t * type, pn532_target_t * targets) {
+  uint8_t i, nbTg;
+  uint16_t length = PN532_PACKBUFFSIZ;
+  uint8_t *p = dev->packetbuffer;
+
+  // NbTg, then Type, Ln, Tg and the target data of each target
+  if (Adafruit_PN532_readframe(dev, PN532_COMMAND_INAUTOPOLL, &nbTg, 1, dev->packetbuffer, &length) != PN532_FRAME_DATA) {
+    return 0;
+  }
+  if (length > PN532_PACKBUFFSIZ) {
+    length = PN532_PACKBUFFSIZ;
+  }
+
+  // nbTg is 0 if no target was found during all polls
+  for (i = 0; i < nbTg && i < PN532_MAX_TARGETS; i++) {
+    if (length < 3 || p[1] < 1 || p[1] + 2 > length) {
+      break;
+    }
+    if (i == 0) {
+      *type = p[0];
+    }
+    Adafruit_PN532_storeTarget(&targets[i], p[2], p + 3, p[1] - 1);
+    length -= p[1] + 2;
+    p += p[1] + 2;
+  }
+
+  return i;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Checks that an inlisted ISO14443-4 target is still in the
+            field, the PN532 sends it an R(NAK) (Diagnose, NumTst 6).
+            Diagnose has no Tg, another target is made the PN532's
+            current one with InSelect first.
+
+    @param  tg      Logical number of the target
+
+    @returns 1 if the target answered
+*/
+/**************************************************************************/
+bool Adafruit_PN532_checkPresence(pn532_dev_t *dev, uint8_t tg) {
+  uint8_t status;
+
+  if (tg != dev->currentTg && !Adafruit_PN532_inSelect(dev, tg)) {
     return false;
   }
+  dev->packetbuffer[0] = PN532_COMMAND_DIAGNOSE;
+  dev->packetbuffer[1] = PN532_DIAGNOSE_PRESENCE;
 
-  if (!Adafruit_PN532_waitready(30000)) {
+  if (!Adafruit_PN532_sendCommandCheckAck(dev, dev->packetbuffer,2,1000)) {
+    return false;
+  }
+  if (Adafruit_PN532_readframe(dev, PN532_COMMAND_DIAGNOSE, &status, 1, NULL, NULL) != PN532_FRAME_DATA) {
     return false;
   }
 
-  Adafruit_PN532_readdata(pn532_packetbuffer,sizeof(pn532_packetbuffer));
-  
-  if (pn532_packetbuffer[0] == 0 && pn532_packetbuffer[1] == 0 && pn532_packetbuffer[2] == 0xff) {
-    uint8_t length = pn532_packetbuffer[3];
-    if (pn532_packetbuffer[4]!=(uint8_t)(~length+1)) {
-      #ifdef PN532DEBUG
-        Serial.println(F("Length check invalid"));
-        Serial.println(length,HEX);
-        Serial.println((~length)+1,HEX);
-      #endif
-      return false;
-    }
-    if (pn532_packetbuffer[5]==PN532_PN532TOHOST && pn532_packetbuffer[6]==PN532_RESPONSE_INLISTPASSIVETARGET) {
-      if (pn532_packetbuffer[7] != 1) {
-        #ifdef PN532DEBUG
-        Serial.println(F("Unhandled number of targets inlisted"));
-        #endif
-        return false;
-      }
-      
-      _inListedTag = pn532_packetbuffer[8];
-      
-      return true;
-    } else {
-      #ifdef PN532DEBUG
-        Serial.print(F("Unexpected response to inlist passive host"));
-      #endif
-      return false;
-    } 
-  } 
-  else {
-    #ifdef PN532DEBUG
-      Serial.println(F("Preamble missing"));
-    #endif
+  return (status & 0x3f) == 0;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Changes the RF bit rates to the inlisted target, for an
+            ISO14443-4 target the PN532 sends it a PPS request
+
+    @param  tg        Logical number of the target
+    @param  brit      Initiator to target bit rate (PN532_BITRATE_...)
+    @param  brti      Target to initiator bit rate (PN532_BITRATE_...)
+
+    @returns 1 if the target switched to the new bit rates
+*/
+/**************************************************************************/
+bool Adafruit_PN532_inPSL(pn532_dev_t *dev, uint8_t tg, uint8_t brit, uint8_t brti) {
+  uint8_t status;
+
+  dev->currentTg = tg;
+  dev->packetbuffer[0] = PN532_COMMAND_INPSL;
+  dev->packetbuffer[1] = tg;
+  dev->packetbuffer[2] = brit;
+  dev->packetbuffer[3] = brti;
+
+  if (!Adafruit_PN532_sendCommandCheckAck(dev, dev->packetbuffer,4,1000)) {
+    return false;
+  }
+  if (Adafruit_PN532_readframe(dev, PN532_COMMAND_INPSL, &status, 1, NULL, NULL) != PN532_FRAME_DATA) {
+    return false;
+  }
+
+  return (status & 0x3f) == 0;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Makes an inlisted target the one the PN532 talks to,
+            reactivating it if it was deselected.
+
+    @param  tg      Logical number of the target
+*/
+/**************************************************************************/
+bool Adafruit_PN532_inSelect(pn532_dev_t *dev, uint8_t tg) {
+  uint8_t status;
+
+  dev->currentTg = 0;
+  dev->packetbuffer[0] = PN532_COMMAND_INSELECT;
+  dev->packetbuffer[1] = tg;
+
+  if (!Adafruit_PN532_sendCommandCheckAck(dev, dev->packetbuffer,2,1000)) {
+    return false;
+  }
+  if (Adafruit_PN532_readframe(dev, PN532_COMMAND_INSELECT, &status, 1, NULL, NULL) != PN532_FRAME_DATA) {
+    return false;
+  }
+  if ((status & 0x3f) != 0) {
     return false;
   }
 
+  dev->currentTg = tg;
   return true;
 }
 
+/**************************************************************************/
+/*! 
+    @brief  Deselects an inlisted target, keeping its information in the
+            PN532 so it can be reselected later.
+
+    @param  tg      Logical number of the target, 0 for all
+*/
+/**************************************************************************/
+bool Adafruit_PN532_inDeselect(pn532_dev_t *dev, uint8_t tg) {
+  uint8_t status;
+
+  if (tg == 0 || tg == dev->currentTg) {
+    dev->currentTg = 0;
+  }
+  dev->packetbuffer[0] = PN532_COMMAND_INDESELECT;
+  dev->packetbuffer[1] = tg;
+
+  if (!Adafruit_PN532_sendCommandCheckAck(dev, dev->packetbuffer,2,1000)) {
+    return false;
+  }
+  if (Adafruit_PN532_readframe(dev, PN532_COMMAND_INDESELECT, &status, 1, NULL, NULL) != PN532_FRAME_DATA) {
+    return false;
+  }
+
+  return (status & 0x3f) == 0;
+}
+
 
 /************** high level communication functions (handles both I2C and SPI) */
 
@@ -491,12 +1025,8 @@ bool Adafruit_PN532_inListPassiveTarget(void) {
     @brief  Tries to read the SPI or I2C ACK signal
 */
 /**************************************************************************/
-bool Adafruit_PN532_readack(void) {
-  uint8_t ackbuff[6];
-  
-  Adafruit_PN532_readdata(ackbuff, 6);
-  
-  return (0 == strncmp((char *)ackbuff, (char *)pn532ack, 6));
+bool Adafruit_PN532_readack(pn532_dev_t *dev) {
+  return Adafruit_PN532_readframe(dev, 0, NULL, 0, NULL, NULL) == PN532_FRAME_ACK;
 }
 
 
@@ -505,44 +1035,59 @@ bool Adafruit_PN532_readack(void) {
     @brief  Return true if the PN532 is ready with a response.
 */
 /**************************************************************************/
-bool Adafruit_PN532_isready(void) {
+bool Adafruit_PN532_isready(pn532_dev_t *dev) {
+	#ifdef PN532_USE_IRQ
+		// The IRQ line is pulled low while a frame is waiting to be read,
+		// no SPI transaction is needed to find out.
+		return !(*dev->pins->irq_pin & _BV(dev->pins->irq_bit));
+	#else
 	// SPI read status and check if ready.
-	#ifdef SPI_HAS_TRANSACTION
-		if (_hardwareSPI) SPI.beginTransaction(PN532_SPI_SETTING);
-	#endif
-	digitalWrite(_ss, LOW);
-	delay(2); 
-	Adafruit_PN532_spi_write(PN532_SPI_STATREAD);
+	PN532_SELECT(dev);
+	spi_write(PN532_SPI_STATREAD);
 	// read byte
-	uint8_t x = Adafruit_PN532_spi_read();
+	uint8_t x = spi_read();
 	
-	digitalWrite(_ss, HIGH);
-	#ifdef SPI_HAS_TRANSACTION
-		if (_hardwareSPI) SPI.endTransaction();
-	#endif
+	PN532_DESELECT(dev);
 
 	// Check if status is ready.
 	return x == PN532_SPI_READY;
+	#endif
 }
 
 /**************************************************************************/
 /*! 
     @brief  Waits until the PN532 is ready.
 
-    @param  timeout   Timeout before giving up
+    @param  timeout   Timeout in ms before giving up, 0 waits forever
 */
 /**************************************************************************/
-bool Adafruit_PN532_waitready(uint16_t timeout) {
-  uint16_t timer = 0;
-  while(!Adafruit_PN532_isready()) {
-    if (timeout != 0) {
-      timer += 10;
-      if (timer > timeout) {
-        return false;
-      }
+bool Adafruit_PN532_waitready(pn532_dev_t *dev, uint16_t timeout) {
+  return Adafruit_PN532_waitsince(dev, tick_ms(), timeout);
+}
+
+// Waits until the PN532 is ready, or until timeout ms have passed since
+// start. Between two looks at the PN532 the idle hook runs, or the CPU
+// sleeps until the next interrupt: the IRQ pin with PN532_USE_IRQ, at the
+// latest the ms tick.
+static bool Adafruit_PN532_waitsince(pn532_dev_t *dev, uint16_t start, uint16_t timeout) {
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  cli();
+  while (!Adafruit_PN532_isready(dev)) {
+    // not before the full timeout has passed, the first tick may come
+    // right after start
+    if (timeout != 0 && tick_elapsed(start) > timeout) {
+      sei();
+      return false;
     }
-    delay(10);
+    if (_idleHook && _idleHook())
+      continue;
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+    cli();
   }
+  sei();
   return true;
 }
 
@@ -554,35 +1099,131 @@ bool Adafruit_PN532_waitready(uint16_t timeout) {
     @param  n         Number of bytes to be read
 */
 /**************************************************************************/
-void Adafruit_PN532_readdata(uint8_t* buff, uint8_t n) {
+void Adafruit_PN532_readdata(pn532_dev_t *dev, uint8_t* buff, uint8_t n) {
 	// SPI write.
-	#ifdef SPI_HAS_TRANSACTION
-		if (_hardwareSPI) SPI.beginTransaction(PN532_SPI_SETTING);
-	#endif
-	digitalWrite(_ss, LOW);
-	delay(2); 
-	Adafruit_PN532_spi_write(PN532_SPI_DATAREAD);
+	PN532_SELECT(dev);
+	spi_write(PN532_SPI_DATAREAD);
+	spi_read_burst(buff, n);
+	PN532_DESELECT(dev);
 
 	#ifdef PN532DEBUG
 		Serial.print(F("Reading: "));
-	#endif
-	for (uint8_t i=0; i<n; i++) {
-		delay(1);
-		buff[i] = Adafruit_PN532_spi_read();
-		#ifdef PN532DEBUG
+		for (uint8_t i=0; i<n; i++) {
 			Serial.print(F(" 0x"));
 			Serial.print(buff[i], HEX);
-		#endif
-	}
-
-	#ifdef PN532DEBUG
+		}
 		Serial.println();
 	#endif
+}
 
-	digitalWrite(_ss, HIGH);
-	#ifdef SPI_HAS_TRANSACTION
-		if (_hardwareSPI) SPI.endTransaction();
-	#endif
+/**************************************************************************/
+/*! 
+    @brief  Reads one frame from the PN532 in a single SPI transaction.
+            The preamble and LEN/LCS are read first, then exactly the
+            announced number of bytes is clocked out while the data
+            checksum is verified. The first headLength bytes after the
+            response code (status, NbTg, ...) are stored in head, the
+            rest goes straight into the caller's buffer.
+
+    @param  command     The command code the response belongs to
+    @param  head        Buffer for the leading payload bytes
+    @param  headLength  Number of leading payload bytes to store in head
+    @param  buff        Buffer for the remaining payload bytes
+    @param  n           In: size of buff, surplus bytes are dropped.
+                        Out: number of payload bytes following the head,
+                        which can be larger than the size of buff
+
+    @returns  PN532_FRAME_ACK, PN532_FRAME_NACK, PN532_FRAME_ERROR for an
+              application level error frame, PN532_FRAME_DATA for a
+              valid response to command or PN532_FRAME_INVALID
+*/
+/**************************************************************************/
+pn532_frame_t Adafruit_PN532_readframe(pn532_dev_t *dev, uint8_t command, uint8_t* head, uint8_t headLength, uint8_t* buff, uint16_t* n) {
+	pn532_frame_t result = PN532_FRAME_INVALID;
+	uint8_t lcs, checksum, x;
+	uint16_t length;
+	uint16_t size = n ? *n : 0;
+
+	TRACE_BEGIN(TRACE_PN532_READ, command);
+	PN532_SELECT(dev);
+	spi_write(PN532_SPI_DATAREAD);
+
+	// preamble and start code, tolerating a missing preamble byte
+	x = spi_read();
+	if (x == PN532_PREAMBLE) {
+		x = spi_read();
+	}
+	if (x == PN532_STARTCODE1) {
+		x = spi_read();
+	}
+	if (x != PN532_STARTCODE2) {
+		goto out;
+	}
+
+	length = spi_read();
+	lcs = spi_read();
+	if (length == 0x00 && lcs == 0xFF) {
+		result = PN532_FRAME_ACK;
+		goto out;
+	}
+	if (length == 0xFF && lcs == 0x00) {
+		result = PN532_FRAME_NACK;
+		goto out;
+	}
+	if (length == 0xFF && lcs == 0xFF) {
+		// extended information frame: LENM LENL LCS
+		x = spi_read();
+		lcs = spi_read();
+		length = ((uint16_t)x << 8) | lcs;
+		lcs += x + spi_read();
+	} else {
+		lcs += length;
+	}
+	if (lcs != 0 || length == 0) {
+		goto out;
+	}
+
+	// TFI
+	checksum = x = spi_read();
+	length--;
+	if (x == PN532_ERRORFRAME && length == 0) {
+		checksum += spi_read();
+		if (checksum == 0) {
+			result = PN532_FRAME_ERROR;
+		}
+		goto out;
+	}
+	if (x != PN532_PN532TOHOST || length < headLength + 1) {
+		goto out;
+	}
+
+	// response code
+	x = spi_read();
+	checksum += x;
+	if (x != command + 1) {
+		goto out;
+	}
+	length -= headLength + 1;
+
+	checksum += spi_read_burst(head, headLength);
+	if (length > size) {
+		checksum += spi_read_burst(buff, size);
+		checksum += spi_read_burst(NULL, length - size);
+	} else {
+		checksum += spi_read_burst(buff, length);
+	}
+	checksum += spi_read();
+	if (checksum == 0) {
+		if (n) {
+			*n = length;
+		}
+		result = PN532_FRAME_DATA;
+	}
+
+out:
+	PN532_DESELECT(dev);
+	TRACE_FINISH(TRACE_PN532_READ, command);
+	return result;
 }
 
 /**************************************************************************/
@@ -594,61 +1235,64 @@ void Adafruit_PN532_readdata(uint8_t* buff, uint8_t n) {
     @param  cmdlen    Command length in bytes 
 */
 /**************************************************************************/
-void Adafruit_PN532_writecommand(uint8_t* cmd, uint8_t cmdlen) {
-	// SPI command write.
-	uint8_t checksum;
-
-	cmdlen++;
-	
-	#ifdef PN532DEBUG
-		Serial.print(F("\nSending: "));
-	#endif
-
-	#ifdef SPI_HAS_TRANSACTION
-		if (_hardwareSPI) SPI.beginTransaction(PN532_SPI_SETTING);
-	#endif
-	digitalWrite(_ss, LOW);
-	delay(2);     // or whatever the delay is for waking up the board
-	Adafruit_PN532_spi_write(PN532_SPI_DATAWRITE);
+void Adafruit_PN532_writecommand(pn532_dev_t *dev, uint8_t* cmd, uint8_t cmdlen) {
+	Adafruit_PN532_writecommanddata(dev, cmd, cmdlen, NULL, 0);
+}
 
-	checksum = PN532_PREAMBLE + PN532_PREAMBLE + PN532_STARTCODE2;
-	Adafruit_PN532_spi_write(PN532_PREAMBLE);
-	Adafruit_PN532_spi_write(PN532_PREAMBLE);
-	Adafruit_PN532_spi_write(PN532_STARTCODE2);
+/**************************************************************************/
+/*! 
+    @brief  Writes a command followed by a block of data to the PN532.
+            The data is clocked out from the caller's buffer, so it does
+            not have to fit into dev->packetbuffer. Frames with more
+            than 254 bytes are sent as extended information frames.
 
-	Adafruit_PN532_spi_write(cmdlen);
-	Adafruit_PN532_spi_write(~cmdlen + 1);
- 
-	Adafruit_PN532_spi_write(PN532_HOSTTOPN532);
-	checksum += PN532_HOSTTOPN532;
+    @param  cmd       Pointer to the command buffer (code and parameters)
+    @param  cmdlen    Command length in bytes 
+    @param  data      Pointer to the data following the command
+    @param  datalen   Data length in bytes 
+*/
+/**************************************************************************/
+void Adafruit_PN532_writecommanddata(pn532_dev_t *dev, const uint8_t* cmd, uint8_t cmdlen, const uint8_t* data, uint16_t datalen) {
+	// SPI command write.
+	uint8_t frame[10];
+	uint8_t checksum, n = 0;
+	uint16_t length = cmdlen + datalen + 1;
 
 	#ifdef PN532DEBUG
-		Serial.print(F(" 0x")); Serial.print(PN532_PREAMBLE, HEX);
-		Serial.print(F(" 0x")); Serial.print(PN532_PREAMBLE, HEX);
-		Serial.print(F(" 0x")); Serial.print(PN532_STARTCODE2, HEX);
-		Serial.print(F(" 0x")); Serial.print(cmdlen, HEX);
-		Serial.print(F(" 0x")); Serial.print(~cmdlen + 1, HEX);
-		Serial.print(F(" 0x")); Serial.print(PN532_HOSTTOPN532, HEX);
+		Serial.print(F("\nSending: "));
 	#endif
 
-	for (uint8_t i=0; i<cmdlen-1; i++) {
-		Adafruit_PN532_spi_write(cmd[i]);
-		checksum += cmd[i];
-		#ifdef PN532DEBUG
-			Serial.print(F(" 0x")); Serial.print(cmd[i], HEX);
-		#endif
+	frame[n++] = PN532_SPI_DATAWRITE;
+	frame[n++] = PN532_PREAMBLE;
+	frame[n++] = PN532_STARTCODE1;
+	frame[n++] = PN532_STARTCODE2;
+	if (length > 0xFF) {
+		// extended information frame: FF FF LENM LENL LCS
+		frame[n++] = 0xFF;
+		frame[n++] = 0xFF;
+		frame[n++] = length >> 8;
+		frame[n++] = length;
+		frame[n++] = ~((length >> 8) + length) + 1;
+	} else {
+		frame[n++] = length;
+		frame[n++] = ~length + 1;
 	}
-	
-	Adafruit_PN532_spi_write(~checksum);
-	Adafruit_PN532_spi_write(PN532_POSTAMBLE);
-	digitalWrite(_ss, HIGH);
-	#ifdef SPI_HAS_TRANSACTION
-		if (_hardwareSPI) SPI.endTransaction();
-	#endif
+	frame[n++] = PN532_HOSTTOPN532;
+
+	PN532_SELECT(dev);
+	spi_write_burst(frame, n);
+	// the bursts sum up the bytes while they are clocked out
+	checksum = PN532_HOSTTOPN532;
+	checksum += spi_write_burst(cmd, cmdlen);
+	checksum += spi_write_burst(data, datalen);
+	frame[0] = ~checksum + 1;
+	frame[1] = PN532_POSTAMBLE;
+	spi_write_burst(frame, 2);
+	PN532_DESELECT(dev);
 
 	#ifdef PN532DEBUG
-		Serial.print(F(" 0x")); Serial.print(~checksum, HEX);
-		Serial.print(F(" 0x")); Serial.print(PN532_POSTAMBLE, HEX);
+		Serial.print(F(" LEN 0x")); Serial.print(length, HEX);
+		Serial.print(F(" DCS 0x")); Serial.print(~checksum + 1, HEX);
 		Serial.println();
 	#endif
 } 
@@ -663,7 +1307,7 @@ void Adafruit_PN532_writecommand(uint8_t* cmd, uint8_t cmdlen) {
 /**************************************************************************/
 void Adafruit_PN532_spi_write(uint8_t c) {
 	// Hardware SPI write.
-	SPI_transfer(c);
+	spi_write(c);
 }
 
 /**************************************************************************/
@@ -678,7 +1322,7 @@ uint8_t Adafruit_PN532_spi_read(void) {
   x = 0;
 
 	// Hardware SPI read.
-	x = SPI_transfer(0x00);
+	x = spi_read();
 
   return x;
 }
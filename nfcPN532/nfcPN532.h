@@ -8,6 +8,7 @@
 
 #define PN532_HOSTTOPN532                   (0xD4)
 #define PN532_PN532TOHOST                   (0xD5)
+#define PN532_ERRORFRAME                    (0x7F)
 
 // PN532 Commands
 #define PN532_COMMAND_DIAGNOSE              (0x00)
@@ -61,6 +62,33 @@
 
 #define PN532_MIFARE_ISO14443A              (0x00)
 
+// InAutoPoll target types
+#define PN532_AUTOPOLL_GENERIC106           (0x00)
+#define PN532_AUTOPOLL_MIFARE               (0x10)
+#define PN532_AUTOPOLL_ISO14443_4A          (0x20)
+#define PN532_AUTOPOLL_MAXTYPES             (15)
+
+// Diagnose test: presence check of an ISO14443-4 target
+#define PN532_DIAGNOSE_PRESENCE             (0x06)
+
+// InPSL bit rates, in each direction
+#define PN532_BITRATE_106                   (0x00)
+#define PN532_BITRATE_212                   (0x01)
+#define PN532_BITRATE_424                   (0x02)
+#define PN532_BITRATE_847                   (0x03)
+
+// Largest InDataExchange payload the PN532 accepts in one frame, longer
+// APDUs are chained with the MI bit (bit 6 of Tg and of the status byte)
+#define PN532_MAX_DATAEXCHANGE              (262)
+#define PN532_MI                            (0x40)
+
+// Room for SENS_RES, SEL_RES, a triple size NFCID and a DESFire ATS
+#define PN532_TARGETDATA_SIZE               (32)
+// Targets the PN532 can inlist at once (MaxTg)
+#define PN532_MAX_TARGETS                   (2)
+// SEL_RES bit of a target that has been activated to ISO14443-4 (ATS follows)
+#define PN532_SEL_RES_ISO14443_4            (0x20)
+
 // Mifare Commands
 #define MIFARE_CMD_AUTH_A                   (0x60)
 #define MIFARE_CMD_AUTH_B                   (0x61)
@@ -73,18 +101,147 @@
 #define MIFARE_ULTRALIGHT_CMD_WRITE         (0xA2)
 
 
+// Define PN532_USE_IRQ to detect a pending response by the PN532's IRQ
+// line (P70_IRQ, active low, enabled by SAMConfig) on an external
+// interrupt instead of polling the SPI status byte every ms.
+// Defaults to INT2 on PB2 of the ATmega1284. With several PN532s this is
+// the IRQ line of the first one, the others are on pin change interrupts
+// (pn532_pins_t).
+//#define PN532_USE_IRQ
+#ifndef PN532_IRQ_vect
+	#define PN532_IRQ_vect                  INT2_vect
+	#define PN532_IRQ_INT                   INT2
+	#define PN532_IRQ_INTF                  INTF2
+	#define PN532_IRQ_ISC0                  ISC20
+	#define PN532_IRQ_ISC1                  ISC21
+	#define PN532_IRQ_PORT                  PORTB
+	#define PN532_IRQ_DDR                   DDRB
+	#define PN532_IRQ_PIN                   PINB
+	#define PN532_IRQ_BIT                   PB2
+#endif
+// The IRQ lines of the other PN532s raise a pin change interrupt, PORTA
+// is PCINT0..7 on the ATmega1284
+#ifndef PN532_PCINT_vect
+	#define PN532_PCINT_vect                PCINT0_vect
+	#define PN532_PCINT_MSK                 PCMSK0
+	#define PN532_PCINT_IE                  PCIE0
+#endif
+
+// Chip select (NSS) of the (first) PN532, one assertion per frame.
+// Defaults to the SPI SS pin PB4 of the ATmega1284.
+#ifndef PN532_SS_PORT
+	#define PN532_SS_PORT                   PORTB
+	#define PN532_SS_DDR                    DDRB
+	#define PN532_SS_BIT                    PB4
+#endif
+// PN532s on the SPI bus, each on its own chip select and IRQ line (see
+// pn532_pins_t and the wiring in nfcdummy.c), 1 to 4
+#ifndef PN532_READERS
+	#define PN532_READERS                   1
+#endif
+#ifndef PN532_SELECT
+	#define PN532_SELECT(dev)               (*(dev)->pins->ss_port &= ~_BV((dev)->pins->ss_bit))
+	#define PN532_DESELECT(dev)             (*(dev)->pins->ss_port |= _BV((dev)->pins->ss_bit))
+#endif
+// NSS low time to wake the PN532 from power down. It is only asleep after
+// reset (or a PowerDown command), frames to an awake PN532 need no delay.
+#define PN532_WAKEUP_MS                     (2)
+
 #include <stdint.h>
 #include <stdbool.h>
 typedef uint8_t byte;
 
-bool Adafruit_PN532_sendCommandCheckAck(uint8_t *cmd, uint8_t cmdlen, uint16_t timeout);
-void Adafruit_PN532_readdata(uint8_t* buff, uint8_t n);
-bool Adafruit_PN532_waitready(uint16_t timeout);
-void Adafruit_PN532_readdata(uint8_t* buff, uint8_t n);
-void Adafruit_PN532_writecommand(uint8_t* cmd, uint8_t cmdlen);
-bool Adafruit_PN532_readack(void);
+// Kind of frame returned by Adafruit_PN532_readframe
+typedef enum {
+  PN532_FRAME_INVALID = 0,
+  PN532_FRAME_ACK,
+  PN532_FRAME_NACK,
+  PN532_FRAME_ERROR,
+  PN532_FRAME_DATA,
+} pn532_frame_t;
+
+// Progress of the command started by Adafruit_PN532_startCommand
+typedef enum {
+  PN532_CMD_IDLE = 0,
+  PN532_CMD_WAIT_ACK,       // frame written, ACK pending
+  PN532_CMD_WAIT_RESPONSE,  // ACKed, response pending
+  PN532_CMD_READY,          // response waiting for Adafruit_PN532_readframe
+  PN532_CMD_FAILED,         // no ACK, or a blocking wait timed out
+} pn532_cmd_t;
+
+// A target reported by InListPassiveTarget or InAutoPoll
+typedef struct {
+  uint8_t tg;                           // logical number for the In... commands
+  uint8_t length;
+  uint8_t data[PN532_TARGETDATA_SIZE];  // SENS_RES, SEL_RES, NFCID length, NFCID, ATS
+} pn532_target_t;
+
+// Only commands and short responses go through the packet buffer, APDUs
+// are exchanged with the caller's buffers
+#ifndef PN532_PACKBUFFSIZ
+	#define PN532_PACKBUFFSIZ               (64)
+#endif
+// Commands with a response deadline (_deadlines in nfcPN532.c)
+#define PN532_DEADLINES                     (9)
+
+// Wiring of one PN532: chip select (NSS), and the IRQ line (P70_IRQ)
+// that is read instead of the SPI status with PN532_USE_IRQ
+typedef struct {
+  volatile uint8_t *ss_port;
+  volatile uint8_t *ss_ddr;
+  uint8_t ss_bit;
+  volatile uint8_t *irq_pin;
+  volatile uint8_t *irq_port;
+  volatile uint8_t *irq_ddr;
+  uint8_t irq_bit;
+} pn532_pins_t;
+
+// Driver context of one PN532, set up by Adafruit_PN532_Adafruit_PN532
+typedef struct {
+  const pn532_pins_t *pins;
+  // command in flight, see Adafruit_PN532_startCommand
+  pn532_cmd_t cmdState;
+  uint8_t cmdCode;
+  uint16_t cmdStart;
+  // target the PN532 talked to last (InDataExchange, InPSL, InSelect), 0
+  // if not known. Diagnose checks the presence of this one.
+  uint8_t currentTg;
+  // slowest recent response per command with a deadline, in ms, decays
+  // by 1/8 per response
+  uint16_t slowest[PN532_DEADLINES];
+  uint8_t packetbuffer[PN532_PACKBUFFSIZ];
+} pn532_dev_t;
+
+bool Adafruit_PN532_sendCommandCheckAck(pn532_dev_t *dev, uint8_t *cmd, uint8_t cmdlen, uint16_t timeout);
+void Adafruit_PN532_readdata(pn532_dev_t *dev, uint8_t* buff, uint8_t n);
+bool Adafruit_PN532_waitready(pn532_dev_t *dev, uint16_t timeout);
+void Adafruit_PN532_writecommand(pn532_dev_t *dev, uint8_t* cmd, uint8_t cmdlen);
+void Adafruit_PN532_writecommanddata(pn532_dev_t *dev, const uint8_t* cmd, uint8_t cmdlen, const uint8_t* data, uint16_t datalen);
+bool Adafruit_PN532_sendCommandDataCheckAck(pn532_dev_t *dev, const uint8_t *cmd, uint8_t cmdlen, const uint8_t *data, uint16_t datalen, uint16_t timeout);
+bool Adafruit_PN532_readack(pn532_dev_t *dev);
+void Adafruit_PN532_startCommand(pn532_dev_t *dev, const uint8_t *cmd, uint8_t cmdlen, const uint8_t *data, uint16_t datalen);
+pn532_cmd_t Adafruit_PN532_pollCommand(pn532_dev_t *dev);
+uint16_t Adafruit_PN532_deadline(pn532_dev_t *dev, uint8_t command, uint16_t timeout);
+void Adafruit_PN532_abort(pn532_dev_t *dev);
+void Adafruit_PN532_setIdleHook(bool (*hook)(void));
+void Adafruit_PN532_setIrqHook(void (*hook)(void));
 void Adafruit_PN532_spi_write(uint8_t c);
 uint8_t Adafruit_PN532_spi_read(void);
-void Adafruit_PN532_begin(void);
-bool Adafruit_PN532_setPassiveActivationRetries(uint8_t maxRetries);
+void Adafruit_PN532_Adafruit_PN532(pn532_dev_t *dev, const pn532_pins_t *pins);
+void Adafruit_PN532_begin(pn532_dev_t *dev);
+bool Adafruit_PN532_setPassiveActivationRetries(pn532_dev_t *dev, uint8_t maxRetries);
+uint32_t Adafruit_PN532_getFirmwareVersion(pn532_dev_t *dev);
+bool Adafruit_PN532_SAMConfig(pn532_dev_t *dev);
+bool Adafruit_PN532_inDataExchange(pn532_dev_t *dev, uint8_t tg, uint8_t * send, uint16_t sendLength, uint8_t * response, uint16_t * responseLength, uint16_t timeout);
+bool Adafruit_PN532_inListPassiveTarget(pn532_dev_t *dev);
+bool Adafruit_PN532_inListPassiveTargetData(pn532_dev_t *dev, uint8_t cardbaudrate, const uint8_t * initData, uint8_t initLength, uint8_t * target, uint8_t * targetLength, uint16_t timeout);
+uint8_t Adafruit_PN532_inListPassiveTargets(pn532_dev_t *dev, uint8_t cardbaudrate, uint8_t maxTg, const uint8_t * initData, uint8_t initLength, pn532_target_t * targets, uint16_t timeout);
+uint8_t Adafruit_PN532_inAutoPoll(pn532_dev_t *dev, uint8_t pollNr, uint8_t period, const uint8_t * types, uint8_t typesLength, uint8_t * type, pn532_target_t * targets, uint16_t timeout);
+void Adafruit_PN532_startAutoPoll(pn532_dev_t *dev, uint8_t pollNr, uint8_t period, const uint8_t * types, uint8_t typesLength);
+uint8_t Adafruit_PN532_readAutoPoll(pn532_dev_t *dev, uint8_t * type, pn532_target_t * targets);
+bool Adafruit_PN532_inSelect(pn532_dev_t *dev, uint8_t tg);
+bool Adafruit_PN532_inDeselect(pn532_dev_t *dev, uint8_t tg);
+bool Adafruit_PN532_inPSL(pn532_dev_t *dev, uint8_t tg, uint8_t brit, uint8_t brti);
+bool Adafruit_PN532_checkPresence(pn532_dev_t *dev, uint8_t tg);
+pn532_frame_t Adafruit_PN532_readframe(pn532_dev_t *dev, uint8_t command, uint8_t* head, uint8_t headLength, uint8_t* buff, uint16_t* n);
 #endif
\ No newline at end of file
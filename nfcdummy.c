@@ -1,40 +1,514 @@
+#include <avr/io.h>
 #include <freefare.h>
+#include <string.h>
+#include <nfcPN532.h>
+#include "crc.h"
+
+// Followed by ":" and the reader number
+#define PN532_CONNSTRING	"pn532_spi"
+
+#if PN532_READERS < 1 || PN532_READERS > 4
+	#error "PN532_READERS must be 1 to 4"
+#endif
+
+// libnfc backend on top of the PN532 SPI driver. The readers are fixed,
+// so context and devices are static. driver_data is the PN532's driver
+// context, chip_data the targets inlisted in it.
+static nfc_context pn532_context;
+static nfc_device pn532_devices[PN532_READERS];
+static pn532_dev_t pn532_devs[PN532_READERS];
+
+// All PN532s share the SPI bus. The first one is on the pins set in
+// nfcPN532.h, the others have their NSS on PORTB and their IRQ line on
+// PORTA.
+static const pn532_pins_t pn532_pins[PN532_READERS] = {
+	{ &PN532_SS_PORT, &PN532_SS_DDR, PN532_SS_BIT, &PN532_IRQ_PIN, &PN532_IRQ_PORT, &PN532_IRQ_DDR, PN532_IRQ_BIT },
+#if PN532_READERS > 1
+	{ &PORTB, &DDRB, PB3, &PINA, &PORTA, &DDRA, PA0 },
+#endif
+#if PN532_READERS > 2
+	{ &PORTB, &DDRB, PB1, &PINA, &PORTA, &DDRA, PA1 },
+#endif
+#if PN532_READERS > 3
+	{ &PORTB, &DDRB, PB0, &PINA, &PORTA, &DDRA, PA2 },
+#endif
+};
+
+#define PN532_ATS_CACHE		16
+
+// Highest RF bit rate negotiated with ISO14443-4 cards after activation,
+// as a PN532_BITRATE_... code. The PN532 is specified for type A up to
+// 424 kbps, PN532_BITRATE_847 can be tried with a define.
+#ifndef PN532_MAX_BITRATE
+	#define PN532_MAX_BITRATE	PN532_BITRATE_424
+#endif
+// ATS: T0 announces TA(1), which lists the divisors the card supports
+#define ATS_T0_TA			0x10
+#define ATS_TA_DS(bitrate)	(0x08 << (bitrate))
+#define ATS_TA_DR(bitrate)	(0x01 << ((bitrate) - 1))
+
+// A target inlisted in the PN532
+typedef struct {
+	bool selected;
+	// logical number the PN532 gave it
+	uint8_t tg;
+	uint8_t abtAtqa[2];
+	uint8_t btSak;
+	uint8_t szUidLen;
+	uint8_t abtUid[10];
+	uint8_t szAtsLen;
+	uint8_t abtAts[PN532_ATS_CACHE];
+	// RF bit rate in both directions, PN532_BITRATE_...
+	uint8_t bitrate;
+} pn532_target;
+
+// The targets of the last activation, stacked cards are inlisted together
+typedef struct {
+	pn532_target targets[PN532_MAX_TARGETS];
+	// the one transceive and deselect work on, picked by its UID in
+	// nfc_initiator_select_passive_target
+	pn532_target *current;
+	// found by nfc_initiator_poll_target, not yet handed out by a list
+	bool polled;
+	// lowered by pn532_bitrate_fallback
+	uint8_t bitrate_max;
+} pn532_chip;
+static pn532_chip pn532_chip_data[PN532_READERS];
+
+static void pn532_cache_target(pn532_target *t, uint8_t tg, const nfc_target *pnt){
+	const nfc_iso14443a_info *nai = &pnt->nti.nai;
+	
+	t->selected = true;
+	t->tg = tg;
+	memcpy(t->abtAtqa, nai->abtAtqa, 2);
+	t->btSak = nai->btSak;
+	t->szUidLen = nai->szUidLen;
+	memcpy(t->abtUid, nai->abtUid, t->szUidLen);
+	t->szAtsLen = (nai->szAtsLen > PN532_ATS_CACHE) ? PN532_ATS_CACHE : nai->szAtsLen;
+	memcpy(t->abtAts, nai->abtAts, t->szAtsLen);
+	t->bitrate = PN532_BITRATE_106;
+}
+
+static void pn532_cached_target(const pn532_target *t, nfc_target *pnt){
+	nfc_iso14443a_info *nai = &pnt->nti.nai;
+	
+	memset(pnt, 0, sizeof(*pnt));
+	pnt->nm.nmt = NMT_ISO14443A;
+	pnt->nm.nbr = NBR_106 + t->bitrate;
+	memcpy(nai->abtAtqa, t->abtAtqa, 2);
+	nai->btSak = t->btSak;
+	nai->szUidLen = t->szUidLen;
+	memcpy(nai->abtUid, t->abtUid, t->szUidLen);
+	nai->szAtsLen = t->szAtsLen;
+	memcpy(nai->abtAts, t->abtAts, t->szAtsLen);
+}
+
+static int pn532_decode_target(const uint8_t *data, uint8_t len, nfc_target *pnt){
+	nfc_iso14443a_info *nai = &pnt->nti.nai;
+	
+	// SENS_RES (2), SEL_RES, NFCIDLength, NFCID, [ATS]
+	if ((len < 4) || (data[3] > sizeof(nai->abtUid)) || (len < 4 + data[3]))
+		return NFC_EIO;
+	nai->abtAtqa[0] = data[0];
+	nai->abtAtqa[1] = data[1];
+	nai->btSak = data[2];
+	nai->szUidLen = data[3];
+	memcpy(nai->abtUid, data + 4, nai->szUidLen);
+	data += 4 + nai->szUidLen;
+	len -= 4 + nai->szUidLen;
+	nai->szAtsLen = 0;
+	if (len > 1) {
+		// TL counts itself, it is not part of abtAts
+		nai->szAtsLen = data[0] - 1;
+		if (nai->szAtsLen > len - 1)
+			nai->szAtsLen = len - 1;
+		memcpy(nai->abtAts, data + 1, nai->szAtsLen);
+	}
+	pnt->nm.nmt = NMT_ISO14443A;
+	pnt->nm.nbr = NBR_106;
+	return NFC_SUCCESS;
+}
+
+// Switches an activated ISO14443-4 card to the highest bit rate up to
+// the reader's bitrate_max that its ATS offers in both directions. A
+// rejected PPS is retried one step lower.
+static void pn532_negotiate_bitrate(nfc_device *pnd, pn532_target *t, nfc_target *pnt){
+	pn532_chip *chip = pnd->chip_data;
+	uint8_t bitrate, ta;
+	
+	if (t->szAtsLen < 2 || !(t->abtAts[0] & ATS_T0_TA))
+		return;
+	ta = t->abtAts[1];
+	for (bitrate = chip->bitrate_max; bitrate > t->bitrate; bitrate--) {
+		if (!(ta & ATS_TA_DS(bitrate)) || !(ta & ATS_TA_DR(bitrate)))
+			continue;
+		if (Adafruit_PN532_inPSL(pnd->driver_data, t->tg, bitrate, bitrate)) {
+			t->bitrate = bitrate;
+			break;
+		}
+	}
+	pnt->nm.nbr = NBR_106 + t->bitrate;
+}
+
+// After a failed exchange above 106 kbps the card is taken one step down,
+// and so are the next cards on this reader. A card that has left the
+// field does not answer the PPS either, which says nothing about the bit
+// rate.
+static void pn532_bitrate_fallback(nfc_device *pnd, pn532_target *t){
+	pn532_chip *chip = pnd->chip_data;
+	uint8_t lower;
+	
+	if (t->bitrate == PN532_BITRATE_106)
+		return;
+	lower = t->bitrate - 1;
+	if (!Adafruit_PN532_inPSL(pnd->driver_data, t->tg, lower, lower))
+		return;
+	t->bitrate = lower;
+	if (chip->bitrate_max > lower)
+		chip->bitrate_max = lower;
+}
+
+// Selected target with the given UID, NULL if there is none
+static pn532_target *pn532_find_target(pn532_chip *chip, const uint8_t *uid, size_t len){
+	uint8_t i;
+	
+	for (i = 0; i < PN532_MAX_TARGETS; i++) {
+		pn532_target *t = &chip->targets[i];
+		
+		if (t->selected && len == t->szUidLen && !memcmp(uid, t->abtUid, len))
+			return t;
+	}
+	return NULL;
+}
+
+static void pn532_release_targets(pn532_chip *chip){
+	uint8_t i;
+	
+	for (i = 0; i < PN532_MAX_TARGETS; i++)
+		chip->targets[i].selected = false;
+	chip->current = NULL;
+	chip->polled = false;
+}
+
+// Takes over the targets of an activation, the first becomes current.
+// pnt is scratch space for decoding.
+static uint8_t pn532_activated(nfc_device *pnd, const pn532_target_t *targets, uint8_t count, nfc_target *pnt){
+	pn532_chip *chip = pnd->chip_data;
+	uint8_t n = 0;
+	
+	while (count--) {
+		if (pn532_decode_target(targets->data, targets->length, pnt) == NFC_SUCCESS) {
+			pn532_cache_target(&chip->targets[n], targets->tg, pnt);
+			pn532_negotiate_bitrate(pnd, &chip->targets[n], pnt);
+			n++;
+		}
+		targets++;
+	}
+	chip->current = n ? &chip->targets[0] : NULL;
+	return n;
+}
+
+// Hands out the selected targets, returns how many
+static int pn532_selected_targets(const pn532_chip *chip, nfc_target ant[], size_t szTargets){
+	uint8_t i;
+	int n = 0;
+	
+	for (i = 0; i < PN532_MAX_TARGETS && (size_t)n < szTargets; i++) {
+		if (chip->targets[i].selected)
+			pn532_cached_target(&chip->targets[i], &ant[n++]);
+	}
+	return n;
+}
+
 int nfc_initiator_init(nfc_device *pnd){
-	return 0;
+	pn532_release_targets(pnd->chip_data);
+	return NFC_SUCCESS;
 }
 int nfc_device_set_property_bool(nfc_device *pnd, const nfc_property property, const bool bEnable){
-	return 0;
+	switch (property) {
+	case NP_INFINITE_SELECT:
+		// 0xFF retries forever, 0x01 gives up after one activation attempt
+		if (!Adafruit_PN532_setPassiveActivationRetries(pnd->driver_data, bEnable ? 0xFF : 0x01))
+			return pnd->last_error = NFC_EIO;
+		pnd->bInfiniteSelect = bEnable;
+		break;
+	case NP_HANDLE_CRC:
+		pnd->bCrc = bEnable;
+		break;
+	case NP_HANDLE_PARITY:
+		pnd->bPar = bEnable;
+		break;
+	case NP_EASY_FRAMING:
+		pnd->bEasyFraming = bEnable;
+		break;
+	case NP_AUTO_ISO14443_4:
+		pnd->bAutoIso14443_4 = bEnable;
+		break;
+	default:
+		// everything else keeps the PN532 defaults
+		break;
+	}
+	return pnd->last_error = NFC_SUCCESS;
 }
 int nfc_initiator_list_passive_targets(nfc_device *pnd, const nfc_modulation nm, nfc_target ant[], const size_t szTargets){
-	return 0;
+	pn532_chip *chip = pnd->chip_data;
+	pn532_target_t targets[PN532_MAX_TARGETS];
+	uint8_t count;
+	int n;
+	
+	if (szTargets == 0)
+		return pnd->last_error = NFC_EINVARG;
+	if (nm.nmt != NMT_ISO14443A || nm.nbr != NBR_106)
+		return pnd->last_error = NFC_EDEVNOTSUPP;
+	// Targets just found by InAutoPoll are already activated, hand them
+	// out instead of inlisting them a second time.
+	if (chip->polled) {
+		chip->polled = false;
+		if ((n = pn532_selected_targets(chip, ant, szTargets)))
+			return pnd->last_error = n;
+	}
+	// stacked cards are all activated by one InListPassiveTarget
+	pn532_release_targets(chip);
+	count = (szTargets < PN532_MAX_TARGETS) ? szTargets : PN532_MAX_TARGETS;
+	count = Adafruit_PN532_inListPassiveTargets(pnd->driver_data, PN532_MIFARE_ISO14443A, count, NULL, 0, targets, pnd->bInfiniteSelect ? 0 : 1000);
+	pn532_activated(pnd, targets, count, &ant[0]);
+	return pnd->last_error = pn532_selected_targets(chip, ant, szTargets);
 }
 int nfc_initiator_target_is_present(nfc_device *pnd, const nfc_target *pnt){
-	return 0;
+	pn532_chip *chip = pnd->chip_data;
+	pn532_target *t = chip->current;
+	
+	if (pnt)
+		t = pn532_find_target(chip, pnt->nti.nai.abtUid, pnt->nti.nai.szUidLen);
+	if (!t || !t->selected)
+		return pnd->last_error = NFC_ETGRELEASED;
+	// One R(NAK) round trip instead of a new activation. The PN532 makes
+	// the target its current one for that, and so does the backend.
+	chip->current = NULL;
+	if (!Adafruit_PN532_checkPresence(pnd->driver_data, t->tg)) {
+		// gone, there is nothing left to deselect
+		t->selected = false;
+		return pnd->last_error = NFC_ETGRELEASED;
+	}
+	chip->current = t;
+	return pnd->last_error = NFC_SUCCESS;
 }
 int nfc_device_get_last_error(const nfc_device *pnd){
-	return 0;
+	return pnd->last_error;
 }
 const char *nfc_strerror(const nfc_device *pnd){
-	return "Hallo";
+	switch (pnd->last_error) {
+	case NFC_SUCCESS:		return "Success";
+	case NFC_EIO:			return "Input / Output Error";
+	case NFC_EINVARG:		return "Invalid argument(s)";
+	case NFC_EDEVNOTSUPP:	return "Not Supported by Device";
+	case NFC_EOVFLOW:		return "Buffer Overflow";
+	case NFC_ETIMEOUT:		return "Timeout";
+	case NFC_ERFTRANS:		return "RF Transmission Error";
+	default:				return "Unknown error";
+	}
 }
 int nfc_initiator_select_passive_target(nfc_device *pnd, const nfc_modulation nm, const uint8_t *pbtInitData, const size_t szInitData, nfc_target *pnt){
-	return 0;
+	pn532_chip *chip = pnd->chip_data;
+	pn532_target_t target;
+	pn532_target *t;
+	nfc_target nt;
+	uint8_t count;
+	
+	if (!pnt)
+		pnt = &nt;
+	
+	if (nm.nmt != NMT_ISO14443A || nm.nbr != NBR_106)
+		return pnd->last_error = NFC_EDEVNOTSUPP;
+	if (szInitData > sizeof(chip->targets[0].abtUid))
+		return pnd->last_error = NFC_EINVARG;
+	
+	// Selecting a card that is already inlisted (libfreefare does this in
+	// mifare_desfire_connect right after freefare_get_tags) needs no RF
+	// round trip, the card would not answer a second activation anyway.
+	// It routes the following exchanges to that card's Tg.
+	if ((t = pn532_find_target(chip, pbtInitData, szInitData))) {
+		chip->current = t;
+		pn532_cached_target(t, pnt);
+		return pnd->last_error = 1;
+	}
+	
+	pn532_release_targets(chip);
+	count = Adafruit_PN532_inListPassiveTargets(pnd->driver_data, PN532_MIFARE_ISO14443A, 1, pbtInitData, szInitData, &target, pnd->bInfiniteSelect ? 0 : 1000);
+	if (!count)
+		return pnd->last_error = 0;
+	if (!pn532_activated(pnd, &target, count, pnt))
+		return pnd->last_error = NFC_EIO;
+	pn532_cached_target(chip->current, pnt);
+	return pnd->last_error = 1;
+}
+// Checks the target types of a poll and turns them into InAutoPoll
+// types, returns how many or an error
+static int pn532_poll_types(nfc_device *pnd, const nfc_modulation *pnmTargetTypes, const size_t szTargetTypes, const uint8_t uiPollNr, const uint8_t uiPeriod, uint8_t *types){
+	uint8_t szTypes = 0;
+	size_t n;
+	
+	for (n = 0; n < szTargetTypes; n++) {
+		if (pnmTargetTypes[n].nmt != NMT_ISO14443A || pnmTargetTypes[n].nbr != NBR_106)
+			return pnd->last_error = NFC_EDEVNOTSUPP;
+	}
+	if (szTargetTypes == 0 || uiPollNr == 0 || uiPeriod == 0 || uiPeriod > 15)
+		return pnd->last_error = NFC_EINVARG;
+	types[szTypes++] = PN532_AUTOPOLL_MIFARE;
+	return szTypes;
+}
+
+// Takes over the targets InAutoPoll found. Stacked cards come back
+// together, the list that follows hands out all of them.
+static int pn532_polled(nfc_device *pnd, const pn532_target_t *targets, uint8_t count, nfc_target *pnt){
+	pn532_chip *chip = pnd->chip_data;
+	
+	if (!count)
+		return pnd->last_error = 0;
+	if (!pn532_activated(pnd, targets, count, pnt))
+		return pnd->last_error = NFC_EIO;
+	pn532_cached_target(chip->current, pnt);
+	chip->polled = true;
+	return pnd->last_error = 1;
+}
+
+int nfc_initiator_poll_target(nfc_device *pnd, const nfc_modulation *pnmTargetTypes, const size_t szTargetTypes, const uint8_t uiPollNr, const uint8_t uiPeriod, nfc_target *pnt){
+	uint8_t types[PN532_AUTOPOLL_MAXTYPES];
+	pn532_target_t targets[PN532_MAX_TARGETS];
+	uint8_t type, count;
+	int szTypes;
+	
+	if ((szTypes = pn532_poll_types(pnd, pnmTargetTypes, szTargetTypes, uiPollNr, uiPeriod, types)) < 0)
+		return szTypes;
+	pn532_release_targets(pnd->chip_data);
+	// the PN532 polls on its own, only found targets (or the end of an
+	// uiPollNr * uiPeriod * 150 ms poll) wake the host
+	count = Adafruit_PN532_inAutoPoll(pnd->driver_data, uiPollNr, uiPeriod, types, szTypes, &type, targets, 0);
+	return pn532_polled(pnd, targets, count, pnt);
+}
+int nfc_initiator_poll_start(nfc_device *pnd, const nfc_modulation *pnmTargetTypes, const size_t szTargetTypes, const uint8_t uiPollNr, const uint8_t uiPeriod){
+	uint8_t types[PN532_AUTOPOLL_MAXTYPES];
+	int szTypes;
+	
+	if ((szTypes = pn532_poll_types(pnd, pnmTargetTypes, szTargetTypes, uiPollNr, uiPeriod, types)) < 0)
+		return szTypes;
+	pn532_release_targets(pnd->chip_data);
+	Adafruit_PN532_startAutoPoll(pnd->driver_data, uiPollNr, uiPeriod, types, szTypes);
+	return pnd->last_error = NFC_SUCCESS;
+}
+int nfc_initiator_poll_result(nfc_device *pnd, nfc_target *pnt){
+	pn532_dev_t *dev = pnd->driver_data;
+	pn532_target_t targets[PN532_MAX_TARGETS];
+	uint8_t type;
+	
+	switch (Adafruit_PN532_pollCommand(dev)) {
+	case PN532_CMD_WAIT_ACK:
+	case PN532_CMD_WAIT_RESPONSE:
+		return pnd->last_error = 0;
+	case PN532_CMD_READY:
+		if (pn532_polled(pnd, targets, Adafruit_PN532_readAutoPoll(dev, &type, targets), pnt) == 0)
+			return pnd->last_error = NFC_ETIMEOUT;
+		return pnd->last_error;
+	default:
+		return pnd->last_error = NFC_EIO;
+	}
 }
 int nfc_initiator_transceive_bytes(nfc_device *pnd, const uint8_t *pbtTx, const size_t szTx, uint8_t *pbtRx, const size_t szRx, int timeout){
-	return 0;
+	pn532_target *t = ((pn532_chip *)pnd->chip_data)->current;
+	uint16_t szRxLen = (szRx > 0xFFFF) ? 0xFFFF : szRx;
+	
+	if (szTx > 0xFFFF)
+		return pnd->last_error = NFC_EINVARG;
+	if (!t || !t->selected)
+		return pnd->last_error = NFC_ETGRELEASED;
+	// the driver writes the response straight into pbtRx. A timeout
+	// given replaces the driver's deadline, 0 (none, libnfc waits
+	// forever) and -1 (the default) keep it, a reader must not hang on
+	// a card that went quiet.
+	if (!Adafruit_PN532_inDataExchange(pnd->driver_data, t->tg, (uint8_t *)pbtTx, szTx, pbtRx, &szRxLen, timeout > 0xFFFF ? 0xFFFF : timeout > 0 ? timeout : 0)) {
+		pn532_bitrate_fallback(pnd, t);
+		return pnd->last_error = NFC_ERFTRANS;
+	}
+	pnd->last_error = NFC_SUCCESS;
+	return szRxLen;
 }
 int nfc_initiator_deselect_target(nfc_device *pnd){
-	return 0;
+	pn532_chip *chip = pnd->chip_data;
+	pn532_target *t = chip->current;
+	
+	chip->current = NULL;
+	chip->polled = false;
+	if (!t || !t->selected)
+		return pnd->last_error = NFC_SUCCESS;
+	t->selected = false;
+	if (!Adafruit_PN532_inDeselect(pnd->driver_data, t->tg))
+		return pnd->last_error = NFC_EIO;
+	return pnd->last_error = NFC_SUCCESS;
 }
+// CRC_A low byte first, as sent
 void iso14443a_crc(uint8_t *pbtData, size_t szLen, uint8_t *pbtCrc){
+	uint16_t crc = crc_a_update(CRC_A_INIT, pbtData, szLen);
+	
+	pbtCrc[0] = crc;
+	pbtCrc[1] = crc >> 8;
 }
 void iso14443a_crc_append(uint8_t *pbtData, size_t szLen){
+	iso14443a_crc(pbtData, szLen, pbtData + szLen);
 }
 void nfc_init(nfc_context **context){
+	uint8_t i;
+	
+	// Every NSS high before the first PN532 is opened, the others would
+	// take its start-up traffic for theirs. The port bit first, so the
+	// pin never drives low.
+	for (i = 0; i < PN532_READERS; i++) {
+		*pn532_pins[i].ss_port |= _BV(pn532_pins[i].ss_bit);
+		*pn532_pins[i].ss_ddr |= _BV(pn532_pins[i].ss_bit);
+	}
+	memset(&pn532_context, 0, sizeof(pn532_context));
+	*context = &pn532_context;
 }
 nfc_device *nfc_open(nfc_context *context, const nfc_connstring connstring){
-	return NULL;
+	const char *p = connstring + sizeof(PN532_CONNSTRING) - 1;
+	pn532_dev_t *dev;
+	nfc_device *pnd;
+	uint8_t n;
+	
+	if (strncmp(connstring, PN532_CONNSTRING, sizeof(PN532_CONNSTRING) - 1) || p[0] != ':' || p[1] < '0' || p[2])
+		return NULL;
+	n = p[1] - '0';
+	if (n >= PN532_READERS)
+		return NULL;
+	pnd = &pn532_devices[n];
+	dev = &pn532_devs[n];
+	Adafruit_PN532_Adafruit_PN532(dev, &pn532_pins[n]);
+	Adafruit_PN532_begin(dev);
+	if (!Adafruit_PN532_getFirmwareVersion(dev))
+		return NULL;
+	if (!Adafruit_PN532_SAMConfig(dev))
+		return NULL;
+	memset(pnd, 0, sizeof(*pnd));
+	memset(&pn532_chip_data[n], 0, sizeof(pn532_chip_data[n]));
+	pn532_chip_data[n].bitrate_max = PN532_MAX_BITRATE;
+	pnd->context = context;
+	pnd->driver_data = dev;
+	pnd->chip_data = &pn532_chip_data[n];
+	strcpy(pnd->name, "PN532");
+	strcpy(pnd->connstring, connstring);
+	pnd->bCrc = true;
+	pnd->bPar = true;
+	pnd->bEasyFraming = true;
+	pnd->bAutoIso14443_4 = true;
+	pnd->bInfiniteSelect = true;
+	pnd->last_error = NFC_SUCCESS;
+	return pnd;
 }
 size_t nfc_list_devices(nfc_context *context, nfc_connstring connstrings[], size_t connstrings_len){
-	return 0;
-}
\ No newline at end of file
+	size_t n;
+	
+	for (n = 0; n < connstrings_len && n < PN532_READERS; n++) {
+		strcpy(connstrings[n], PN532_CONNSTRING ":0");
+		connstrings[n][sizeof(PN532_CONNSTRING)] += n;
+	}
+	return n;
+}
@@ -1,8 +1,9 @@
 #ifndef _NFCDUMMY_H_
 #define _NFCDUMMY_H_
 
-#define DEVICE_NAME_LENGTH  256
-#define NFC_BUFSIZE_CONNSTRING 1024
+// libnfc uses 256/1024 here, far too much SRAM for the ATmega
+#define DEVICE_NAME_LENGTH  16
+#define NFC_BUFSIZE_CONNSTRING 16
 #define MAX_USER_DEFINED_DEVICES 4
 typedef char nfc_connstring[NFC_BUFSIZE_CONNSTRING];
 typedef struct nfc_device nfc_device;
@@ -165,6 +166,18 @@ typedef struct {
 } nfc_target;
 
 #define NFC_SUCCESS			 0
+#define NFC_EIO				-1
+#define NFC_EINVARG			-2
+#define NFC_EDEVNOTSUPP		-3
+#define NFC_ENOTSUCHDEV		-4
+#define NFC_EOVFLOW			-5
+#define NFC_ETIMEOUT		-6
+#define NFC_EOPABORTED		-7
+#define NFC_ENOTIMPL		-8
+#define NFC_ETGRELEASED		-10
+#define NFC_ERFTRANS		-20
+#define NFC_ESOFT			-80
+#define NFC_ECHIP			-90
 
 void nfc_init(nfc_context **context);
 int nfc_initiator_init(nfc_device *pnd);
@@ -173,6 +186,13 @@ int nfc_initiator_list_passive_targets(nfc_device *pnd, const nfc_modulation nm,
 int nfc_initiator_target_is_present(nfc_device *pnd, const nfc_target *pnt);
 int nfc_device_get_last_error(const nfc_device *pnd);
 const char *nfc_strerror(const nfc_device *pnd);
+int nfc_initiator_poll_target(nfc_device *pnd, const nfc_modulation *pnmTargetTypes, const size_t szTargetTypes, const uint8_t uiPollNr, const uint8_t uiPeriod, nfc_target *pnt);
+// Not in libnfc: nfc_initiator_poll_target split up, so that several
+// readers can poll at the same time. poll_result returns 1 with the
+// target in pnt, 0 while the PN532 still polls, NFC_ETIMEOUT if all polls
+// came back empty.
+int nfc_initiator_poll_start(nfc_device *pnd, const nfc_modulation *pnmTargetTypes, const size_t szTargetTypes, const uint8_t uiPollNr, const uint8_t uiPeriod);
+int nfc_initiator_poll_result(nfc_device *pnd, nfc_target *pnt);
 int nfc_initiator_select_passive_target(nfc_device *pnd, const nfc_modulation nm, const uint8_t *pbtInitData, const size_t szInitData, nfc_target *pnt);
 int nfc_initiator_transceive_bytes(nfc_device *pnd, const uint8_t *pbtTx, const size_t szTx, uint8_t *pbtRx, const size_t szRx, int timeout);
 int nfc_initiator_deselect_target(nfc_device *pnd);
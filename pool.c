@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <string.h>
+#include "pool.h"
+
+typedef struct pool_block {
+	struct pool_block *next;
+} pool_block;
+
+typedef struct {
+	uint8_t *blocks;
+	uint16_t size;
+	uint8_t count;
+	// blocks from fresh on have never been handed out, so the free list
+	// needs no setup
+	uint8_t fresh;
+	pool_block *free;
+	uint8_t used;
+	uint8_t peak;
+} pool_t;
+
+static uint8_t pool_small[POOL_SMALL_COUNT][POOL_SMALL_SIZE] __attribute__((aligned));
+static uint8_t pool_medium[POOL_MEDIUM_COUNT][POOL_MEDIUM_SIZE] __attribute__((aligned));
+static uint8_t pool_large[POOL_LARGE_COUNT][POOL_LARGE_SIZE] __attribute__((aligned));
+
+static pool_t pools[POOL_CLASSES] = {
+	{ pool_small[0], POOL_SMALL_SIZE, POOL_SMALL_COUNT },
+	{ pool_medium[0], POOL_MEDIUM_SIZE, POOL_MEDIUM_COUNT },
+	{ pool_large[0], POOL_LARGE_SIZE, POOL_LARGE_COUNT },
+};
+static uint16_t pool_overflow_count;
+
+// The allocator of the C library, for what the pools cannot serve
+void *__real_malloc(size_t size);
+void __real_free(void *ptr);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size);
+void __wrap_free(void *ptr);
+void *__wrap_realloc(void *ptr, size_t size);
+void *__wrap_calloc(size_t n, size_t size);
+
+// The pool ptr was handed out from, NULL for heap blocks
+static pool_t *pool_of(void *ptr){
+	pool_t *p;
+
+	for (p = pools; p < pools + POOL_CLASSES; p++) {
+		if ((uint8_t *)ptr >= p->blocks && (uint8_t *)ptr < p->blocks + p->size * p->count)
+			return p;
+	}
+	return NULL;
+}
+
+// A full pool passes the request on to the one with the next larger blocks
+void *__wrap_malloc(size_t size){
+	pool_t *p;
+	void *ptr;
+
+	for (p = pools; p < pools + POOL_CLASSES; p++) {
+		if (size > p->size)
+			continue;
+		if (p->free) {
+			ptr = p->free;
+			p->free = p->free->next;
+		} else if (p->fresh < p->count) {
+			ptr = p->blocks + p->size * p->fresh++;
+		} else {
+			continue;
+		}
+		if (++p->used > p->peak)
+			p->peak = p->used;
+		return ptr;
+	}
+	pool_overflow_count++;
+	return __real_malloc(size);
+}
+
+void __wrap_free(void *ptr){
+	pool_t *p = pool_of(ptr);
+	pool_block *b = ptr;
+
+	if (!p) {
+		__real_free(ptr);
+		return;
+	}
+	b->next = p->free;
+	p->free = b;
+	p->used--;
+}
+
+// libfreefare grows its tag lists and crypto buffers a little at a time,
+// mostly the block is large enough already
+void *__wrap_realloc(void *ptr, size_t size){
+	pool_t *p = pool_of(ptr);
+	void *moved;
+
+	if (!p)
+		return ptr ? __real_realloc(ptr, size) : __wrap_malloc(size);
+	if (size <= p->size)
+		return ptr;
+	moved = __wrap_malloc(size);
+	if (moved) {
+		memcpy(moved, ptr, p->size);
+		__wrap_free(ptr);
+	}
+	return moved;
+}
+
+void *__wrap_calloc(size_t n, size_t size){
+	void *ptr;
+
+	if (size && n > (size_t)-1 / size)
+		return NULL;
+	ptr = __wrap_malloc(n * size);
+	if (ptr)
+		memset(ptr, 0, n * size);
+	return ptr;
+}
+
+void pool_stats(uint8_t i, pool_stats_t *stats){
+	stats->size = pools[i].size;
+	stats->count = pools[i].count;
+	stats->used = pools[i].used;
+	stats->peak = pools[i].peak;
+}
+
+// Requests that went to the heap because no pool had a block for them
+uint16_t pool_overflows(void){
+	return pool_overflow_count;
+}
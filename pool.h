@@ -0,0 +1,54 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+
+// Fixed block pools behind malloc and free. libfreefare allocates its
+// tags, AIDs, keys, crypto buffers and UID strings with malloc, once per
+// card. The firmware is linked with -Wl,--wrap=malloc,... so these calls
+// end up here: a request is served from the smallest pool with a free
+// block large enough, in constant time from the pool's free list, and
+// freeing puts the block back. The blocks of one size are
+// interchangeable, the heap does not fragment however long the firmware
+// runs. Only a request no pool can serve goes to the heap,
+// pool_overflows() counts those.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <nfcPN532.h>
+
+// The pools, smallest blocks first. Small: AIDs, UID strings and tag
+// lists. Medium: crypto buffers. Large: tags and keys, a tag and its
+// session key per card, and the key being authenticated with.
+#ifndef POOL_SMALL_SIZE
+	#define POOL_SMALL_SIZE		16
+#endif
+#ifndef POOL_SMALL_COUNT
+	#define POOL_SMALL_COUNT	(4 + PN532_READERS)
+#endif
+#ifndef POOL_MEDIUM_SIZE
+	#define POOL_MEDIUM_SIZE	64
+#endif
+#ifndef POOL_MEDIUM_COUNT
+	#define POOL_MEDIUM_COUNT	(2 * PN532_READERS * PN532_MAX_TARGETS)
+#endif
+#ifndef POOL_LARGE_SIZE
+	#define POOL_LARGE_SIZE		512
+#endif
+#ifndef POOL_LARGE_COUNT
+	#define POOL_LARGE_COUNT	(2 * PN532_READERS * PN532_MAX_TARGETS + 1)
+#endif
+
+#define POOL_CLASSES		3
+
+// Blocks of pool i in use now and at most since the start, to size the
+// pools after a run with the busiest readers
+typedef struct {
+	uint16_t size;
+	uint8_t count;
+	uint8_t used;
+	uint8_t peak;
+} pool_stats_t;
+
+void pool_stats(uint8_t i, pool_stats_t *stats);
+uint16_t pool_overflows(void);
+
+#endif
@@ -0,0 +1,133 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+#include "sched.h"
+#include "trace.h"
+
+_Static_assert(SCHED_MAX_TASKS <= 8, "the task masks have 8 bits");
+
+static sched_task_t sched_tasks[SCHED_MAX_TASKS];
+static void *sched_args[SCHED_MAX_TASKS];
+static uint8_t sched_count;
+// Posted and not yet started
+static volatile uint8_t sched_pending;
+// Started and not yet finished, a task is not started again from the
+// idle hook while it waits
+static uint8_t sched_running;
+// Tasks that wait for a PN532, not started from the idle hook
+static uint8_t sched_waiting;
+// Bit of the waiting task that was started last
+static uint8_t sched_turn;
+static sched_stats_t sched_task_stats[SCHED_MAX_TASKS];
+#ifdef TRACE
+static uint32_t sched_posted[SCHED_MAX_TASKS];
+#endif
+
+// SCHED_NO_TASK when the table is full, the task is not added then
+uint8_t sched_add(sched_task_t task, void *arg){
+	if (sched_count == SCHED_MAX_TASKS)
+		return SCHED_NO_TASK;
+	sched_tasks[sched_count] = task;
+	sched_args[sched_count] = arg;
+	return sched_count++;
+}
+
+// The task waits for a PN532 (the driver's idle hook runs then), it is
+// only started from sched_run and never inside another task's wait
+void sched_waits(uint8_t id){
+	sched_waiting |= _BV(id);
+}
+
+// Safe to call from interrupts. Posting a pending task again does not
+// run it twice.
+void sched_post(uint8_t id){
+	uint8_t bit = _BV(id);
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (!(sched_pending & bit)) {
+			sched_pending = sched_pending | bit;
+			#ifdef TRACE
+				sched_posted[id] = trace_now();
+			#endif
+		}
+	}
+}
+
+// Runs the posted task with the highest priority that is not in skip,
+// called and returns with interrupts disabled
+static bool sched_next(uint8_t skip){
+	uint8_t ready = sched_pending & ~sched_running & ~skip;
+	uint8_t id, bit, later;
+	sched_stats_t *s;
+	#ifdef TRACE
+		uint32_t start, latency, run;
+	#endif
+	
+	if (!ready)
+		return false;
+	for (id = 0, bit = 1; !(ready & bit); id++)
+		bit <<= 1;
+	// the waiting tasks take turns, the first posted one after the last
+	// started goes next: a reader that posts itself for the next step of
+	// its tap does not hold up the others
+	if (bit & sched_waiting) {
+		later = ready & sched_waiting & ~((sched_turn << 1) - 1);
+		while (later && !(later & bit)) {
+			bit <<= 1;
+			id++;
+		}
+		sched_turn = bit;
+	}
+	sched_pending = sched_pending & ~bit;
+	sched_running |= bit;
+	s = &sched_task_stats[id];
+	#ifdef TRACE
+		start = trace_now();
+		latency = start - sched_posted[id];
+	#endif
+	sei();
+	
+	sched_tasks[id](sched_args[id]);
+	
+	s->runs++;
+	#ifdef TRACE
+		run = trace_now() - start;
+		if (latency > s->max_latency)
+			s->max_latency = latency;
+		if (run > s->max_run)
+			s->max_run = run;
+	#endif
+	cli();
+	sched_running &= ~bit;
+	return true;
+}
+
+// Main loop body: runs the next posted task, or sleeps until an interrupt
+// when there is none
+void sched_run(void){
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	cli();
+	if (!sched_next(0)) {
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
+	}
+	sei();
+}
+
+// PN532 idle hook (Adafruit_PN532_setIdleHook), runs one posted task
+// that does not wait for a PN532 itself, so the waiting one and the other
+// readers are not started inside this wait. With interrupts disabled
+// between the check and the caller's sleep, no post from an interrupt is
+// missed.
+bool sched_idle(void){
+	return sched_next(sched_waiting);
+}
+
+void sched_stats(uint8_t id, sched_stats_t *stats){
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		*stats = sched_task_stats[id];
+	}
+}
@@ -0,0 +1,45 @@
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+// Cooperative run-to-completion scheduler for the main loop. Tasks are
+// posted from code or from interrupts and run one at a time, a task is
+// never preempted by another one. The lower the id (the earlier the task
+// was added) the higher its priority. While a task waits for a PN532,
+// sched_idle as the driver's idle hook runs the other posted tasks that
+// do not wait for one themselves, so a card transaction does not hold up
+// the rest of the firmware. Waits never nest: the tasks marked with
+// sched_waits only start from sched_run, one at a time, and keep their
+// runs short by posting themselves again for the rest of their work.
+// Among themselves they take turns rather than go by priority. Each PN532
+// is owned by one task, only that task may use it.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// One bit per task in the pending mask
+#ifndef SCHED_MAX_TASKS
+	#define SCHED_MAX_TASKS		8
+#endif
+// sched_add with all SCHED_MAX_TASKS taken
+#define SCHED_NO_TASK		0xFF
+
+// arg is the one given to sched_add, one function can serve several
+// tasks (e.g. one per reader)
+typedef void (*sched_task_t)(void *arg);
+
+// Worst-case latency (post to start) and run time of a task in Timer1
+// ticks (TRACE_TICK_HZ), only measured in builds with -DTRACE
+typedef struct {
+	uint16_t runs;
+	uint32_t max_latency;
+	uint32_t max_run;
+} sched_stats_t;
+
+uint8_t sched_add(sched_task_t task, void *arg);
+void sched_waits(uint8_t id);
+void sched_post(uint8_t id);
+void sched_run(void);
+bool sched_idle(void);
+void sched_stats(uint8_t id, sched_stats_t *stats);
+
+#endif
@@ -0,0 +1,435 @@
+#include <string.h>
+#include "desfiresim.h"
+#include "simaes.h"
+
+// Native command codes
+#define DF_GET_VERSION			0x60
+#define DF_SELECT_APPLICATION	0x5A
+#define DF_AUTHENTICATE_AES		0xAA
+#define DF_ADDITIONAL_FRAME		0xAF
+#define DF_GET_VALUE			0x6C
+#define DF_CREDIT				0x0C
+#define DF_DEBIT				0xDC
+#define DF_COMMIT_TRANSACTION	0xC7
+#define DF_ABORT_TRANSACTION	0xA7
+
+// Status codes
+#define DF_OPERATION_OK			0x00
+#define DF_ILLEGAL_COMMAND		0x1C
+#define DF_INTEGRITY_ERROR		0x1E
+#define DF_LENGTH_ERROR			0x7E
+#define DF_PERMISSION_DENIED	0x9D
+#define DF_APPLICATION_NOT_FOUND	0xA0
+#define DF_AUTHENTICATION_ERROR	0xAE
+#define DF_BOUNDARY_ERROR		0xBE
+#define DF_FILE_NOT_FOUND		0xF0
+
+// Communication settings of the value file
+#define DF_COMM_PLAIN			0x00
+#define DF_COMM_MACED			0x01
+#define DF_COMM_ENCIPHERED		0x03
+
+// The application main.c works with
+#define SIM_AID					0x0000F7
+#define SIM_VALFILENO			1
+#define SIM_NKEYS				2
+
+// Card processing times in us (EEPROM writes dominate the commit)
+#define T_DEFAULT				1000
+#define T_SELECT				1800
+#define T_AUTH1					2000
+#define T_AUTH2					2800
+#define T_VALUE					1500
+#define T_COMMIT				9000
+
+// Key 1 is diversified from main.c's master key (AN10922, UID and AID)
+static const uint8_t sim_master_key[16] = {
+	0xf9,0x28,0x7d,0x1f,0xe8,0xb0,0xf2,0xf2,0x70,0xf0,0xe1,0x9f,0x05,0x8a,0xe0,0x51
+};
+
+struct desfire_card {
+	uint8_t uid[DESFIRESIM_UIDLEN];
+	uint8_t keys[SIM_NKEYS][16];
+	uint32_t rng;
+	uint32_t aid;
+	// authentication
+	int8_t auth_key;
+	uint8_t pending_auth;
+	uint8_t rnd_b[16];
+	uint8_t iv[16];
+	simaes_ctx key;
+	simaes_ctx session;
+	// value file
+	uint8_t comm;
+	int32_t value;
+	int32_t pending;
+	int32_t lower, upper;
+	// commits that lowered the value
+	unsigned debits;
+	// GetVersion parts
+	uint8_t version_part;
+};
+static struct desfire_card cards[DESFIRESIM_CARDS];
+// the card desfiresim_use picked, all other calls act on it
+static struct desfire_card *card = cards;
+
+static uint8_t rnd(void){
+	card->rng = card->rng * 1103515245 + 12345;
+	return card->rng >> 16;
+}
+
+static uint32_t crc32_desfire(const uint8_t *data, size_t len, uint32_t crc){
+	int b;
+	
+	while (len--) {
+		crc ^= *data++;
+		for (b = 0; b < 8; b++)
+			crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+	}
+	return crc;
+}
+
+static void put32(uint8_t *p, uint32_t v){
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static uint32_t get32(const uint8_t *p){
+	return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// AN10922 AES-128: CMAC of 0x01 || UID || AID padded to 32 bytes
+static void diversify(const uint8_t *master, uint8_t *key){
+	uint8_t d[32], k[16], iv[16];
+	simaes_ctx ctx;
+	int i, n = 0, msb;
+	
+	simaes_setkey(&ctx, master);
+	memset(k, 0, 16);
+	simaes_encrypt(&ctx, k, k);
+	// K2 = L << 2 in GF(2^128)
+	for (n = 0; n < 2; n++) {
+		msb = k[0] & 0x80;
+		for (i = 0; i < 15; i++)
+			k[i] = (k[i] << 1) | (k[i + 1] >> 7);
+		k[15] = (k[15] << 1) ^ (msb ? 0x87 : 0);
+	}
+	memset(d, 0, 32);
+	n = 0;
+	d[n++] = 0x01;
+	memcpy(d + n, card->uid, DESFIRESIM_UIDLEN);
+	n += DESFIRESIM_UIDLEN;
+	d[n++] = SIM_AID;
+	d[n++] = SIM_AID >> 8;
+	d[n++] = SIM_AID >> 16;
+	d[n] = 0x80;
+	for (i = 0; i < 16; i++)
+		d[16 + i] ^= k[i];
+	memset(iv, 0, 16);
+	simaes_cbc_encrypt(&ctx, iv, d, 32);
+	memcpy(key, d + 16, 16);
+}
+
+void desfiresim_init(uint32_t seed){
+	unsigned n;
+	int i;
+	
+	for (n = DESFIRESIM_CARDS; n-- > 0; ) {
+		card = &cards[n];
+		memset(card, 0, sizeof(*card));
+		card->rng = seed + n;
+		card->uid[0] = 0x04;
+		for (i = 1; i < DESFIRESIM_UIDLEN; i++)
+			card->uid[i] = rnd();
+		diversify(sim_master_key, card->keys[1]);
+		card->comm = DF_COMM_ENCIPHERED;
+		card->value = card->pending = 100000;
+		card->lower = 0;
+		card->upper = 1000000;
+		desfiresim_activate();
+	}
+}
+
+void desfiresim_use(unsigned n){
+	card = &cards[n];
+}
+
+void desfiresim_activate(void){
+	card->aid = 0;
+	card->auth_key = -1;
+	card->pending_auth = 0;
+	card->version_part = 0;
+	card->pending = card->value;
+}
+
+const uint8_t *desfiresim_uid(void){
+	return card->uid;
+}
+
+int32_t desfiresim_value(void){
+	return card->value;
+}
+
+unsigned desfiresim_debits(void){
+	return card->debits;
+}
+
+// Authenticated plain commands update the IV with a CMAC over the command
+static void cmac_command(const uint8_t *cmd, size_t len){
+	uint8_t mac[16];
+	
+	if (card->auth_key >= 0)
+		simaes_cmac(&card->session, card->iv, cmd, len, mac);
+}
+
+// Status plus, when authenticated, the first 8 bytes of the response CMAC
+// computed over data || status
+static size_t respond(uint8_t *res, uint8_t status, const uint8_t *data, size_t len){
+	uint8_t buf[64], mac[16];
+	
+	res[0] = status;
+	memcpy(res + 1, data, len);
+	if (status != DF_OPERATION_OK || card->auth_key < 0)
+		return len + 1;
+	memcpy(buf, data, len);
+	buf[len] = status;
+	simaes_cmac(&card->session, card->iv, buf, len + 1, mac);
+	memcpy(res + 1 + len, mac, 8);
+	return len + 9;
+}
+
+static size_t fail(uint8_t *res, uint8_t status){
+	card->auth_key = -1;
+	res[0] = status;
+	return 1;
+}
+
+static size_t cmd_authenticate(const uint8_t *cmd, size_t len, uint8_t *res){
+	uint8_t iv[16];
+	
+	if (len != 2)
+		return fail(res, DF_LENGTH_ERROR);
+	if (card->aid != SIM_AID || cmd[1] >= SIM_NKEYS)
+		return fail(res, DF_PERMISSION_DENIED);
+	card->auth_key = -1;
+	card->pending_auth = cmd[1] + 1;
+	simaes_setkey(&card->key, card->keys[cmd[1]]);
+	for (int i = 0; i < 16; i++)
+		card->rnd_b[i] = rnd();
+	memset(iv, 0, 16);
+	memcpy(res + 1, card->rnd_b, 16);
+	simaes_cbc_encrypt(&card->key, iv, res + 1, 16);
+	memcpy(card->iv, iv, 16);
+	res[0] = DF_ADDITIONAL_FRAME;
+	return 17;
+}
+
+static size_t cmd_authenticate2(const uint8_t *cmd, size_t len, uint8_t *res){
+	uint8_t buf[32], rnd_a[16], sk[16];
+	
+	if (len != 33)
+		return fail(res, DF_LENGTH_ERROR);
+	memcpy(buf, cmd + 1, 32);
+	simaes_cbc_decrypt(&card->key, card->iv, buf, 32);
+	// RndB' = RndB rotated left by one byte
+	if (memcmp(buf + 16, card->rnd_b + 1, 15) || buf[31] != card->rnd_b[0])
+		return fail(res, DF_AUTHENTICATION_ERROR);
+	memcpy(rnd_a, buf, 16);
+	memcpy(res + 1, rnd_a + 1, 15);
+	res[16] = rnd_a[0];
+	simaes_cbc_encrypt(&card->key, card->iv, res + 1, 16);
+	
+	memcpy(sk, rnd_a, 4);
+	memcpy(sk + 4, card->rnd_b, 4);
+	memcpy(sk + 8, rnd_a + 12, 4);
+	memcpy(sk + 12, card->rnd_b + 12, 4);
+	simaes_setkey(&card->session, sk);
+	memset(card->iv, 0, 16);
+	card->auth_key = card->pending_auth - 1;
+	card->pending_auth = 0;
+	res[0] = DF_OPERATION_OK;
+	return 17;
+}
+
+static size_t cmd_value(const uint8_t *cmd, size_t len, uint8_t *res){
+	uint8_t buf[16];
+	int32_t amount;
+	
+	if (card->aid != SIM_AID)
+		return fail(res, DF_PERMISSION_DENIED);
+	if (len < 2 || cmd[1] != SIM_VALFILENO)
+		return fail(res, DF_FILE_NOT_FOUND);
+	if (card->auth_key < 0)
+		return fail(res, DF_AUTHENTICATION_ERROR);
+	if (card->comm == DF_COMM_ENCIPHERED) {
+		if (len != 18)
+			return fail(res, DF_LENGTH_ERROR);
+		memcpy(buf, cmd + 2, 16);
+		simaes_cbc_decrypt(&card->session, card->iv, buf, 16);
+		// value || CRC32(cmd || fileno || value) || padding
+		if (crc32_desfire(buf, 4, crc32_desfire(cmd, 2, 0xFFFFFFFF)) != get32(buf + 4))
+			return fail(res, DF_INTEGRITY_ERROR);
+		amount = get32(buf);
+	} else {
+		if (len != 6)
+			return fail(res, DF_LENGTH_ERROR);
+		cmac_command(cmd, len);
+		amount = get32(cmd + 2);
+	}
+	if (amount < 0)
+		return fail(res, DF_BOUNDARY_ERROR);
+	if (cmd[0] == DF_DEBIT)
+		amount = -amount;
+	if (card->pending + amount < card->lower || card->pending + amount > card->upper)
+		return fail(res, DF_BOUNDARY_ERROR);
+	card->pending += amount;
+	return respond(res, DF_OPERATION_OK, NULL, 0);
+}
+
+static size_t cmd_get_value(const uint8_t *cmd, size_t len, uint8_t *res){
+	uint8_t buf[16];
+	
+	if (card->aid != SIM_AID)
+		return fail(res, DF_PERMISSION_DENIED);
+	if (len != 2 || cmd[1] != SIM_VALFILENO)
+		return fail(res, DF_FILE_NOT_FOUND);
+	if (card->comm != DF_COMM_PLAIN && card->auth_key < 0)
+		return fail(res, DF_AUTHENTICATION_ERROR);
+	cmac_command(cmd, len);
+	put32(buf, card->value);
+	if (card->comm != DF_COMM_ENCIPHERED)
+		return respond(res, DF_OPERATION_OK, buf, 4);
+	// value || CRC32(value || status) || padding, enciphered
+	buf[4] = DF_OPERATION_OK;
+	put32(buf + 4, crc32_desfire(buf, 5, 0xFFFFFFFF));
+	memset(buf + 8, 0, 8);
+	simaes_cbc_encrypt(&card->session, card->iv, buf, 16);
+	res[0] = DF_OPERATION_OK;
+	memcpy(res + 1, buf, 16);
+	return 17;
+}
+
+static size_t cmd_get_version(const uint8_t *cmd, size_t len, uint8_t *res){
+	static const uint8_t hw[7] = { 0x04, 0x01, 0x01, 0x01, 0x00, 0x18, 0x05 };
+	static const uint8_t sw[7] = { 0x04, 0x01, 0x01, 0x01, 0x04, 0x18, 0x05 };
+	uint8_t id[14];
+	
+	if (cmd[0] == DF_GET_VERSION) {
+		card->version_part = 1;
+		res[0] = DF_ADDITIONAL_FRAME;
+		memcpy(res + 1, hw, 7);
+		return 8;
+	}
+	if (card->version_part == 1) {
+		card->version_part = 2;
+		res[0] = DF_ADDITIONAL_FRAME;
+		memcpy(res + 1, sw, 7);
+		return 8;
+	}
+	card->version_part = 0;
+	memset(id, 0, sizeof(id));
+	memcpy(id, card->uid, DESFIRESIM_UIDLEN);
+	id[13] = 0x12;
+	return respond(res, DF_OPERATION_OK, id, sizeof(id));
+}
+
+static size_t native_command(const uint8_t *cmd, size_t len, uint8_t *res, uint32_t *busy_us){
+	uint32_t aid;
+	
+	*busy_us = T_DEFAULT;
+	if (len == 0)
+		return fail(res, DF_LENGTH_ERROR);
+	if (cmd[0] != DF_ADDITIONAL_FRAME) {
+		card->pending_auth = 0;
+		card->version_part = 0;
+	}
+	switch (cmd[0]) {
+	case DF_SELECT_APPLICATION:
+		*busy_us = T_SELECT;
+		if (len != 4)
+			return fail(res, DF_LENGTH_ERROR);
+		aid = cmd[1] | ((uint32_t)cmd[2] << 8) | ((uint32_t)cmd[3] << 16);
+		card->auth_key = -1;
+		card->pending = card->value;
+		if (aid != 0 && aid != SIM_AID)
+			return fail(res, DF_APPLICATION_NOT_FOUND);
+		card->aid = aid;
+		res[0] = DF_OPERATION_OK;
+		return 1;
+	case DF_AUTHENTICATE_AES:
+		*busy_us = T_AUTH1;
+		return cmd_authenticate(cmd, len, res);
+	case DF_ADDITIONAL_FRAME:
+		if (card->pending_auth) {
+			*busy_us = T_AUTH2;
+			return cmd_authenticate2(cmd, len, res);
+		}
+		if (card->version_part)
+			return cmd_get_version(cmd, len, res);
+		return fail(res, DF_ILLEGAL_COMMAND);
+	case DF_GET_VERSION:
+		return cmd_get_version(cmd, len, res);
+	case DF_GET_VALUE:
+		*busy_us = T_VALUE;
+		return cmd_get_value(cmd, len, res);
+	case DF_CREDIT:
+	case DF_DEBIT:
+		*busy_us = T_VALUE;
+		return cmd_value(cmd, len, res);
+	case DF_COMMIT_TRANSACTION:
+		*busy_us = T_COMMIT;
+		cmac_command(cmd, len);
+		if (card->pending < card->value)
+			card->debits++;
+		card->value = card->pending;
+		return respond(res, DF_OPERATION_OK, NULL, 0);
+	case DF_ABORT_TRANSACTION:
+		cmac_command(cmd, len);
+		card->pending = card->value;
+		return respond(res, DF_OPERATION_OK, NULL, 0);
+	default:
+		return fail(res, DF_ILLEGAL_COMMAND);
+	}
+}
+
+size_t desfiresim_command(const uint8_t *cmd, size_t len, uint8_t *res, uint32_t *busy_us){
+	uint8_t native[300];
+	size_t n, lc;
+	
+	// ISO 7816 wrapping: 90 CMD 00 00 Lc DATA 00 -> DATA 91 STATUS
+	if (len >= 5 && cmd[0] == 0x90 && cmd[2] == 0 && cmd[3] == 0) {
+		lc = cmd[4];
+		if (lc + 5 > len)
+			lc = len - 5;
+		native[0] = cmd[1];
+		memcpy(native + 1, cmd + 5, lc);
+		n = native_command(native, lc + 1, native + 1 + lc, busy_us);
+		memcpy(res, native + 2 + lc, n - 1);
+		res[n - 1] = 0x91;
+		res[n] = native[1 + lc];
+		return n + 1;
+	}
+	return native_command(cmd, len, res, busy_us);
+}
+
+const char *desfiresim_command_name(const uint8_t *cmd, size_t len){
+	uint8_t code;
+	
+	if (len == 0)
+		return "DESFire ?";
+	code = (len >= 5 && cmd[0] == 0x90) ? cmd[1] : cmd[0];
+	switch (code) {
+	case DF_SELECT_APPLICATION:	return "SelectApplication";
+	case DF_AUTHENTICATE_AES:	return "AuthenticateAES";
+	case DF_ADDITIONAL_FRAME:	return "AdditionalFrame";
+	case DF_GET_VERSION:		return "GetVersion";
+	case DF_GET_VALUE:			return "GetValue";
+	case DF_CREDIT:				return "Credit";
+	case DF_DEBIT:				return "Debit";
+	case DF_COMMIT_TRANSACTION:	return "CommitTransaction";
+	case DF_ABORT_TRANSACTION:	return "AbortTransaction";
+	default:					return "DESFire other";
+	}
+}
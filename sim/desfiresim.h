@@ -0,0 +1,31 @@
+#ifndef _DESFIRESIM_H_
+#define _DESFIRESIM_H_
+
+// Software MIFARE DESFire EV1 card: one application with AES keys and a
+// value file, enough for the select / authenticate / debit / commit
+// transaction main.c performs. Native and ISO 7816 wrapped commands are
+// understood.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define DESFIRESIM_UIDLEN		7
+// Cards of all readers, PN532SIM_STACK per reader
+#define DESFIRESIM_CARDS		8
+
+void desfiresim_init(uint32_t seed);
+// Picks the card the other calls act on, 0 .. DESFIRESIM_CARDS - 1
+void desfiresim_use(unsigned n);
+// Resets the card state as if it just entered the field
+void desfiresim_activate(void);
+const uint8_t *desfiresim_uid(void);
+// Processes one command, returns the response length. *busy_us is set to
+// the time the card needs to process the command.
+size_t desfiresim_command(const uint8_t *cmd, size_t len, uint8_t *res, uint32_t *busy_us);
+// Name of the native command code for the phase report
+const char *desfiresim_command_name(const uint8_t *cmd, size_t len);
+int32_t desfiresim_value(void);
+// Committed transactions that lowered the value
+unsigned desfiresim_debits(void);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef _SIM_AVR_EEPROM_H_
+#define _SIM_AVR_EEPROM_H_
+
+// EEMEM variables are plain RAM on the host, the EEPROM starts out erased
+// only as far as the firmware initializes it, and nothing is kept between
+// runs.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define EEMEM
+#define E2END	0x0FFF
+
+#define eeprom_is_ready()	1
+#define eeprom_busy_wait()	do {} while (0)
+
+static inline uint8_t eeprom_read_byte(const uint8_t *p){
+	return *p;
+}
+
+static inline void eeprom_write_byte(uint8_t *p, uint8_t value){
+	*p = value;
+}
+
+static inline void eeprom_update_byte(uint8_t *p, uint8_t value){
+	*p = value;
+}
+
+static inline void eeprom_read_block(void *dst, const void *src, size_t n){
+	memcpy(dst, src, n);
+}
+
+static inline void eeprom_write_block(const void *src, void *dst, size_t n){
+	memcpy(dst, src, n);
+}
+
+static inline void eeprom_update_block(const void *src, void *dst, size_t n){
+	memcpy(dst, src, n);
+}
+
+#endif
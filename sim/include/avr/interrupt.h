@@ -0,0 +1,11 @@
+#ifndef _SIM_AVR_INTERRUPT_H_
+#define _SIM_AVR_INTERRUPT_H_
+
+// Interrupt handlers are plain functions. The simulator calls the timer,
+// SPI and USART vectors it models as the virtual clock passes, for the
+// PN532 IRQ it exposes the pin level instead.
+#define ISR(vector)	void vector(void); void vector(void)
+#define sei()
+#define cli()
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef _SIM_AVR_IO_H_
+#define _SIM_AVR_IO_H_
+
+// ATmega1284 registers as plain variables. Only the inputs that matter
+// (the PN532 chip select and IRQ lines, SPI, Timer0, Timer1 and the
+// USART0 status) are backed by the simulator.
+
+#include <stdint.h>
+#include "sim.h"
+
+extern volatile uint8_t sim_io[64];
+extern volatile uint16_t sim_io16[8];
+extern volatile uint16_t sim_udr0;
+extern volatile uint16_t sim_spdr;
+
+// The PN532 IRQ lines on PINA and PINB are kept up to date by the
+// simulator
+#define PORTA		sim_io[0]
+#define DDRA		sim_io[1]
+#define PINA		sim_io[2]
+#define PORTB		sim_io[3]
+#define DDRB		sim_io[4]
+#define PINB		sim_io[5]
+#define PORTC		sim_io[6]
+#define DDRC		sim_io[7]
+#define PINC		sim_io[8]
+#define PORTD		sim_io[9]
+#define DDRD		sim_io[10]
+#define PIND		sim_io[11]
+#define EICRA		sim_io[12]
+#define EIMSK		sim_io[13]
+#define EIFR		sim_io[14]
+#define PCICR		sim_io[28]
+#define PCMSK0		sim_io[29]
+#define SPCR		sim_io[15]
+#define SPSR		(*sim_spsr())
+// written bytes are clocked on the next SPSR read or when sleeping
+#define SPDR		sim_spdr
+#define TCCR0A		sim_io[24]
+#define TCCR0B		sim_io[25]
+#define OCR0A		sim_io[26]
+#define TIMSK0		sim_io[27]
+#define TCCR1A		sim_io[18]
+#define TCCR1B		sim_io[19]
+#define TIMSK1		sim_io[20]
+#define TIFR1		sim_io[21]
+#define TCNT1		sim_tcnt1()
+#define UCSR0A		sim_ucsr0a()
+#define UCSR0B		sim_io[22]
+#define UCSR0C		sim_io[23]
+#define UBRR0		sim_io16[0]
+// written bytes are picked up on the next UCSR0A read
+#define UDR0		sim_udr0
+
+#define PA0	0
+#define PA1	1
+#define PA2	2
+#define PA3	3
+
+#define PB0	0
+#define PB1	1
+#define PB2	2
+#define PB3	3
+#define PB4	4
+#define PB5	5
+#define PB6	6
+#define PB7	7
+
+#define SPR0	0
+#define SPR1	1
+#define CPHA	2
+#define CPOL	3
+#define MSTR	4
+#define DORD	5
+#define SPE		6
+#define SPIE	7
+#define SPI2X	0
+#define WCOL	6
+#define SPIF	7
+
+#define ISC20	4
+#define ISC21	5
+#define INT2	2
+#define INTF2	2
+#define PCIE0	0
+
+#define CS00	0
+#define CS01	1
+#define CS02	2
+#define WGM01	1
+#define OCIE0A	1
+
+#define CS10	0
+#define CS11	1
+#define CS12	2
+#define TOIE1	0
+#define TOV1	0
+
+#define TXB80	0
+#define RXB80	1
+#define UCSZ02	2
+#define TXEN0	3
+#define RXEN0	4
+#define UDRIE0	5
+#define TXCIE0	6
+#define RXCIE0	7
+#define UCSZ00	1
+#define UCSZ01	2
+#define UDRE0	5
+#define TXC0	6
+#define RXC0	7
+
+#define _BV(bit)	(1 << (bit))
+
+#define bit_is_set(sfr, bit)			((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit)			(!((sfr) & _BV(bit)))
+#define loop_until_bit_is_set(sfr, bit)		do {} while (bit_is_clear(sfr, bit))
+#define loop_until_bit_is_clear(sfr, bit)	do {} while (bit_is_set(sfr, bit))
+
+// The driver writes the chip selects through pointers (pn532_pins_t),
+// the simulator is told about every NSS edge
+#define PN532_SELECT(dev)	(*(dev)->pins->ss_port &= ~_BV((dev)->pins->ss_bit), sim_cs_sync())
+#define PN532_DESELECT(dev)	(*(dev)->pins->ss_port |= _BV((dev)->pins->ss_bit), sim_cs_sync())
+
+#endif
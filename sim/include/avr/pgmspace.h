@@ -0,0 +1,25 @@
+#ifndef _SIM_AVR_PGMSPACE_H_
+#define _SIM_AVR_PGMSPACE_H_
+
+// Flash and RAM share one address space on the host.
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s)				(s)
+#define pgm_read_byte(p)	(*(const uint8_t *)(p))
+#define pgm_read_word(p)	(*(const uint16_t *)(p))
+#define pgm_read_dword(p)	(*(const uint32_t *)(p))
+#define memcpy_P			memcpy
+#define memcmp_P			memcmp
+#define strlen_P			strlen
+
+// Far addresses are plain pointers
+typedef uintptr_t uint_farptr_t;
+#define pgm_get_far_address(var)	((uint_farptr_t)&(var))
+#define pgm_read_byte_far(a)		pgm_read_byte((const void *)(a))
+#define pgm_read_word_far(a)		pgm_read_word((const void *)(a))
+#define memcpy_PF(d, a, n)			memcpy((d), (const void *)(a), (n))
+#define memcmp_PF(s, a, n)			memcmp((s), (const void *)(a), (n))
+
+#endif
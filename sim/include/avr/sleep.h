@@ -0,0 +1,13 @@
+#ifndef _SIM_AVR_SLEEP_H_
+#define _SIM_AVR_SLEEP_H_
+
+#include "sim.h"
+
+#define SLEEP_MODE_IDLE		0
+#define set_sleep_mode(mode)
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu()			sim_sleep()
+#define sleep_mode()		sim_sleep()
+
+#endif
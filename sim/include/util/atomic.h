@@ -0,0 +1,10 @@
+#ifndef _SIM_UTIL_ATOMIC_H_
+#define _SIM_UTIL_ATOMIC_H_
+
+// Interrupts only run between firmware statements that advance the
+// virtual clock, a block is atomic as it stands.
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+#define ATOMIC_BLOCK(type)	for (int _sim_atomic = 1; _sim_atomic; _sim_atomic = 0)
+
+#endif
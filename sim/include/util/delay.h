@@ -0,0 +1,9 @@
+#ifndef _SIM_UTIL_DELAY_H_
+#define _SIM_UTIL_DELAY_H_
+
+#include "sim.h"
+
+#define _delay_us(us)	sim_advance_us((uint64_t)(us))
+#define _delay_ms(ms)	sim_advance_us((uint64_t)(ms) * 1000)
+
+#endif
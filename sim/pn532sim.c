@@ -0,0 +1,722 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "pn532sim.h"
+#include "desfiresim.h"
+
+#define SPI_STATREAD		0x02
+#define SPI_DATAWRITE		0x01
+#define SPI_DATAREAD		0x03
+
+#define FRAMESIZE			600
+#define MAX_DATAEXCHANGE	262
+#define MI					0x40
+
+// PN532 and RF timing in us
+#define T_ACK				300
+#define T_FIRMWARE			200
+#define T_ACTIVATE			5200
+// anticollision loop and RATS for a second, stacked card
+#define T_ACTIVATE_NEXT		3400
+#define T_POLL_ATTEMPT		4800
+#define T_FDT				90
+#define T_TAP_MAX			3000000
+// ISO14443-4 frame size of the card (FSC) minus PCB and CRC
+#define RF_CHUNK			59
+
+struct pn532sim {
+	// SPI transaction
+	uint8_t cs;
+	uint8_t op;
+	bool op_seen;
+	uint8_t rx[FRAMESIZE];
+	size_t rxlen;
+	// frames waiting to be read: the ACK, then the response
+	bool ack_pending;
+	uint64_t ack_ready;
+	bool resp_pending;
+	uint64_t resp_ready;
+	uint8_t resp[FRAMESIZE];
+	size_t resp_len;
+	// frame being read: 1 = ACK, 2 = response
+	uint8_t reading;
+	size_t read_pos;
+	// current command for the phase report
+	const char *phase;
+	uint64_t phase_start;
+	// RF side
+	uint8_t retries;
+	// cards in the field per tap, the first of them in desfiresim, the
+	// targets inlisted from them (Tg is the index + 1) and the one the
+	// PN532 talked to last
+	unsigned cards, card0;
+	struct {
+		bool active;
+		// bit rates in bps, reader to card and card to reader
+		uint32_t bitrate_pcd, bitrate_picc;
+	} tg[PN532SIM_STACK];
+	uint8_t cur;
+	// a card of the current tap has been activated
+	bool tap_active;
+	unsigned taps_left;
+	uint32_t tap_gap_ms;
+	uint64_t tap_start;
+	// commits before the card is taken away, and when it is
+	unsigned tap_ops, ops;
+	uint64_t leave_at;
+	// InDataExchange chaining
+	uint8_t chain_tx[FRAMESIZE];
+	size_t chain_txlen;
+	uint8_t chain_rx[FRAMESIZE];
+	size_t chain_rxlen, chain_rxpos;
+};
+
+// One PN532 per reader, all on the same SPI bus. pn is the one the
+// current call is about.
+static struct pn532sim readers[PN532SIM_READERS];
+static unsigned nreaders;
+static struct pn532sim *pn = readers;
+
+static const uint8_t sim_atqa[2] = { 0x03, 0x44 };
+static const uint8_t sim_sak = 0x20;
+static const uint8_t sim_ats[6] = { 0x06, 0x75, 0x77, 0x81, 0x02, 0x80 };
+
+void pn532sim_init(unsigned nr, unsigned taps, uint32_t tap_gap_ms, unsigned tap_ops, unsigned cards){
+	unsigned r;
+	
+	nreaders = (nr < 1) ? 1 : (nr > PN532SIM_READERS) ? PN532SIM_READERS : nr;
+	memset(readers, 0, sizeof(readers));
+	// every reader gets its own cards, tapped at the same times
+	for (r = 0; r < nreaders; r++) {
+		pn = &readers[r];
+		pn->cs = 1;
+		pn->retries = 0xFF;
+		pn->cards = (cards < 1) ? 1 : (cards > PN532SIM_STACK) ? PN532SIM_STACK : cards;
+		pn->card0 = r * PN532SIM_STACK;
+		pn->taps_left = taps;
+		pn->tap_gap_ms = tap_gap_ms;
+		pn->tap_ops = tap_ops;
+		pn->tap_start = (uint64_t)tap_gap_ms * 1000;
+	}
+	pn = readers;
+	desfiresim_init(0x1284);
+}
+
+static bool card_in_field(uint64_t t){
+	return pn->taps_left && t >= pn->tap_start && t < pn->tap_start + T_TAP_MAX;
+}
+
+static bool any_active(void){
+	unsigned i;
+	
+	for (i = 0; i < pn->cards; i++) {
+		if (pn->tg[i].active)
+			return true;
+	}
+	return false;
+}
+
+static void deactivate_all(void){
+	unsigned i;
+	
+	for (i = 0; i < PN532SIM_STACK; i++)
+		pn->tg[i].active = false;
+}
+
+static void end_tap_at(uint64_t now){
+	if (!pn->taps_left || !pn->tap_active)
+		return;
+	sim_phase("Tap (card in field)", pn->tap_start, now);
+	deactivate_all();
+	pn->tap_active = false;
+	pn->taps_left--;
+	pn->tap_start = now + (uint64_t)pn->tap_gap_ms * 1000;
+	pn->ops = 0;
+	pn->leave_at = 0;
+}
+
+static void end_tap(void){
+	end_tap_at(sim_now_us());
+}
+
+static void check_tap_timeout(void){
+	// taken away after its last commit
+	if (pn->leave_at && sim_now_us() >= pn->leave_at)
+		end_tap_at(pn->leave_at);
+	// cards that were never released leave the field after T_TAP_MAX
+	while (pn->taps_left && sim_now_us() >= pn->tap_start + T_TAP_MAX) {
+		deactivate_all();
+		pn->tap_active = false;
+		pn->taps_left--;
+		pn->tap_start += T_TAP_MAX + (uint64_t)pn->tap_gap_ms * 1000;
+	}
+}
+
+// Air time of a frame of len bytes at the given bit rate, chained in FSC
+// sized blocks
+static uint32_t rf_us(size_t len, uint32_t bitrate){
+	size_t blocks = len / RF_CHUNK + 1;
+	uint64_t bits = (len + 4 * blocks) * 9;
+	
+	// every chained block but the last is acknowledged by an R-block
+	bits += (blocks - 1) * 3 * 9;
+	return bits * 1000000 / bitrate + (blocks - 1) * 2 * T_FDT;
+}
+
+static void queue_response(uint8_t code, const uint8_t *payload, size_t len, uint64_t ready){
+	uint8_t *f = pn->resp;
+	size_t flen = len + 2;
+	uint8_t dcs;
+	size_t i, n = 0;
+	
+	f[n++] = 0x00;
+	f[n++] = 0x00;
+	f[n++] = 0xFF;
+	if (flen > 255) {
+		f[n++] = 0xFF;
+		f[n++] = 0xFF;
+		f[n++] = flen >> 8;
+		f[n++] = flen;
+		f[n++] = -(uint8_t)((flen >> 8) + flen);
+	} else {
+		f[n++] = flen;
+		f[n++] = -(uint8_t)flen;
+	}
+	f[n++] = 0xD5;
+	f[n++] = code + 1;
+	dcs = 0xD5 + code + 1;
+	for (i = 0; i < len; i++) {
+		f[n++] = payload[i];
+		dcs += payload[i];
+	}
+	f[n++] = -dcs;
+	f[n++] = 0x00;
+	pn->resp_len = n;
+	pn->resp_pending = true;
+	pn->resp_ready = ready;
+}
+
+static void queue_error(uint64_t ready){
+	static const uint8_t error[] = { 0x00, 0x00, 0xFF, 0x01, 0xFF, 0x7F, 0x81, 0x00 };
+	
+	memcpy(pn->resp, error, sizeof(error));
+	pn->resp_len = sizeof(error);
+	pn->resp_pending = true;
+	pn->resp_ready = ready;
+}
+
+// Tg, SENS_RES, SEL_RES, NFCIDLength, NFCID, ATS of card i
+static size_t target_data(unsigned i, uint8_t *p){
+	size_t n = 0;
+	
+	desfiresim_use(pn->card0 + i);
+	p[n++] = i + 1;
+	p[n++] = sim_atqa[0];
+	p[n++] = sim_atqa[1];
+	p[n++] = sim_sak;
+	p[n++] = DESFIRESIM_UIDLEN;
+	memcpy(p + n, desfiresim_uid(), DESFIRESIM_UIDLEN);
+	n += DESFIRESIM_UIDLEN;
+	memcpy(p + n, sim_ats, sizeof(sim_ats));
+	n += sizeof(sim_ats);
+	return n;
+}
+
+// Time at which a card can be activated when polling from t on for at
+// most limit us (0 = endless), or 0 if there is none. An endless poll
+// after the last tap never ends, the simulation is over once no PN532
+// has anything left to report.
+static uint64_t activation_time(uint64_t t, uint64_t limit){
+	uint64_t start;
+	
+	check_tap_timeout();
+	if (!pn->taps_left)
+		return 0;
+	start = (t > pn->tap_start) ? t : pn->tap_start;
+	if (limit && start > t + limit)
+		return 0;
+	return start + T_ACTIVATE;
+}
+
+static void activate(unsigned i){
+	pn->tap_active = true;
+	pn->tg[i].active = true;
+	pn->tg[i].bitrate_pcd = pn->tg[i].bitrate_picc = 106000;
+	pn->cur = i;
+	pn->chain_txlen = 0;
+	pn->chain_rxlen = pn->chain_rxpos = 0;
+	desfiresim_use(pn->card0 + i);
+	desfiresim_activate();
+}
+
+// Index of the card with the given UID, -1 if there is none
+static int find_card(const uint8_t *uid, size_t len){
+	unsigned i;
+	
+	for (i = 0; i < pn->cards; i++) {
+		desfiresim_use(pn->card0 + i);
+		if (len == DESFIRESIM_UIDLEN && !memcmp(uid, desfiresim_uid(), DESFIRESIM_UIDLEN))
+			return i;
+	}
+	return -1;
+}
+
+// Index of the active target Tg, -1 if it is not inlisted or has left
+static int find_target(uint8_t tg, uint64_t t){
+	check_tap_timeout();
+	tg &= 0x3F;
+	if (tg < 1 || tg > pn->cards || !pn->tg[tg - 1].active || !card_in_field(t))
+		return -1;
+	return tg - 1;
+}
+
+static void cmd_inlist(const uint8_t *p, size_t len, uint64_t t){
+	uint8_t res[2 * 32 + 1];
+	uint64_t ready;
+	uint64_t limit = (pn->retries == 0xFF) ? 0 : (uint64_t)(pn->retries + 1) * T_POLL_ATTEMPT;
+	unsigned first = 0, count = pn->cards;
+	size_t n = 1;
+	int i;
+	
+	pn->phase = "InListPassiveTarget";
+	if (len < 2 || p[0] < 1 || p[0] > 2 || p[1] != 0x00) {
+		queue_error(t);
+		return;
+	}
+	if (len > 2) {
+		// the UID picks one card, the others stay quiet
+		i = find_card(p + 2, len - 2);
+		if (i < 0) {
+			limit = T_POLL_ATTEMPT;
+			count = 0;
+		} else {
+			first = i;
+			count = 1;
+		}
+	}
+	if (count > p[0])
+		count = p[0];
+	ready = count ? activation_time(t, limit) : 0;
+	if (!ready && !limit)
+		return;
+	if (!ready) {
+		res[0] = 0;
+		queue_response(0x4A, res, 1, t + limit);
+		return;
+	}
+	deactivate_all();
+	res[0] = count;
+	for (i = first; i < first + count; i++) {
+		activate(i);
+		n += target_data(i, res + n);
+	}
+	queue_response(0x4A, res, n, ready + (count - 1) * T_ACTIVATE_NEXT);
+}
+
+static void cmd_autopoll(const uint8_t *p, size_t len, uint64_t t){
+	uint8_t res[2 * 34 + 1];
+	uint64_t ready, limit;
+	size_t n = 1, ln;
+	unsigned i;
+	
+	pn->phase = "InAutoPoll";
+	if (len < 3) {
+		queue_error(t);
+		return;
+	}
+	limit = (p[0] == 0xFF) ? 0 : (uint64_t)p[0] * p[1] * 150000;
+	ready = activation_time(t, limit);
+	if (!ready && !limit)
+		return;
+	if (!ready) {
+		res[0] = 0;
+		queue_response(0x60, res, 1, t + limit);
+		return;
+	}
+	// the PN532 reports up to two targets of the type it found
+	deactivate_all();
+	res[0] = pn->cards;
+	for (i = 0; i < pn->cards; i++) {
+		activate(i);
+		ln = target_data(i, res + n + 2);
+		res[n++] = p[2];
+		res[n++] = ln;
+		n += ln;
+	}
+	queue_response(0x60, res, n, ready + (pn->cards - 1) * T_ACTIVATE_NEXT);
+}
+
+static void cmd_exchange(const uint8_t *p, size_t len, uint64_t t){
+	static uint8_t res[FRAMESIZE];
+	uint32_t busy = 0;
+	uint64_t ready = t;
+	size_t n;
+	int i;
+	
+	pn->phase = "InDataExchange";
+	if (len < 1) {
+		queue_error(t);
+		return;
+	}
+	if ((i = find_target(p[0], t)) < 0) {
+		// card gone: timeout after the frame waiting time
+		res[0] = 0x01;
+		queue_response(0x40, res, 1, t + 5000);
+		return;
+	}
+	if (i != pn->cur) {
+		// chaining does not survive a change of target
+		pn->cur = i;
+		pn->chain_txlen = 0;
+		pn->chain_rxlen = pn->chain_rxpos = 0;
+	}
+	desfiresim_use(pn->card0 + i);
+	if (len == 1 && pn->chain_rxpos < pn->chain_rxlen) {
+		// host fetches the next part of a chained response
+		n = pn->chain_rxlen - pn->chain_rxpos;
+		res[0] = 0x00;
+		if (n > MAX_DATAEXCHANGE) {
+			n = MAX_DATAEXCHANGE;
+			res[0] = MI;
+		}
+		memcpy(res + 1, pn->chain_rx + pn->chain_rxpos, n);
+		pn->chain_rxpos += n;
+		queue_response(0x40, res, n + 1, t);
+		return;
+	}
+	if (pn->chain_txlen + len - 1 > sizeof(pn->chain_tx)) {
+		res[0] = 0x0A;
+		queue_response(0x40, res, 1, t);
+		return;
+	}
+	if (sim_rf_max && (pn->tg[i].bitrate_pcd > sim_rf_max || pn->tg[i].bitrate_picc > sim_rf_max)) {
+		// the link does not hold up at this bit rate: CRC error
+		pn->chain_txlen = 0;
+		res[0] = 0x02;
+		queue_response(0x40, res, 1, t + rf_us(len - 1, pn->tg[i].bitrate_pcd) + T_FDT);
+		return;
+	}
+	memcpy(pn->chain_tx + pn->chain_txlen, p + 1, len - 1);
+	pn->chain_txlen += len - 1;
+	if (p[0] & MI) {
+		// more data to come from the host
+		res[0] = 0x00;
+		queue_response(0x40, res, 1, t);
+		return;
+	}
+	
+	pn->phase = desfiresim_command_name(pn->chain_tx, pn->chain_txlen);
+	n = desfiresim_command(pn->chain_tx, pn->chain_txlen, pn->chain_rx, &busy);
+	ready += rf_us(pn->chain_txlen, pn->tg[i].bitrate_pcd) + T_FDT + busy + rf_us(n, pn->tg[i].bitrate_picc);
+	if (pn->tap_ops && !strcmp(pn->phase, "CommitTransaction") && ++pn->ops == pn->tap_ops * pn->cards)
+		pn->leave_at = ready;
+	pn->chain_txlen = 0;
+	pn->chain_rxlen = n;
+	pn->chain_rxpos = 0;
+	
+	res[0] = 0x00;
+	if (n > MAX_DATAEXCHANGE) {
+		n = MAX_DATAEXCHANGE;
+		res[0] = MI;
+	}
+	memcpy(res + 1, pn->chain_rx, n);
+	pn->chain_rxpos = n;
+	queue_response(0x40, res, n + 1, ready);
+}
+
+// Diagnose, only NumTst 0x06: presence check of the target the PN532
+// talked to last with an R(NAK) that an ISO14443-4 card answers with
+// R(ACK)
+static void cmd_diagnose(const uint8_t *p, size_t len, uint64_t t){
+	uint8_t status = 0;
+	int i;
+	
+	pn->phase = "Diagnose";
+	if (len < 1 || p[0] != 0x06) {
+		queue_error(t);
+		return;
+	}
+	pn->phase = "Presence check";
+	if ((i = find_target(pn->cur + 1, t)) < 0) {
+		status = 0x01;
+		queue_response(0x00, &status, 1, t + 5000);
+		return;
+	}
+	queue_response(0x00, &status, 1, t + rf_us(1, pn->tg[i].bitrate_pcd) + T_FDT + rf_us(1, pn->tg[i].bitrate_picc));
+}
+
+// PPS: DSI and DRI as in the InPSL BR codes, the card accepts the
+// divisors announced in TA(1) of its ATS
+static void cmd_psl(const uint8_t *p, size_t len, uint64_t t){
+	uint8_t status = 0;
+	uint8_t ta = sim_ats[2];
+	int i;
+	
+	pn->phase = "InPSL";
+	if (len < 3 || p[1] > 3 || p[2] > 3) {
+		queue_error(t);
+		return;
+	}
+	if ((i = find_target(p[0], t)) < 0) {
+		status = 0x01;
+		queue_response(0x4E, &status, 1, t + 5000);
+		return;
+	}
+	if ((p[1] && !(ta & (0x01 << (p[1] - 1)))) || (p[2] && !(ta & (0x08 << p[2])))) {
+		status = 0x27;
+		queue_response(0x4E, &status, 1, t);
+		return;
+	}
+	// PPSS PPS0 PPS1 and the PPSS echo, at the old bit rate
+	t += rf_us(3, pn->tg[i].bitrate_pcd) + T_FDT + rf_us(1, pn->tg[i].bitrate_picc);
+	pn->tg[i].bitrate_pcd = 106000 << p[1];
+	pn->tg[i].bitrate_picc = 106000 << p[2];
+	queue_response(0x4E, &status, 1, t);
+}
+
+// InSelect: makes Tg the target the PN532 talks to
+static void cmd_select(const uint8_t *p, size_t len, uint64_t t){
+	uint8_t status = 0;
+	int i;
+	
+	pn->phase = "InSelect";
+	if (len < 1) {
+		queue_error(t);
+		return;
+	}
+	if ((i = find_target(p[0], t)) < 0) {
+		status = 0x01;
+		queue_response(0x54, &status, 1, t + 5000);
+		return;
+	}
+	pn->cur = i;
+	queue_response(0x54, &status, 1, t);
+}
+
+// InDeselect / InRelease of Tg, 0 for all targets
+static void cmd_deselect(const uint8_t *p, size_t len, uint64_t t){
+	uint8_t status = 0;
+	unsigned i;
+	
+	pn->phase = (p[0] == 0x44) ? "InDeselect" : "InRelease";
+	if (len < 2) {
+		queue_error(t);
+		return;
+	}
+	queue_response(p[0], &status, 1, t + rf_us(1, 106000));
+	for (i = 0; i < pn->cards; i++) {
+		if (p[1] == 0 || p[1] == i + 1)
+			pn->tg[i].active = false;
+	}
+	// the cards are taken out of the field once the host lets go of all
+	if (!any_active())
+		end_tap();
+}
+
+static void process_command(const uint8_t *p, size_t len){
+	static const uint8_t firmware[] = { 0x32, 0x01, 0x06, 0x07 };
+	uint64_t t = sim_now_us();
+	uint8_t status = 0;
+	
+	pn->ack_pending = true;
+	pn->ack_ready = t + T_ACK;
+	pn->phase_start = t;
+	t += T_ACK + T_FIRMWARE;
+	
+	switch (p[0]) {
+	case 0x00:
+		cmd_diagnose(p + 1, len - 1, t);
+		break;
+	case 0x02:
+		pn->phase = "GetFirmwareVersion";
+		queue_response(p[0], firmware, sizeof(firmware), t);
+		break;
+	case 0x14:
+		pn->phase = "SAMConfiguration";
+		queue_response(p[0], NULL, 0, t);
+		break;
+	case 0x32:
+		pn->phase = "RFConfiguration";
+		if (len >= 5 && p[1] == 5)
+			pn->retries = p[4];
+		queue_response(p[0], NULL, 0, t);
+		break;
+	case 0x4A:
+		cmd_inlist(p + 1, len - 1, t);
+		break;
+	case 0x60:
+		cmd_autopoll(p + 1, len - 1, t);
+		break;
+	case 0x40:
+		cmd_exchange(p + 1, len - 1, t);
+		break;
+	case 0x4E:
+		cmd_psl(p + 1, len - 1, t);
+		break;
+	case 0x54:
+		cmd_select(p + 1, len - 1, t);
+		break;
+	case 0x44:
+	case 0x52:
+		cmd_deselect(p, len, t);
+		break;
+	default:
+		pn->phase = "unsupported";
+		queue_error(t);
+		break;
+	}
+	if (sim_verbose)
+		fprintf(stderr, "[%10.3f ms] PN532 %u %s\n", pn->phase_start / 1000.0, (unsigned)(pn - readers), pn->phase);
+}
+
+// Checks preamble, LEN/LCS, TFI and DCS of a frame written by the host
+static void received_frame(void){
+	const uint8_t *f = pn->rx;
+	size_t len, off;
+	uint8_t sum = 0;
+	size_t i;
+	
+	if (pn->rxlen < 6 || f[0] != 0x00 || f[1] != 0x00 || f[2] != 0xFF)
+		return;
+	// an ACK frame from the host aborts the command in progress
+	if (f[3] == 0x00 && f[4] == 0xFF) {
+		if (sim_verbose)
+			fprintf(stderr, "[%10.3f ms] PN532 %u abort\n", sim_now_us() / 1000.0, (unsigned)(pn - readers));
+		pn->ack_pending = pn->resp_pending = false;
+		return;
+	}
+	if (f[3] == 0xFF && f[4] == 0xFF) {
+		if (pn->rxlen < 9 || (uint8_t)(f[5] + f[6] + f[7]) != 0)
+			return;
+		len = ((size_t)f[5] << 8) | f[6];
+		off = 8;
+	} else {
+		if ((uint8_t)(f[3] + f[4]) != 0)
+			return;
+		len = f[3];
+		off = 5;
+	}
+	if (len < 2 || off + len + 1 > pn->rxlen || f[off] != 0xD4)
+		return;
+	for (i = 0; i <= len; i++)
+		sum += f[off + i];
+	if (sum != 0)
+		return;
+	// a new command discards whatever the host did not read
+	pn->ack_pending = pn->resp_pending = false;
+	process_command(f + off + 1, len - 1);
+}
+
+bool pn532sim_ready(unsigned r){
+	uint64_t now = sim_now_us();
+	
+	pn = &readers[r];
+	if (pn->ack_pending)
+		return now >= pn->ack_ready;
+	return pn->resp_pending && now >= pn->resp_ready;
+}
+
+uint64_t pn532sim_next_event(void){
+	uint64_t next = 0, t;
+	unsigned r;
+	
+	for (r = 0; r < nreaders; r++) {
+		pn = &readers[r];
+		if (pn->ack_pending)
+			t = pn->ack_ready;
+		else if (pn->resp_pending)
+			t = pn->resp_ready;
+		else
+			continue;
+		if (!next || t < next)
+			next = t;
+	}
+	return next;
+}
+
+unsigned pn532sim_readers(void){
+	return nreaders;
+}
+
+void pn532sim_cs(unsigned r, uint8_t level){
+	pn = &readers[r];
+	if (level == pn->cs)
+		return;
+	pn->cs = level;
+	if (!level) {
+		pn->op_seen = false;
+		pn->rxlen = 0;
+		pn->reading = 0;
+		pn->read_pos = 0;
+		return;
+	}
+	if (!pn->op_seen)
+		return;
+	if (pn->op == SPI_DATAWRITE) {
+		received_frame();
+	} else if (pn->op == SPI_DATAREAD && pn->reading == 1) {
+		pn->ack_pending = false;
+		// the response cannot be ready before its ACK has been read
+		if (pn->resp_ready < sim_now_us())
+			pn->resp_ready = sim_now_us();
+	} else if (pn->op == SPI_DATAREAD && pn->reading == 2) {
+		pn->resp_pending = false;
+		sim_phase(pn->phase, pn->phase_start, sim_now_us());
+	}
+}
+
+// Only a selected PN532 drives MISO
+uint8_t pn532sim_transfer(uint8_t mosi){
+	unsigned r;
+	
+	for (r = 0; r < nreaders && readers[r].cs; r++)
+		;
+	if (r == nreaders)
+		return 0xFF;
+	pn = &readers[r];
+	if (!pn->op_seen) {
+		pn->op_seen = true;
+		pn->op = mosi;
+		return 0x00;
+	}
+	switch (pn->op) {
+	case SPI_DATAWRITE:
+		if (pn->rxlen < sizeof(pn->rx))
+			pn->rx[pn->rxlen++] = mosi;
+		return 0x00;
+	case SPI_STATREAD:
+		return pn532sim_ready(r) ? 0x01 : 0x00;
+	case SPI_DATAREAD:
+		if (!pn->reading) {
+			if (!pn532sim_ready(r))
+				return 0x00;
+			pn->reading = pn->ack_pending ? 1 : 2;
+		}
+		if (pn->reading == 1) {
+			static const uint8_t ack[] = { 0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00 };
+			return (pn->read_pos < sizeof(ack)) ? ack[pn->read_pos++] : 0x00;
+		}
+		return (pn->read_pos < pn->resp_len) ? pn->resp[pn->read_pos++] : 0x00;
+	default:
+		return 0x00;
+	}
+}
+
+bool pn532sim_check_debits(unsigned expect){
+	unsigned r, i, debits;
+	bool ok = true;
+	
+	for (r = 0; r < nreaders; r++) {
+		for (i = 0; i < readers[r].cards; i++) {
+			desfiresim_use(readers[r].card0 + i);
+			debits = desfiresim_debits();
+			fprintf(stderr, "reader %u card %u: value %ld, %u debits\n", r, i, (long)desfiresim_value(), debits);
+			if (expect && debits != expect) {
+				fprintf(stderr, "expected %u debits\n", expect);
+				ok = false;
+			}
+		}
+	}
+	return ok;
+}
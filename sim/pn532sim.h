@@ -0,0 +1,28 @@
+#ifndef _PN532SIM_H_
+#define _PN532SIM_H_
+
+// Virtual PN532s on the SPI bus: frame protocol, ACKs, status reads and
+// the initiator commands the driver uses, each with a simulated DESFire
+// card that is tapped SIM_TAPS times. SIM_CARDS=2 stacks a second card on
+// it, SIM_READERS puts up to four PN532s on the bus.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PN532SIM_READERS		4
+// Cards that can be stacked in the field of one reader
+#define PN532SIM_STACK			2
+
+void pn532sim_init(unsigned readers, unsigned taps, uint32_t tap_gap_ms, unsigned tap_ops, unsigned cards);
+unsigned pn532sim_readers(void);
+// Chip select of reader r, 0 = selected
+void pn532sim_cs(unsigned r, uint8_t level);
+uint8_t pn532sim_transfer(uint8_t mosi);
+bool pn532sim_ready(unsigned r);
+// Time of the next event the firmware could be waiting for, 0 if none
+uint64_t pn532sim_next_event(void);
+// Prints the value and debits of every card used, false if a card was not
+// debited exactly expect times (0 checks nothing)
+bool pn532sim_check_debits(unsigned expect);
+
+#endif
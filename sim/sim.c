@@ -0,0 +1,352 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+#include "sim.h"
+#include "pn532sim.h"
+
+#define SIM_MAXPHASES		32
+// SPI byte time on top of the eight clock cycles: polling SPIF and
+// loading SPDR
+#define SIM_SPI_OVERHEAD_NS	1000
+// NSS (on PORTB) and IRQ lines of the PN532s as wired in nfcdummy.c
+static const struct {
+	uint8_t ss_bit;
+	volatile uint8_t *irq_pin;
+	uint8_t irq_bit;
+} sim_wiring[PN532SIM_READERS] = {
+	{ PB4, &PINB, PB2 },
+	{ PB3, &PINA, PA0 },
+	{ PB1, &PINA, PA1 },
+	{ PB0, &PINA, PA2 },
+};
+// UDR0 holds no byte to send
+#define SIM_UDR_EMPTY		0xFFFF
+// SPDR holds the received byte (low 8 bits), not one to send
+#define SIM_SPDR_DONE		0x100
+
+typedef struct {
+	const char *name;
+	unsigned count;
+	uint64_t total, min, max;
+} sim_phase_stats;
+
+volatile uint8_t sim_io[64];
+volatile uint16_t sim_io16[8];
+volatile uint16_t sim_udr0 = SIM_UDR_EMPTY;
+volatile uint16_t sim_spdr = SIM_SPDR_DONE;
+uint32_t sim_spi_hz;
+uint32_t sim_rf_max;
+bool sim_verbose;
+
+// interrupt handlers the firmware may define
+void TIMER0_COMPA_vect(void) __attribute__((weak));
+void TIMER1_OVF_vect(void) __attribute__((weak));
+void USART0_UDRE_vect(void) __attribute__((weak));
+void INT2_vect(void) __attribute__((weak));
+void PCINT0_vect(void) __attribute__((weak));
+
+static uint64_t now_us;
+// CPU cycle of the next Timer0 compare match, 0 until the timer runs
+static uint64_t timer0_match;
+static uint8_t spsr;
+static uint8_t cs_level[PN532SIM_READERS] = { 1, 1, 1, 1 };
+static uint32_t spi_ns;
+static uint64_t uart_busy_until;
+static FILE *uart_out;
+
+static void uart_flush(void);
+static void uart_drain(void);
+static bool uart_udre_enabled(void);
+static void uart_start(void);
+static void uart_sync(void);
+static sim_phase_stats phases[SIM_MAXPHASES];
+static unsigned nphases;
+static unsigned expect_debits;
+
+static uint32_t env(const char *name, uint32_t def){
+	const char *v = getenv(name);
+	
+	return v ? strtoul(v, NULL, 0) : def;
+}
+
+__attribute__((constructor))
+static void sim_init(void){
+	sim_spi_hz = env("SIM_SPI_HZ", 0);
+	sim_rf_max = env("SIM_RF_MAX", 0) * 1000;
+	sim_verbose = env("SIM_VERBOSE", 0);
+	expect_debits = env("SIM_EXPECT_DEBITS", 0);
+	pn532sim_init(env("SIM_READERS", 1), env("SIM_TAPS", 1), env("SIM_TAP_GAP", 500), env("SIM_TAP_OPS", 1), env("SIM_CARDS", 1));
+	setvbuf(stdout, NULL, _IONBF, 0);
+	if (getenv("SIM_UART")) {
+		uart_out = fopen(getenv("SIM_UART"), "wb");
+		if (!uart_out) {
+			perror(getenv("SIM_UART"));
+			exit(1);
+		}
+		// bytes are still queued when the firmware returns
+		atexit(uart_drain);
+	}
+}
+
+static const uint16_t prescaler[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+
+// Timer1 count at the given time, 0 while the timer is stopped
+static uint64_t timer1_ticks(uint64_t us){
+	uint16_t p = prescaler[TCCR1B & 7];
+	
+	return p ? us * (F_OSC / p) / 1000000 : 0;
+}
+
+// CPU cycles between two compare matches of Timer0 in CTC mode, 0 while
+// it is stopped or its interrupt is off. OCR0A is read again after every
+// match, the handler may change it.
+static uint64_t timer0_period(void){
+	uint16_t p = prescaler[TCCR0B & 7];
+	
+	if (!p || !(TIMSK0 & _BV(OCIE0A)) || !TIMER0_COMPA_vect)
+		return 0;
+	return (uint64_t)(OCR0A + 1) * p;
+}
+
+static uint64_t cycles(uint64_t us){
+	return us * F_OSC / 1000000;
+}
+
+static void cs_sync(void);
+static void irq_sync(void);
+
+static void set_time(uint64_t us){
+	uint64_t ovf = timer1_ticks(now_us) >> 16;
+	
+	cs_sync();
+	uart_start();
+	if (!timer0_period()) {
+		timer0_match = 0;
+	} else {
+		if (!timer0_match)
+			timer0_match = cycles(now_us) + timer0_period();
+		while (timer0_match <= cycles(us)) {
+			TIMER0_COMPA_vect();
+			timer0_match += timer0_period();
+		}
+	}
+	now_us = us;
+	irq_sync();
+	uart_sync();
+	if ((TIMSK1 & _BV(TOIE1)) && TIMER1_OVF_vect) {
+		for (; ovf < timer1_ticks(now_us) >> 16; ovf++)
+			TIMER1_OVF_vect();
+	}
+}
+
+uint64_t sim_now_us(void){
+	return now_us;
+}
+
+void sim_advance_us(uint64_t us){
+	set_time(now_us + us);
+}
+
+void sim_sleep(void){
+	uint64_t next;
+	
+	next = pn532sim_next_event();
+	// the UART interrupt wakes us up for its next byte
+	uart_start();
+	uart_sync();
+	if (uart_udre_enabled() && (!next || uart_busy_until < next))
+		next = uart_busy_until;
+	if (!next) {
+		// nothing will ever wake us up
+		sim_report();
+		exit(pn532sim_check_debits(expect_debits) ? 0 : 1);
+	}
+	// the Timer0 interrupt wakes us up earlier. A PN532 whose response is
+	// already due does not wake us either, the firmware looks at it on a
+	// later tick.
+	if (timer0_match) {
+		uint64_t match = (timer0_match * 1000000 + F_OSC - 1) / F_OSC;
+		
+		if (match < next || next <= now_us)
+			next = match;
+	}
+	if (next > now_us)
+		set_time(next);
+}
+
+// The IRQ lines follow the PN532s whenever time passes or a chip select
+// changes, the firmware reads them through pointers. Their edges raise
+// INT2 (falling, the first PN532) and the pin change interrupt of PORTA
+// when the firmware enabled them.
+static void irq_sync(void){
+	volatile uint8_t *pin;
+	uint8_t bit, old;
+	unsigned r;
+	
+	for (r = 0; r < pn532sim_readers(); r++) {
+		pin = sim_wiring[r].irq_pin;
+		bit = _BV(sim_wiring[r].irq_bit);
+		old = *pin & bit;
+		if (pn532sim_ready(r))
+			*pin &= ~bit;
+		else
+			*pin |= bit;
+		if ((*pin & bit) == old)
+			continue;
+		if (pin == &PINB) {
+			if (!(*pin & bit) && (EIMSK & _BV(INT2)) && INT2_vect)
+				INT2_vect();
+		} else if ((PCICR & _BV(PCIE0)) && (PCMSK0 & bit) && PCINT0_vect) {
+			PCINT0_vect();
+		}
+	}
+}
+
+// CS edges are noticed when the driver says so (PN532_SELECT in
+// include/avr/io.h), on the next access to the SPI, or when time passes
+static void cs_sync(void){
+	uint8_t level;
+	unsigned r;
+	
+	for (r = 0; r < pn532sim_readers(); r++) {
+		level = (DDRB & _BV(sim_wiring[r].ss_bit)) ? (PORTB >> sim_wiring[r].ss_bit) & 1 : 1;
+		if (level != cs_level[r]) {
+			cs_level[r] = level;
+			pn532sim_cs(r, level);
+		}
+	}
+	irq_sync();
+}
+
+void sim_cs_sync(void){
+	cs_sync();
+}
+
+uint8_t sim_spi_transfer(uint8_t mosi){
+	static const uint8_t div[4] = {4, 16, 64, 128};
+	uint32_t hz = sim_spi_hz;
+	
+	if (!hz)
+		hz = F_OSC / div[SPCR & 3] * (spsr & _BV(SPI2X) ? 2 : 1);
+	// sub-microsecond byte times add up
+	spi_ns += 8000000000ULL / hz + SIM_SPI_OVERHEAD_NS;
+	sim_advance_us(spi_ns / 1000);
+	spi_ns %= 1000;
+	return pn532sim_transfer(mosi);
+}
+
+// Clocks a byte written to SPDR, false if there was none
+static bool spi_clock(void){
+	cs_sync();
+	if (sim_spdr & SIM_SPDR_DONE)
+		return false;
+	sim_spdr = sim_spi_transfer(sim_spdr) | SIM_SPDR_DONE;
+	spsr |= _BV(SPIF);
+	return true;
+}
+
+volatile uint8_t *sim_spsr(void){
+	spi_clock();
+	return &spsr;
+}
+
+uint16_t sim_tcnt1(void){
+	return timer1_ticks(now_us);
+}
+
+// Sends the byte in UDR0 once the transmitter is done with the last one,
+// but not before from_us
+static void uart_shift(uint64_t from_us){
+	// 10 bit times per byte at the baud rate set in UBRR0
+	uint32_t baud = F_OSC / 16 / (UBRR0 + 1);
+	
+	if (sim_udr0 == SIM_UDR_EMPTY)
+		return;
+	if (uart_out)
+		fputc(sim_udr0, uart_out);
+	sim_udr0 = SIM_UDR_EMPTY;
+	if (uart_busy_until < from_us)
+		uart_busy_until = from_us;
+	uart_busy_until += (10000000 + baud - 1) / baud;
+}
+
+static void uart_flush(void){
+	uart_shift(now_us);
+}
+
+static bool uart_udre_enabled(void){
+	return (UCSR0B & _BV(UDRIE0)) && USART0_UDRE_vect;
+}
+
+// An idle transmitter with the data register empty interrupt just
+// enabled starts now
+static void uart_start(void){
+	if (uart_udre_enabled() && uart_busy_until < now_us)
+		uart_busy_until = now_us;
+}
+
+// The data register empty interrupt refills UDR0 as often as the
+// transmitter finished a byte up to now, the bytes follow each other
+// without gaps
+static void uart_sync(void){
+	while (uart_udre_enabled() && uart_busy_until <= now_us) {
+		USART0_UDRE_vect();
+		uart_shift(0);
+	}
+}
+
+// Lets the interrupt send what the firmware left in its buffer
+static void uart_drain(void){
+	uart_start();
+	while (uart_udre_enabled())
+		set_time(uart_busy_until > now_us ? uart_busy_until : now_us + 1);
+	uart_flush();
+}
+
+// Nothing is ever received. Reading the status takes no time, the
+// transmitter is driven by its interrupt.
+uint8_t sim_ucsr0a(void){
+	uart_flush();
+	return uart_busy_until > now_us ? 0 : _BV(UDRE0) | _BV(TXC0);
+}
+
+void sim_phase(const char *name, uint64_t start_us, uint64_t end_us){
+	uint64_t d = end_us - start_us;
+	sim_phase_stats *p;
+	unsigned i;
+	
+	for (i = 0; i < nphases; i++) {
+		if (!strcmp(phases[i].name, name))
+			break;
+	}
+	if (i == nphases) {
+		if (nphases == SIM_MAXPHASES)
+			return;
+		nphases++;
+		phases[i].name = name;
+		phases[i].min = d;
+	}
+	p = &phases[i];
+	p->count++;
+	p->total += d;
+	if (d < p->min)
+		p->min = d;
+	if (d > p->max)
+		p->max = d;
+}
+
+void sim_report(void){
+	unsigned i;
+	
+	uart_drain();
+	if (uart_out)
+		fflush(uart_out);
+	fprintf(stderr, "\n%-24s %6s %10s %10s %10s\n", "phase", "count", "avg ms", "min ms", "max ms");
+	for (i = 0; i < nphases; i++) {
+		sim_phase_stats *p = &phases[i];
+		fprintf(stderr, "%-24s %6u %10.3f %10.3f %10.3f\n", p->name, p->count,
+			p->total / 1000.0 / p->count, p->min / 1000.0, p->max / 1000.0);
+	}
+	fprintf(stderr, "virtual time: %.3f ms\n", now_us / 1000.0);
+}
@@ -0,0 +1,57 @@
+#ifndef _SIM_H_
+#define _SIM_H_
+
+/*
+ * Host-side simulation of the reader hardware. The firmware sources are
+ * compiled for Linux against register shims (include/avr); behind the
+ * SPI and the PN532s' chip select and IRQ lines sit virtual PN532s, each
+ * with a software DESFire EV1 card in its field. All time is virtual: SPI transfers, delays and the RF and
+ * card processing times advance a microsecond clock, so the reported
+ * timings do not depend on the speed of the host.
+ *
+ * Configuration is read from the environment:
+ *   SIM_READERS    PN532s on the bus, 1 to 4, as wired in nfcdummy.c
+ *                  (1); each gets its own cards and taps
+ *   SIM_TAPS       number of card taps per reader before the simulation
+ *                  ends (1)
+ *   SIM_TAP_GAP    ms between removing the card and the next tap (500)
+ *   SIM_TAP_OPS    commits after which the card is taken away, 0 keeps
+ *                  it until the firmware deselects it, at most 3 s (1)
+ *   SIM_CARDS      cards stacked in the field per tap, 1 or 2 (1);
+ *                  SIM_TAP_OPS counts the commits of each of them
+ *   SIM_SPI_HZ     SPI clock in Hz (as set up in SPCR/SPSR)
+ *   SIM_RF_MAX     highest RF bit rate in kbps that works, exchanges
+ *                  above it fail with a CRC error (no limit)
+ *   SIM_VERBOSE    log every PN532 command to stderr (0)
+ *   SIM_EXPECT_DEBITS  debits every card must have seen when the
+ *                  simulation ends, the exit status is 1 otherwise
+ *                  (0, not checked)
+ *   SIM_UART       file receiving the bytes sent on USART0, the log
+ *                  and trace dumps (discarded)
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Virtual clock
+uint64_t sim_now_us(void);
+void sim_advance_us(uint64_t us);
+// Sleep until the next event (PN532 ready, next tap) is due
+void sim_sleep(void);
+
+// Pins and SPI bus as seen by the firmware
+void sim_cs_sync(void);
+uint8_t sim_spi_transfer(uint8_t mosi);
+volatile uint8_t *sim_spsr(void);
+uint16_t sim_tcnt1(void);
+uint8_t sim_ucsr0a(void);
+
+// Phase statistics, printed when the simulation ends
+void sim_phase(const char *name, uint64_t start_us, uint64_t end_us);
+void sim_report(void);
+
+extern uint32_t sim_spi_hz;
+extern uint32_t sim_rf_max;
+extern bool sim_verbose;
+
+#endif
@@ -0,0 +1,184 @@
+#include <string.h>
+#include "simaes.h"
+
+static const uint8_t sbox[256] = {
+	0x63,0x7c,0x77,0x7b,0xf2,0x6b,0x6f,0xc5,0x30,0x01,0x67,0x2b,0xfe,0xd7,0xab,0x76,
+	0xca,0x82,0xc9,0x7d,0xfa,0x59,0x47,0xf0,0xad,0xd4,0xa2,0xaf,0x9c,0xa4,0x72,0xc0,
+	0xb7,0xfd,0x93,0x26,0x36,0x3f,0xf7,0xcc,0x34,0xa5,0xe5,0xf1,0x71,0xd8,0x31,0x15,
+	0x04,0xc7,0x23,0xc3,0x18,0x96,0x05,0x9a,0x07,0x12,0x80,0xe2,0xeb,0x27,0xb2,0x75,
+	0x09,0x83,0x2c,0x1a,0x1b,0x6e,0x5a,0xa0,0x52,0x3b,0xd6,0xb3,0x29,0xe3,0x2f,0x84,
+	0x53,0xd1,0x00,0xed,0x20,0xfc,0xb1,0x5b,0x6a,0xcb,0xbe,0x39,0x4a,0x4c,0x58,0xcf,
+	0xd0,0xef,0xaa,0xfb,0x43,0x4d,0x33,0x85,0x45,0xf9,0x02,0x7f,0x50,0x3c,0x9f,0xa8,
+	0x51,0xa3,0x40,0x8f,0x92,0x9d,0x38,0xf5,0xbc,0xb6,0xda,0x21,0x10,0xff,0xf3,0xd2,
+	0xcd,0x0c,0x13,0xec,0x5f,0x97,0x44,0x17,0xc4,0xa7,0x7e,0x3d,0x64,0x5d,0x19,0x73,
+	0x60,0x81,0x4f,0xdc,0x22,0x2a,0x90,0x88,0x46,0xee,0xb8,0x14,0xde,0x5e,0x0b,0xdb,
+	0xe0,0x32,0x3a,0x0a,0x49,0x06,0x24,0x5c,0xc2,0xd3,0xac,0x62,0x91,0x95,0xe4,0x79,
+	0xe7,0xc8,0x37,0x6d,0x8d,0xd5,0x4e,0xa9,0x6c,0x56,0xf4,0xea,0x65,0x7a,0xae,0x08,
+	0xba,0x78,0x25,0x2e,0x1c,0xa6,0xb4,0xc6,0xe8,0xdd,0x74,0x1f,0x4b,0xbd,0x8b,0x8a,
+	0x70,0x3e,0xb5,0x66,0x48,0x03,0xf6,0x0e,0x61,0x35,0x57,0xb9,0x86,0xc1,0x1d,0x9e,
+	0xe1,0xf8,0x98,0x11,0x69,0xd9,0x8e,0x94,0x9b,0x1e,0x87,0xe9,0xce,0x55,0x28,0xdf,
+	0x8c,0xa1,0x89,0x0d,0xbf,0xe6,0x42,0x68,0x41,0x99,0x2d,0x0f,0xb0,0x54,0xbb,0x16,
+};
+
+static uint8_t inv_sbox[256];
+
+static uint8_t xtime(uint8_t x){
+	return (x << 1) ^ ((x & 0x80) ? 0x1b : 0);
+}
+
+static uint8_t mul(uint8_t a, uint8_t b){
+	uint8_t r = 0;
+	while (b) {
+		if (b & 1)
+			r ^= a;
+		a = xtime(a);
+		b >>= 1;
+	}
+	return r;
+}
+
+void simaes_setkey(simaes_ctx *ctx, const uint8_t key[16]){
+	uint8_t rcon = 1;
+	int i;
+	
+	if (!inv_sbox[0]) {
+		for (i = 0; i < 256; i++)
+			inv_sbox[sbox[i]] = i;
+	}
+	memcpy(ctx->rk, key, 16);
+	for (i = 16; i < 176; i += 4) {
+		uint8_t t[4];
+		memcpy(t, ctx->rk + i - 4, 4);
+		if (i % 16 == 0) {
+			uint8_t u = t[0];
+			t[0] = sbox[t[1]] ^ rcon;
+			t[1] = sbox[t[2]];
+			t[2] = sbox[t[3]];
+			t[3] = sbox[u];
+			rcon = xtime(rcon);
+		}
+		ctx->rk[i] = ctx->rk[i - 16] ^ t[0];
+		ctx->rk[i + 1] = ctx->rk[i - 15] ^ t[1];
+		ctx->rk[i + 2] = ctx->rk[i - 14] ^ t[2];
+		ctx->rk[i + 3] = ctx->rk[i - 13] ^ t[3];
+	}
+}
+
+void simaes_encrypt(const simaes_ctx *ctx, const uint8_t in[16], uint8_t out[16]){
+	uint8_t s[16], t[16];
+	int r, i, c;
+	
+	for (i = 0; i < 16; i++)
+		s[i] = in[i] ^ ctx->rk[i];
+	for (r = 1; r <= 10; r++) {
+		// SubBytes and ShiftRows
+		for (i = 0; i < 16; i++)
+			t[i] = sbox[s[(i + 4 * (i % 4)) % 16]];
+		if (r < 10) {
+			for (c = 0; c < 4; c++) {
+				uint8_t *a = t + 4 * c;
+				s[4 * c] = xtime(a[0]) ^ mul(a[1], 3) ^ a[2] ^ a[3];
+				s[4 * c + 1] = a[0] ^ xtime(a[1]) ^ mul(a[2], 3) ^ a[3];
+				s[4 * c + 2] = a[0] ^ a[1] ^ xtime(a[2]) ^ mul(a[3], 3);
+				s[4 * c + 3] = mul(a[0], 3) ^ a[1] ^ a[2] ^ xtime(a[3]);
+			}
+		} else {
+			memcpy(s, t, 16);
+		}
+		for (i = 0; i < 16; i++)
+			s[i] ^= ctx->rk[16 * r + i];
+	}
+	memcpy(out, s, 16);
+}
+
+void simaes_decrypt(const simaes_ctx *ctx, const uint8_t in[16], uint8_t out[16]){
+	uint8_t s[16], t[16];
+	int r, i, c;
+	
+	for (i = 0; i < 16; i++)
+		s[i] = in[i] ^ ctx->rk[160 + i];
+	for (r = 9; r >= 0; r--) {
+		// InvShiftRows and InvSubBytes
+		for (i = 0; i < 16; i++)
+			t[(i + 4 * (i % 4)) % 16] = inv_sbox[s[i]];
+		for (i = 0; i < 16; i++)
+			t[i] ^= ctx->rk[16 * r + i];
+		if (r > 0) {
+			for (c = 0; c < 4; c++) {
+				uint8_t *a = t + 4 * c;
+				s[4 * c] = mul(a[0], 14) ^ mul(a[1], 11) ^ mul(a[2], 13) ^ mul(a[3], 9);
+				s[4 * c + 1] = mul(a[0], 9) ^ mul(a[1], 14) ^ mul(a[2], 11) ^ mul(a[3], 13);
+				s[4 * c + 2] = mul(a[0], 13) ^ mul(a[1], 9) ^ mul(a[2], 14) ^ mul(a[3], 11);
+				s[4 * c + 3] = mul(a[0], 11) ^ mul(a[1], 13) ^ mul(a[2], 9) ^ mul(a[3], 14);
+			}
+		} else {
+			memcpy(s, t, 16);
+		}
+	}
+	memcpy(out, s, 16);
+}
+
+void simaes_cbc_encrypt(const simaes_ctx *ctx, uint8_t *iv, uint8_t *data, size_t len){
+	size_t n;
+	int i;
+	
+	for (n = 0; n < len; n += 16) {
+		for (i = 0; i < 16; i++)
+			data[n + i] ^= iv[i];
+		simaes_encrypt(ctx, data + n, data + n);
+		memcpy(iv, data + n, 16);
+	}
+}
+
+void simaes_cbc_decrypt(const simaes_ctx *ctx, uint8_t *iv, uint8_t *data, size_t len){
+	uint8_t c[16];
+	size_t n;
+	int i;
+	
+	for (n = 0; n < len; n += 16) {
+		memcpy(c, data + n, 16);
+		simaes_decrypt(ctx, data + n, data + n);
+		for (i = 0; i < 16; i++)
+			data[n + i] ^= iv[i];
+		memcpy(iv, c, 16);
+	}
+}
+
+static void shift_subkey(uint8_t k[16]){
+	uint8_t msb = k[0] & 0x80;
+	int i;
+	
+	for (i = 0; i < 15; i++)
+		k[i] = (k[i] << 1) | (k[i + 1] >> 7);
+	k[15] <<= 1;
+	if (msb)
+		k[15] ^= 0x87;
+}
+
+void simaes_cmac(const simaes_ctx *ctx, uint8_t *iv, const uint8_t *data, size_t len, uint8_t mac[16]){
+	uint8_t k[16], last[16];
+	size_t n, rest;
+	int i;
+	
+	memset(k, 0, 16);
+	simaes_encrypt(ctx, k, k);
+	shift_subkey(k);
+	
+	// all blocks but the last one
+	rest = len ? ((len - 1) % 16) + 1 : 0;
+	for (n = 0; n + rest < len; n += 16) {
+		for (i = 0; i < 16; i++)
+			iv[i] ^= data[n + i];
+		simaes_encrypt(ctx, iv, iv);
+	}
+	memset(last, 0, 16);
+	memcpy(last, data + n, rest);
+	if (rest < 16) {
+		last[rest] = 0x80;
+		shift_subkey(k);
+	}
+	for (i = 0; i < 16; i++)
+		iv[i] ^= last[i] ^ k[i];
+	simaes_encrypt(ctx, iv, iv);
+	memcpy(mac, iv, 16);
+}
@@ -0,0 +1,23 @@
+#ifndef _SIMAES_H_
+#define _SIMAES_H_
+
+// Plain reference AES-128 for the simulated card, deliberately independent
+// of the firmware's crypto code.
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct {
+	uint8_t rk[176];
+} simaes_ctx;
+
+void simaes_setkey(simaes_ctx *ctx, const uint8_t key[16]);
+void simaes_encrypt(const simaes_ctx *ctx, const uint8_t in[16], uint8_t out[16]);
+void simaes_decrypt(const simaes_ctx *ctx, const uint8_t in[16], uint8_t out[16]);
+// CBC over len bytes (a multiple of 16) in place, iv is updated
+void simaes_cbc_encrypt(const simaes_ctx *ctx, uint8_t *iv, uint8_t *data, size_t len);
+void simaes_cbc_decrypt(const simaes_ctx *ctx, uint8_t *iv, uint8_t *data, size_t len);
+// NIST SP 800-38B CMAC, iv is the chaining value (DESFire EV1 style)
+void simaes_cmac(const simaes_ctx *ctx, uint8_t *iv, const uint8_t *data, size_t len, uint8_t mac[16]);
+
+#endif
@@ -0,0 +1,11 @@
+#include "stack.h"
+
+// The host stack says nothing about the one of the AVR, the simulator
+// reports none used
+uint16_t stack_peak(void){
+	return 0;
+}
+
+uint16_t stack_unused(void){
+	return 0;
+}
@@ -0,0 +1,126 @@
+#include <string.h>
+#include "sm.h"
+
+// Shift left by one bit, reduce with Rb
+static void cmac_double(uint8_t *k){
+	uint8_t i, msb = k[0] & 0x80;
+	
+	for (i = 0; i < AES_BLOCK_SIZE - 1; i++)
+		k[i] = (k[i] << 1) | (k[i + 1] >> 7);
+	k[AES_BLOCK_SIZE - 1] <<= 1;
+	if (msb)
+		k[AES_BLOCK_SIZE - 1] ^= 0x87;
+}
+
+static void xor_block(uint8_t *d, const uint8_t *s){
+	uint8_t i;
+	
+	for (i = 0; i < AES_BLOCK_SIZE; i++)
+		d[i] ^= s[i];
+}
+
+// K1 = 2 * AES(key, 0)
+void sm_cmac_subkey(const uint8_t *key, uint8_t *k1){
+	AES_KEY k;
+	
+	memset(k1, 0, AES_BLOCK_SIZE);
+	AES_set_encrypt_key(key, 128, &k);
+	AES_encrypt(k1, k1, &k);
+	cmac_double(k1);
+}
+
+void sm_cmac_init(sm_cmac_t *c, const uint8_t *key, const uint8_t *k1, const uint8_t *iv){
+	c->key = key;
+	c->k1 = k1;
+	if (iv)
+		memcpy(c->x, iv, AES_BLOCK_SIZE);
+	else
+		memset(c->x, 0, AES_BLOCK_SIZE);
+	c->fill = 0;
+	c->padded = false;
+}
+
+void sm_cmac_update(sm_cmac_t *c, const uint8_t *data, uint16_t len){
+	AES_KEY k;
+	
+	if (!len)
+		return;
+	AES_set_encrypt_key(c->key, 128, &k);
+	while (len--) {
+		// the last block gets the subkey, only encipher a full one when
+		// more data follows
+		if (c->fill == AES_BLOCK_SIZE) {
+			AES_encrypt(c->x, c->x, &k);
+			c->fill = 0;
+		}
+		c->x[c->fill++] ^= *data++;
+	}
+}
+
+void sm_cmac_pad(sm_cmac_t *c, uint16_t zeros){
+	static const uint8_t pad = 0x80;
+	AES_KEY k;
+	
+	sm_cmac_update(c, &pad, 1);
+	AES_set_encrypt_key(c->key, 128, &k);
+	// XORing zeros leaves x as it is, only the block ends count
+	while (zeros) {
+		if (c->fill == AES_BLOCK_SIZE) {
+			AES_encrypt(c->x, c->x, &k);
+			c->fill = 0;
+		}
+		if (zeros < AES_BLOCK_SIZE - c->fill) {
+			c->fill += zeros;
+			break;
+		}
+		zeros -= AES_BLOCK_SIZE - c->fill;
+		c->fill = AES_BLOCK_SIZE;
+	}
+	c->padded = true;
+}
+
+void sm_cmac_final(sm_cmac_t *c, uint8_t *mac){
+	uint8_t sub[AES_BLOCK_SIZE];
+	AES_KEY k;
+	
+	if (c->fill < AES_BLOCK_SIZE && !c->padded) {
+		c->x[c->fill] ^= 0x80;
+		c->padded = true;
+	}
+	memcpy(sub, c->k1, AES_BLOCK_SIZE);
+	if (c->padded)
+		cmac_double(sub);
+	xor_block(c->x, sub);
+	AES_set_encrypt_key(c->key, 128, &k);
+	AES_encrypt(c->x, mac, &k);
+}
+
+void sm_cbc_encipher(const uint8_t *key, uint8_t *iv, uint8_t *data, uint16_t len){
+	const uint8_t *prev = iv;
+	AES_KEY k;
+	
+	if (!len)
+		return;
+	AES_set_encrypt_key(key, 128, &k);
+	for (; len >= AES_BLOCK_SIZE; len -= AES_BLOCK_SIZE, data += AES_BLOCK_SIZE) {
+		xor_block(data, prev);
+		AES_encrypt(data, data, &k);
+		prev = data;
+	}
+	memcpy(iv, prev, AES_BLOCK_SIZE);
+}
+
+// Each cipher block is the IV of the next, it is kept before the block is
+// deciphered over it
+void sm_cbc_decipher(const uint8_t *key, uint8_t *iv, uint8_t *data, uint16_t len){
+	uint8_t c[AES_BLOCK_SIZE];
+	AES_KEY k;
+	
+	AES_set_decrypt_key(key, 128, &k);
+	for (; len >= AES_BLOCK_SIZE; len -= AES_BLOCK_SIZE, data += AES_BLOCK_SIZE) {
+		memcpy(c, data, AES_BLOCK_SIZE);
+		AES_decrypt(data, data, &k);
+		xor_block(data, iv);
+		memcpy(iv, c, AES_BLOCK_SIZE);
+	}
+}
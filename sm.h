@@ -0,0 +1,53 @@
+#ifndef _SM_H_
+#define _SM_H_
+
+// AES-128 CMAC over data fed a chunk at a time, and CBC that enciphers or
+// deciphers in place. The CMAC state is one block plus a few bytes however
+// long the data is, the message needs no padded copy.
+//
+// The firmware uses the CMAC for the AN10922 key diversification
+// (keydiv.c) and for the APDUs of an AES session: sm_freefare.c takes
+// libfreefare's MACing and ciphering of commands and responses over. The
+// authentication itself stays with libfreefare. bench.c checks and
+// measures both.
+//
+//   sm_cmac_init(&c, key, k1, iv);
+//   sm_cmac_update(&c, header, n);
+//   sm_cmac_update(&c, data, m);
+//   sm_cmac_final(&c, mac);
+//
+// Keys are AES-128 and owned by the caller, the expanded key comes from
+// the key cache of aesdummy.c. K1 is the CMAC subkey of the key,
+// sm_cmac_subkey() derives it once per key; K2 follows from K1 at the end.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "aesdummy.h"
+
+typedef struct {
+	const uint8_t *key;
+	const uint8_t *k1;
+	// chaining value, the data is XORed in here
+	uint8_t x[AES_BLOCK_SIZE];
+	// bytes in x since it was last enciphered, a full block waits for
+	// the next byte or the end
+	uint8_t fill;
+	bool padded;
+} sm_cmac_t;
+
+void sm_cmac_subkey(const uint8_t *key, uint8_t *k1);
+// iv NULL starts from zero, DESFire chains the MACs of a session
+void sm_cmac_init(sm_cmac_t *c, const uint8_t *key, const uint8_t *k1, const uint8_t *iv);
+void sm_cmac_update(sm_cmac_t *c, const uint8_t *data, uint16_t len);
+// Pads with 0x80 and then zeros more zero bytes, for MACs over a fixed
+// length (AN10922); sm_cmac_final() pads to the end of the block otherwise
+void sm_cmac_pad(sm_cmac_t *c, uint16_t zeros);
+// The full 16 byte CMAC, DESFire sends its odd bytes or the first 8
+void sm_cmac_final(sm_cmac_t *c, uint8_t *mac);
+
+// len is a multiple of AES_BLOCK_SIZE. iv is updated to the last cipher
+// block, so a message can be ciphered in several calls.
+void sm_cbc_encipher(const uint8_t *key, uint8_t *iv, uint8_t *data, uint16_t len);
+void sm_cbc_decipher(const uint8_t *key, uint8_t *iv, uint8_t *data, uint16_t len);
+
+#endif
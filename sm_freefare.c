@@ -0,0 +1,180 @@
+#include <stdlib.h>
+#include <string.h>
+#include "freefare_internal.h"
+#include "sm.h"
+#include "crc.h"
+
+// libfreefare's secure messaging of AES sessions, through sm.c and crc.c.
+// The linker wraps the two entry points mifare_desfire.c calls for every
+// command and response (-Wl,--wrap, see the Makefile), the same way
+// pool.c takes over malloc, and the CRC32 it calls for ChangeKey. Legacy
+// and 3K3DES sessions, and authentication itself, stay with libfreefare.
+//
+// libfreefare MACs a command by copying it into a padded buffer and
+// ciphers it block by block with a new key schedule each; here the CMAC
+// runs over the data where it is, the CBC works in place with one key
+// schedule, and a response is checked and deciphered right in the
+// receive buffer. A command that gets a MAC or a CRC appended still goes
+// into the crypto buffer, the caller's may have no room for it.
+
+// DESFire sends 8 of the 16 CMAC bytes
+#define SM_MAC_LENGTH		8
+
+void *__real_mifare_cryto_preprocess_data(MifareTag tag, void *data, size_t *nbytes, off_t offset, int communication_settings);
+void *__real_mifare_cryto_postprocess_data(MifareTag tag, void *data, ssize_t *nbytes, int communication_settings);
+void *__wrap_mifare_cryto_preprocess_data(MifareTag tag, void *data, size_t *nbytes, off_t offset, int communication_settings);
+void *__wrap_mifare_cryto_postprocess_data(MifareTag tag, void *data, ssize_t *nbytes, int communication_settings);
+void __wrap_desfire_crc32(const uint8_t *data, const size_t len, uint8_t *crc);
+void __wrap_desfire_crc32_append(uint8_t *data, const size_t len);
+
+// DESFire's CRC32, little endian
+void __wrap_desfire_crc32(const uint8_t *data, const size_t len, uint8_t *crc){
+	uint32_t c = crc32_update(CRC32_INIT, data, len);
+
+	crc[0] = c;
+	crc[1] = c >> 8;
+	crc[2] = c >> 16;
+	crc[3] = c >> 24;
+}
+
+void __wrap_desfire_crc32_append(uint8_t *data, const size_t len){
+	__wrap_desfire_crc32(data, len, data + len);
+}
+
+static bool sm_freefare_aes(MifareTag tag){
+	MifareDESFireKey key = MIFARE_DESFIRE (tag)->session_key;
+
+	return key && key->type == T_AES && MIFARE_DESFIRE (tag)->authentication_scheme == AS_NEW;
+}
+
+// CMAC of data and, if last is not NULL, one more byte. It becomes the IV
+// of what follows.
+static void sm_freefare_cmac(MifareTag tag, const uint8_t *data, size_t len, const uint8_t *last){
+	MifareDESFireKey key = MIFARE_DESFIRE (tag)->session_key;
+	sm_cmac_t c;
+
+	sm_cmac_init(&c, key->data, key->cmac_sk1, MIFARE_DESFIRE (tag)->ivect);
+	sm_cmac_update(&c, data, len);
+	if (last)
+		sm_cmac_update(&c, last, 1);
+	sm_cmac_final(&c, MIFARE_DESFIRE (tag)->cmac);
+	memcpy(MIFARE_DESFIRE (tag)->ivect, MIFARE_DESFIRE (tag)->cmac, AES_BLOCK_SIZE);
+}
+
+void *__wrap_mifare_cryto_preprocess_data(MifareTag tag, void *data, size_t *nbytes, off_t offset, int communication_settings){
+	MifareDESFireKey key = MIFARE_DESFIRE (tag)->session_key;
+	uint8_t *res = data;
+	size_t edl;
+
+	if (!sm_freefare_aes(tag))
+		return __real_mifare_cryto_preprocess_data(tag, data, nbytes, offset, communication_settings);
+	switch (communication_settings & MDCM_MASK) {
+	case MDCM_PLAIN:
+	case MDCM_MACED:
+		// plain commands are MACed too, only to keep the IV in step
+		if (!(communication_settings & CMAC_COMMAND))
+			break;
+		sm_freefare_cmac(tag, data, *nbytes, NULL);
+		if ((communication_settings & MDCM_MASK) == MDCM_PLAIN)
+			break;
+		if (!(res = assert_crypto_buffer_size(tag, *nbytes + SM_MAC_LENGTH)))
+			abort();
+		memcpy(res, data, *nbytes);
+		memcpy(res + *nbytes, MIFARE_DESFIRE (tag)->cmac, SM_MAC_LENGTH);
+		*nbytes += SM_MAC_LENGTH;
+		break;
+	case MDCM_ENCIPHERED:
+		// CMD + HEADERS | DATA | CRC32 over all before | zero padding, all
+		// after the headers enciphered
+		if (!(communication_settings & ENC_COMMAND))
+			break;
+		edl = enciphered_data_length(tag, *nbytes - offset, communication_settings) + offset;
+		if (!(res = assert_crypto_buffer_size(tag, edl)))
+			abort();
+		memcpy(res, data, *nbytes);
+		if (!(communication_settings & NO_CRC)) {
+			__wrap_desfire_crc32_append(res, *nbytes);
+			*nbytes += 4;
+		}
+		memset(res + *nbytes, 0, edl - *nbytes);
+		*nbytes = edl;
+		sm_cbc_encipher(key->data, MIFARE_DESFIRE (tag)->ivect, res + offset, edl - offset);
+		break;
+	default:
+		return __real_mifare_cryto_preprocess_data(tag, data, nbytes, offset, communication_settings);
+	}
+	return res;
+}
+
+// data is the response followed by its status byte, *nbytes counts both
+void *__wrap_mifare_cryto_postprocess_data(MifareTag tag, void *data, ssize_t *nbytes, int communication_settings){
+	MifareDESFireKey key = MIFARE_DESFIRE (tag)->session_key;
+	static const uint8_t ok = OPERATION_OK;
+	uint8_t *res = data;
+	uint32_t prefix, crc;
+	size_t n, p, done, i;
+
+	if (!sm_freefare_aes(tag))
+		return __real_mifare_cryto_postprocess_data(tag, data, nbytes, communication_settings);
+	// a status code alone
+	if (*nbytes == 1)
+		return data;
+	switch (communication_settings & MDCM_MASK) {
+	case MDCM_PLAIN:
+	case MDCM_MACED:
+		if (!(communication_settings & CMAC_COMMAND))
+			break;
+		if (!(communication_settings & CMAC_VERIFY)) {
+			sm_freefare_cmac(tag, res, *nbytes, NULL);
+			break;
+		}
+		// DATA | CMAC | STATUS, the CMAC is over DATA | STATUS
+		if (*nbytes < SM_MAC_LENGTH + 1)
+			goto fail;
+		n = *nbytes - SM_MAC_LENGTH - 1;
+		sm_freefare_cmac(tag, res, n, res + *nbytes - 1);
+		if (memcmp(MIFARE_DESFIRE (tag)->cmac, res + n, SM_MAC_LENGTH))
+			goto fail;
+		*nbytes -= SM_MAC_LENGTH;
+		break;
+	case MDCM_ENCIPHERED:
+		// DATA | CRC32 over DATA and STATUS | padding, enciphered, then
+		// STATUS. The padding is 0x80 or 0x00 and then 0x00, so the CRC is
+		// searched for from the shortest DATA that fits in the last block.
+		n = *nbytes - 1;
+		if (n % AES_BLOCK_SIZE)
+			goto fail;
+		sm_cbc_decipher(key->data, MIFARE_DESFIRE (tag)->ivect, res, n);
+		prefix = CRC32_INIT;
+		done = 0;
+		for (p = n > AES_BLOCK_SIZE + 3 ? n - AES_BLOCK_SIZE - 3 : 0; p + 4 <= n; p++) {
+			// the CRC of DATA is carried from one guess to the next, a CRC
+			// followed by itself leaves 0
+			prefix = crc32_update(prefix, res + done, p - done);
+			done = p;
+			crc = crc32_update(crc32_update(prefix, &ok, 1), res + p, 4);
+			if (crc)
+				continue;
+			// like libfreefare, the last byte is not looked at
+			for (i = p + 4; i + 1 < n; i++) {
+				if (res[i] && (res[i] != 0x80 || i != p + 4))
+					break;
+			}
+			if (i + 1 < n)
+				continue;
+			// DATA then STATUS, as libfreefare hands it out
+			res[p] = OPERATION_OK;
+			*nbytes = p + 1;
+			return res;
+		}
+		goto fail;
+	default:
+		return __real_mifare_cryto_postprocess_data(tag, data, nbytes, communication_settings);
+	}
+	return res;
+
+fail:
+	MIFARE_DESFIRE (tag)->last_pcd_error = CRYPTO_ERROR;
+	*nbytes = -1;
+	return NULL;
+}
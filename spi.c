@@ -0,0 +1,73 @@
+#include <stddef.h>
+#include <avr/io.h>
+#include "spi.h"
+
+#define SPI_DDR		DDRB
+#define SPI_SS		PB4
+#define SPI_MOSI	PB5
+#define SPI_MISO	PB6
+#define SPI_SCK		PB7
+
+void spi_init(void){
+	// SS has to be an output to stay master
+	SPI_DDR |= _BV(SPI_SS) | _BV(SPI_MOSI) | _BV(SPI_SCK);
+	SPI_DDR &= ~_BV(SPI_MISO);
+	SPCR = _BV(SPE) | _BV(MSTR) | _BV(DORD);
+	SPSR = _BV(SPI2X);
+}
+
+uint8_t spi_transfer(uint8_t c){
+	return spi_exchange(c);
+}
+
+void spi_transfer_block(const uint8_t *tx, uint8_t *rx, uint16_t len){
+	uint8_t c;
+	
+	while (len--) {
+		c = spi_exchange(tx ? *tx++ : 0x00);
+		if (rx)
+			*rx++ = c;
+	}
+}
+
+uint8_t spi_write_burst(const uint8_t *tx, uint16_t len){
+	uint8_t c, sum;
+	
+	if (!len)
+		return 0;
+	c = *tx++;
+	SPDR = c;
+	sum = c;
+	while (--len) {
+		// fetched and summed while the previous byte is on the wire
+		c = *tx++;
+		sum += c;
+		loop_until_bit_is_set(SPSR, SPIF);
+		SPDR = c;
+	}
+	loop_until_bit_is_set(SPSR, SPIF);
+	return sum;
+}
+
+uint8_t spi_read_burst(uint8_t *rx, uint16_t len){
+	uint8_t c, sum = 0;
+	
+	if (!len)
+		return 0;
+	SPDR = 0x00;
+	while (--len) {
+		loop_until_bit_is_set(SPSR, SPIF);
+		c = SPDR;
+		// the receive buffer is free, the next byte starts right away
+		SPDR = 0x00;
+		sum += c;
+		if (rx)
+			*rx++ = c;
+	}
+	loop_until_bit_is_set(SPSR, SPIF);
+	c = SPDR;
+	sum += c;
+	if (rx)
+		*rx = c;
+	return sum;
+}
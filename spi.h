@@ -0,0 +1,43 @@
+#ifndef _SPI_H_
+#define _SPI_H_
+
+// SPI master for the PN532 link: mode 0, LSB first, at F_OSC / 2
+// (1.8432 MHz, the PN532 takes up to 5 MHz).
+//
+// Everything polls SPIF. At F_OSC / 2 a byte takes only 16 CPU cycles,
+// less than the entry and exit of an SPI interrupt, so clocking frames
+// from the interrupt would be slower and leave the CPU no time between
+// bytes. The inline single byte primitives are for frame headers, the
+// burst calls for payloads. The bursts load the next byte while the
+// current one is on the wire and return the sum of all bytes, which is
+// what PN532 checksums need.
+
+#include <stdint.h>
+#include <avr/io.h>
+
+void spi_init(void);
+
+uint8_t spi_transfer(uint8_t c);
+// tx NULL clocks out zeros, rx NULL drops the received bytes
+void spi_transfer_block(const uint8_t *tx, uint8_t *rx, uint16_t len);
+
+// Bursts, returning the 8 bit sum of the bytes sent or received
+uint8_t spi_write_burst(const uint8_t *tx, uint16_t len);
+// rx NULL drops the bytes
+uint8_t spi_read_burst(uint8_t *rx, uint16_t len);
+
+static inline uint8_t spi_exchange(uint8_t c){
+	SPDR = c;
+	loop_until_bit_is_set(SPSR, SPIF);
+	return SPDR;
+}
+
+static inline void spi_write(uint8_t c){
+	spi_exchange(c);
+}
+
+static inline uint8_t spi_read(void){
+	return spi_exchange(0x00);
+}
+
+#endif
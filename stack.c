@@ -0,0 +1,43 @@
+#include <avr/io.h>
+#include <stdlib.h>
+#include "stack.h"
+
+// From the linker: the end of .bss and the top of the stack
+extern uint8_t _end;
+extern uint8_t __stack;
+// avr-libc's heap break, NULL until the heap is used
+extern char *__brkval;
+
+// Runs in .init1, before the stack pointer and r1 are set up, hence no
+// C. Paints from the end of .bss up to the top of the stack.
+void stack_paint(void) __attribute__((naked, used, section(".init1")));
+void stack_paint(void){
+	__asm volatile (
+		"	ldi r30, lo8(_end)\n"
+		"	ldi r31, hi8(_end)\n"
+		"	ldi r24, %0\n"
+		"	ldi r25, hi8(__stack)\n"
+		"	rjmp 2f\n"
+		"1:	st Z+, r24\n"
+		"2:	cpi r30, lo8(__stack)\n"
+		"	cpc r31, r25\n"
+		"	brlo 1b\n"
+		:: "M" (STACK_CANARY));
+}
+
+// The lowest byte that no longer holds the pattern
+static const uint8_t *stack_low(void){
+	const uint8_t *p = __brkval ? (const uint8_t *)__brkval : &_end;
+	
+	while (p < &__stack && *p == STACK_CANARY)
+		p++;
+	return p;
+}
+
+uint16_t stack_peak(void){
+	return &__stack - stack_low() + 1;
+}
+
+uint16_t stack_unused(void){
+	return stack_low() - (__brkval ? (const uint8_t *)__brkval : &_end);
+}
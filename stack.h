@@ -0,0 +1,19 @@
+#ifndef _STACK_H_
+#define _STACK_H_
+
+// Stack high-water mark. Before the C runtime starts, the RAM between the
+// end of .bss and the top of the stack is filled with STACK_CANARY. The
+// stack grows down into it, the heap (only used when the pools of pool.c
+// run full) up. What still holds the pattern was never used.
+
+#include <stdint.h>
+
+#define STACK_CANARY		0xc5
+
+// Deepest the stack has been since reset, in bytes
+uint16_t stack_peak(void);
+// Bytes between the heap and the deepest stack that were never touched,
+// what the buffers can still grow by
+uint16_t stack_unused(void);
+
+#endif
@@ -0,0 +1,52 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "tick.h"
+
+#if TICK_TIMER_HZ / 1000 > 256
+	#error "F_OSC too high for the Timer0 prescaler, adjust tick.c"
+#endif
+
+static volatile uint16_t tick_count;
+// Timer clocks per ms are not a whole number (57.6 at 3.6864 MHz): the
+// remainder is carried over and every period that collects a full one is
+// one clock longer
+static uint16_t tick_carry;
+static void (*tick_hook)(void);
+
+ISR(TIMER0_COMPA_vect) {
+	tick_count++;
+	tick_carry += TICK_TIMER_HZ % 1000;
+	if (tick_carry >= 1000) {
+		tick_carry -= 1000;
+		OCR0A = TICK_TIMER_HZ / 1000;
+	} else {
+		OCR0A = TICK_TIMER_HZ / 1000 - 1;
+	}
+	if (tick_hook)
+		tick_hook();
+}
+
+void tick_init(void){
+	// CTC mode, F_OSC / 64
+	TCCR0A = _BV(WGM01);
+	TCCR0B = _BV(CS01) | _BV(CS00);
+	OCR0A = TICK_TIMER_HZ / 1000 - 1;
+	TIMSK0 |= _BV(OCIE0A);
+	sei();
+}
+
+void tick_set_hook(void (*hook)(void)){
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		tick_hook = hook;
+	}
+}
+
+uint16_t tick_ms(void){
+	uint16_t ms;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		ms = tick_count;
+	}
+	return ms;
+}
@@ -0,0 +1,23 @@
+#ifndef _TICK_H_
+#define _TICK_H_
+
+// Millisecond tick from Timer0 (compare match A), for timeouts. The count
+// wraps after 65.5 s, so compare with tick_elapsed and keep intervals
+// below that.
+
+#include <stdint.h>
+
+// Timer0 runs at F_OSC / 64
+#define TICK_TIMER_HZ			(F_OSC / 64)
+
+void tick_init(void);
+uint16_t tick_ms(void);
+// Called from the tick interrupt every ms, NULL for none
+void tick_set_hook(void (*hook)(void));
+
+// ms since an earlier tick_ms()
+static inline uint16_t tick_elapsed(uint16_t since){
+	return tick_ms() - since;
+}
+
+#endif
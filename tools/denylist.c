@@ -0,0 +1,176 @@
+/*
+ * Builds the flash table of denied cards (see denylist.h), and the serial
+ * commands that change the EEPROM overlay.
+ *
+ *   cc -O2 -o denylist denylist.c
+ *   ./denylist uids.txt > ../denylist_table.c     (or from stdin)
+ *   ./denylist -r 12000 > ../denylist_table.c     random UIDs, to benchmark
+ *   ./denylist -d 04a1b2c3d4e5f6 > /dev/ttyUSB0   deny a card
+ *   ./denylist -a 04a1b2c3d4e5f6 > /dev/ttyUSB0   allow it again
+ *   ./denylist -c > /dev/ttyUSB0                  clear the overlay
+ *
+ * The list has one UID per line in hex, anything after a # is a comment.
+ * Only 7 byte NXP UIDs fit the table, others are reported and left out,
+ * they can still go to the overlay. Duplicates are dropped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include "../denylist.h"
+
+// Serial commands, as main.c reads them
+#define CMD_DENY		'D'
+#define CMD_ALLOW		'A'
+#define CMD_CLEAR		'C'
+
+// Table entries within the upper 64 KB of the flash
+#define MAX_UIDS		((0x10000 - 257 * 2) / DENYLIST_ENTRY)
+
+static uint8_t (*uids)[DENYLIST_UID_LEN];
+static size_t count, size;
+
+static int parse_uid(const char *s, uint8_t *uid){
+	int n = 0;
+	unsigned v;
+
+	while (*s && n <= DENYLIST_UID_LEN) {
+		if (isspace((unsigned char)*s) || *s == ':') {
+			s++;
+			continue;
+		}
+		if (sscanf(s, "%2x", &v) != 1 || !isxdigit((unsigned char)s[1]))
+			return -1;
+		if (n < DENYLIST_UID_LEN)
+			uid[n] = v;
+		n++;
+		s += 2;
+	}
+	return n;
+}
+
+static void add(const uint8_t *uid){
+	if (count == size) {
+		size = size ? size * 2 : 1024;
+		uids = realloc(uids, size * DENYLIST_UID_LEN);
+		if (!uids) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	memcpy(uids[count++], uid, DENYLIST_UID_LEN);
+}
+
+static int compare(const void *a, const void *b){
+	return memcmp(a, b, DENYLIST_UID_LEN);
+}
+
+static void read_list(FILE *f){
+	char line[256], *p;
+	uint8_t uid[DENYLIST_UID_LEN];
+	int lineno = 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+		if ((p = strchr(line, '#')))
+			*p = 0;
+		switch (parse_uid(line, uid)) {
+		case 0:
+			break;
+		case DENYLIST_UID_LEN:
+			if (uid[0] == DENYLIST_MANUFACTURER) {
+				add(uid);
+				break;
+			}
+			// fall through
+		default:
+			fprintf(stderr, "line %d: not a 7 byte NXP UID, left out\n", lineno);
+		}
+	}
+}
+
+static void random_list(long n){
+	uint8_t uid[DENYLIST_UID_LEN];
+	long i;
+	int j;
+
+	srand(1);
+	for (i = 0; i < n; i++) {
+		uid[0] = DENYLIST_MANUFACTURER;
+		for (j = 1; j < DENYLIST_UID_LEN; j++)
+			uid[j] = rand() >> 7;
+		add(uid);
+	}
+}
+
+static void write_table(void){
+	size_t i, n = 0;
+	unsigned b;
+	int j;
+
+	qsort(uids, count, DENYLIST_UID_LEN, compare);
+	for (i = 0; i < count; i++) {
+		if (!n || memcmp(uids[n - 1], uids[i], DENYLIST_UID_LEN))
+			memcpy(uids[n++], uids[i], DENYLIST_UID_LEN);
+	}
+	count = n;
+	if (count > MAX_UIDS) {
+		fprintf(stderr, "%zu UIDs, the flash takes %d\n", count, MAX_UIDS);
+		exit(1);
+	}
+	printf("// Generated by tools/denylist, do not edit. %zu UIDs.\n\n", count);
+	printf("#include \"denylist.h\"\n\n");
+	printf("const denylist_table_t denylist_table DENYLIST_SECTION = {\n");
+	printf("\t.index = {");
+	for (b = 0, i = 0; b <= 256; b++) {
+		while (i < count && uids[i][1] < b)
+			i++;
+		printf("%s%zu", b % 16 ? ", " : b ? ",\n\t\t" : "\n\t\t", i);
+	}
+	printf("\n\t},\n\t.entries = {\n");
+	for (i = 0; i < count; i++) {
+		printf("\t\t{");
+		for (j = 2; j < DENYLIST_UID_LEN; j++)
+			printf("%s0x%02x", j > 2 ? ", " : "", uids[i][j]);
+		printf("},\n");
+	}
+	printf("\t},\n};\n");
+	fprintf(stderr, "%zu UIDs, %zu bytes of flash\n", count, 257 * 2 + count * DENYLIST_ENTRY);
+}
+
+static void command(char cmd, const char *hex){
+	uint8_t uid[DENYLIST_UID_LEN];
+
+	if (hex && parse_uid(hex, uid) != DENYLIST_UID_LEN) {
+		fprintf(stderr, "%s: not a 7 byte UID\n", hex);
+		exit(1);
+	}
+	putchar(cmd);
+	if (hex)
+		fwrite(uid, 1, DENYLIST_UID_LEN, stdout);
+}
+
+int main(int argc, char **argv){
+	FILE *f = stdin;
+
+	if (argc > 2 && !strcmp(argv[1], "-d")) {
+		command(CMD_DENY, argv[2]);
+	} else if (argc > 2 && !strcmp(argv[1], "-a")) {
+		command(CMD_ALLOW, argv[2]);
+	} else if (argc > 1 && !strcmp(argv[1], "-c")) {
+		command(CMD_CLEAR, NULL);
+	} else if (argc > 2 && !strcmp(argv[1], "-r")) {
+		random_list(atol(argv[2]));
+		write_table();
+	} else {
+		if (argc > 1 && !(f = fopen(argv[1], "rb"))) {
+			perror(argv[1]);
+			return 1;
+		}
+		read_list(f);
+		write_table();
+	}
+	return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * Decodes the journal exports the firmware sends to the UART when it
+ * receives 'J' (see journal.h) and prints one line per record, oldest
+ * first.
+ *
+ *   cc -O2 -o journaldecode journaldecode.c
+ *   ./journaldecode capture.bin     (or from stdin)
+ *
+ * Only the last export in the capture is printed. Records are checked
+ * against their CRC, sequence gaps are reported: the journal ring wrapped
+ * or records were lost before they reached the EEPROM.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "../journal.h"
+
+#define RECORD_SIZE		16
+
+static uint8_t *records;
+static size_t count;
+
+static uint8_t crc8(const uint8_t *p, int len){
+	uint8_t crc = 0xff;
+	int i;
+
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+	}
+	return crc;
+}
+
+static int read_export(FILE *f){
+	uint8_t b[3];
+	size_t n;
+	int c;
+
+	// sync
+	do {
+		while ((c = getc(f)) != JOURNAL_SYNC1)
+			if (c == EOF)
+				return 0;
+		c = getc(f);
+	} while (c != JOURNAL_SYNC2 && c != EOF);
+	if (c == EOF || fread(b, 1, 3, f) != 3)
+		return 0;
+	if (b[0] != JOURNAL_VERSION) {
+		fprintf(stderr, "unknown journal version %u\n", b[0]);
+		return 1;
+	}
+	n = b[1] | b[2] << 8;
+	free(records);
+	records = malloc(n * RECORD_SIZE + 1);
+	count = fread(records, RECORD_SIZE, n, f);
+	if (count != n)
+		fprintf(stderr, "export cut short, %zu of %zu records\n", count, n);
+	return count == n;
+}
+
+int main(int argc, char **argv){
+	FILE *f = stdin;
+	int exports = 0;
+	size_t i;
+	int j;
+
+	if (argc > 1 && !(f = fopen(argv[1], "rb"))) {
+		perror(argv[1]);
+		return 1;
+	}
+	while (read_export(f))
+		exports++;
+	if (!records) {
+		fprintf(stderr, "no journal found\n");
+		return 1;
+	}
+	printf("%6s %-14s %10s %6s %6s\n", "seq", "uid", "amount", "result", "reader");
+	for (i = 0; i < count; i++) {
+		const uint8_t *r = records + i * RECORD_SIZE;
+		int32_t amount = (int32_t)(r[0] | r[1] << 8 | r[2] << 16 | (uint32_t)r[3] << 24);
+		uint16_t seq = r[4] | r[5] << 8;
+
+		if (i && seq != (uint16_t)((r[-RECORD_SIZE + 4] | r[-RECORD_SIZE + 5] << 8) + 1))
+			printf("-- gap --\n");
+		printf("%6u ", seq);
+		for (j = 0; j < JOURNAL_UID_LEN; j++)
+			printf("%02x", r[6 + j]);
+		printf(" %10ld %6d %6u", (long)amount, (int8_t)r[13], r[14]);
+		if (crc8(r, RECORD_SIZE - 1) != r[15])
+			printf("  bad crc");
+		printf("\n");
+	}
+	fprintf(stderr, "%d exports, %zu records in the last\n", exports, count);
+	return 0;
+}
@@ -0,0 +1,254 @@
+/*
+ * Decodes the trace dumps the firmware writes to the UART when it is built
+ * with -DTRACE (see trace.h) and prints per-phase latency statistics over
+ * all taps.
+ *
+ *   cc -O2 -o tracedecode tracedecode.c
+ *   ./tracedecode capture.bin     (or from stdin)
+ *
+ * Each tap is broken down into the transaction phases of main.c and into
+ * the time spent in the PN532 command steps: writing the command, waiting
+ * for and reading the ACK, waiting for the response and reading it. What
+ * remains of a tap is time on the AVR (crypto, libfreefare, logging).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "../trace.h"
+
+#define NPHASES		16
+#define NSTEPS		4
+
+typedef struct {
+	double *v;
+	size_t n, size;
+} samples;
+
+static const char *phase_names[NPHASES] = {
+	[TRACE_TAP] = "tap",
+	[TRACE_GETTAGS] = "get tags",
+	[TRACE_CONNECT] = "connect",
+	[TRACE_SELECT] = "select application",
+	[TRACE_GETUID] = "get uid",
+	[TRACE_KEYDIV] = "key diversification",
+	[TRACE_AUTH] = "authenticate",
+	[TRACE_DEBIT] = "debit",
+	[TRACE_COMMIT] = "commit",
+	[TRACE_DISCONNECT] = "disconnect",
+	[TRACE_PRESENCE] = "presence check",
+};
+
+static const char *step_names[NSTEPS] = {
+	"write command", "ack", "wait response", "read response"
+};
+
+static samples phase_samples[NPHASES];
+// PN532 steps per tap, and per single command
+static samples step_tap_samples[NSTEPS + 1];
+static samples step_cmd_samples[NSTEPS][256];
+
+// With several readers their taps overlap, a tap is paired with its end
+// by the reader in the argument. The other phases and the PN532 commands
+// of a reader do not overlap another's, the starts are stacked all the
+// same.
+#define NEST				8
+
+typedef struct {
+	uint32_t start[NEST];
+	int depth;
+} nest;
+
+static double tick_ms;
+static nest phase_start[NPHASES];
+static nest tap_start[256];
+static nest step_start[NSTEPS][256];
+static double tap_steps[NSTEPS];
+// taps in progress, the steps are taken per outermost tap
+static int in_tap;
+static unsigned long dumps, records, dropped;
+
+static void add(samples *s, double v){
+	if (s->n == s->size) {
+		s->size = s->size ? 2 * s->size : 64;
+		s->v = realloc(s->v, s->size * sizeof(*s->v));
+		if (!s->v) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	s->v[s->n++] = v;
+}
+
+static int cmp(const void *a, const void *b){
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+// nearest rank
+static double percentile(const samples *s, int p){
+	size_t i = (s->n * p + 99) / 100;
+
+	return s->v[i ? i - 1 : 0];
+}
+
+static void print(const char *name, samples *s){
+	double sum = 0;
+	size_t i;
+
+	if (!s->n)
+		return;
+	qsort(s->v, s->n, sizeof(*s->v), cmp);
+	for (i = 0; i < s->n; i++)
+		sum += s->v[i];
+	printf("%-28s %6zu %9.3f %9.3f %9.3f %9.3f %9.3f\n", name, s->n, sum / s->n,
+		percentile(s, 50), percentile(s, 90), percentile(s, 99), s->v[s->n - 1]);
+}
+
+static void push(nest *n, uint32_t ticks){
+	if (n->depth < NEST)
+		n->start[n->depth] = ticks;
+	n->depth++;
+}
+
+// Start of the innermost open phase, 0 with none open
+static int pop(nest *n, uint32_t *ticks){
+	if (n->depth == 0)
+		return 0;
+	n->depth--;
+	*ticks = n->start[n->depth < NEST ? n->depth : NEST - 1];
+	return 1;
+}
+
+static void event(uint8_t ev, uint8_t arg, uint32_t ticks){
+	uint8_t id = ev & ~TRACE_END;
+	int end = ev & TRACE_END;
+	uint32_t start;
+	double ms;
+	nest *n;
+	int i;
+
+	if (id >= TRACE_PN532_WRITE && id < TRACE_PN532_WRITE + NSTEPS) {
+		int step = id - TRACE_PN532_WRITE;
+
+		if (!end) {
+			push(&step_start[step][arg], ticks);
+			return;
+		}
+		if (!pop(&step_start[step][arg], &start))
+			return;
+		ms = (uint32_t)(ticks - start) * tick_ms;
+		add(&step_cmd_samples[step][arg], ms);
+		// the ACK frame is read within the ack step
+		if (in_tap && !(id == TRACE_PN532_READ && arg == 0))
+			tap_steps[step] += ms;
+		return;
+	}
+	if (id >= NPHASES)
+		return;
+	n = id == TRACE_TAP ? &tap_start[arg] : &phase_start[id];
+	if (!end) {
+		push(n, ticks);
+		if (id == TRACE_TAP && !in_tap++)
+			memset(tap_steps, 0, sizeof(tap_steps));
+		return;
+	}
+	if (!pop(n, &start))
+		return;
+	ms = (uint32_t)(ticks - start) * tick_ms;
+	add(&phase_samples[id], ms);
+	if (id == TRACE_TAP && in_tap && !--in_tap) {
+		double rest = ms;
+
+		for (i = 0; i < NSTEPS; i++) {
+			add(&step_tap_samples[i], tap_steps[i]);
+			rest -= tap_steps[i];
+		}
+		add(&step_tap_samples[NSTEPS], rest);
+	}
+}
+
+static int get(FILE *f){
+	int c = getc(f);
+
+	if (c == EOF) {
+		if (dumps == 0)
+			fprintf(stderr, "no trace found\n");
+		return -1;
+	}
+	return c;
+}
+
+static int read_dump(FILE *f){
+	uint8_t b[7];
+	uint32_t hz, ticks;
+	int c, count, i, j;
+
+	// sync
+	do {
+		while ((c = get(f)) != TRACE_SYNC1)
+			if (c < 0)
+				return 0;
+		c = get(f);
+	} while (c != TRACE_SYNC2 && c >= 0);
+	if (c < 0 || fread(b, 1, 7, f) != 7)
+		return 0;
+	if (b[0] != TRACE_VERSION) {
+		fprintf(stderr, "unknown trace version %u\n", b[0]);
+		return 1;
+	}
+	hz = b[1] | b[2] << 8 | b[3] << 16 | (uint32_t)b[4] << 24;
+	tick_ms = 1000.0 / hz;
+	count = b[5];
+	dropped += b[6];
+	for (i = 0; i < count; i++) {
+		uint8_t r[6];
+
+		if (fread(r, 1, 6, f) != 6)
+			return 0;
+		ticks = 0;
+		for (j = 5; j >= 2; j--)
+			ticks = ticks << 8 | r[j];
+		event(r[0], r[1], ticks);
+		records++;
+	}
+	dumps++;
+	return 1;
+}
+
+int main(int argc, char **argv){
+	FILE *f = stdin;
+	char name[64];
+	int i, c;
+
+	if (argc > 1 && !(f = fopen(argv[1], "rb"))) {
+		perror(argv[1]);
+		return 1;
+	}
+	while (read_dump(f))
+		;
+	printf("%lu dumps, %lu records", dumps, records);
+	if (dropped)
+		printf(", %lu records lost to ring overflow (raise TRACE_SIZE)", dropped);
+	printf("\n\n%-28s %6s %9s %9s %9s %9s %9s\n", "phase [ms]", "n", "avg", "p50", "p90", "p99", "max");
+	for (i = 0; i < NPHASES; i++) {
+		if (phase_names[i])
+			print(phase_names[i], &phase_samples[i]);
+	}
+	printf("\n%-28s\n", "per tap");
+	for (i = 0; i < NSTEPS; i++) {
+		snprintf(name, sizeof(name), "  pn532 %s", step_names[i]);
+		print(name, &step_tap_samples[i]);
+	}
+	print("  avr", &step_tap_samples[NSTEPS]);
+	printf("\n%-28s\n", "per pn532 command");
+	for (c = 1; c < 256; c++) {
+		for (i = 0; i < NSTEPS; i++) {
+			snprintf(name, sizeof(name), "  %02X %s", c, step_names[i]);
+			print(name, &step_cmd_samples[i][c]);
+		}
+	}
+	return 0;
+}
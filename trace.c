@@ -0,0 +1,116 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "trace.h"
+#include "uart.h"
+
+#ifdef TRACE
+
+typedef struct {
+	uint8_t event;
+	uint8_t arg;
+	uint32_t ticks;
+} trace_record;
+
+static trace_record trace_ring[TRACE_SIZE];
+static uint8_t trace_head;
+static uint8_t trace_count;
+static uint8_t trace_dropped;
+static volatile uint16_t trace_overflows;
+// Records still to send of the dump under way
+static uint8_t trace_dump_left;
+static bool trace_dumping;
+
+ISR(TIMER1_OVF_vect) {
+	trace_overflows++;
+}
+
+void trace_init(void){
+	// Timer1 free-running at F_OSC / 8, the overflow extends it to 32 bits
+	TCCR1A = 0;
+	TCCR1B = _BV(CS11);
+	TIMSK1 |= _BV(TOIE1);
+	sei();
+}
+
+uint32_t trace_now(void){
+	uint16_t hi, lo;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		hi = trace_overflows;
+		lo = TCNT1;
+		// overflow pending but not yet serviced
+		if ((TIFR1 & _BV(TOV1)) && lo < 0x8000)
+			hi++;
+	}
+	return ((uint32_t)hi << 16) | lo;
+}
+
+void trace_event(uint8_t event, uint8_t arg){
+	uint32_t ticks = trace_now();
+	trace_record *r;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		r = &trace_ring[trace_head];
+		if (++trace_head == TRACE_SIZE)
+			trace_head = 0;
+		if (trace_count < TRACE_SIZE)
+			trace_count++;
+		else if (trace_dropped < 0xFF)
+			trace_dropped++;
+		r->event = event;
+		r->arg = arg;
+		r->ticks = ticks;
+	}
+}
+
+// As much of the dump as the UART buffer takes, never waits: the header
+// with the count of records, then the records oldest first. They leave
+// the ring as they are sent, events go on being recorded meanwhile.
+bool trace_dump(void){
+	uint8_t b[9];
+	trace_record *r;
+	bool sent;
+	
+	if (!trace_dumping) {
+		b[0] = TRACE_SYNC1;
+		b[1] = TRACE_SYNC2;
+		b[2] = TRACE_VERSION;
+		b[3] = (uint8_t)(TRACE_TICK_HZ);
+		b[4] = (uint8_t)(TRACE_TICK_HZ >> 8);
+		b[5] = (uint8_t)(TRACE_TICK_HZ >> 16);
+		b[6] = (uint8_t)(TRACE_TICK_HZ >> 24);
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			b[7] = trace_count;
+			b[8] = trace_dropped;
+			if (uart_try_write(b, 9)) {
+				trace_dump_left = trace_count;
+				trace_dropped = 0;
+				trace_dumping = true;
+			}
+		}
+		if (!trace_dumping)
+			return true;
+	}
+	while (trace_dump_left) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			r = &trace_ring[(trace_head + TRACE_SIZE - trace_count) % TRACE_SIZE];
+			b[0] = r->event;
+			b[1] = r->arg;
+			b[2] = r->ticks;
+			b[3] = r->ticks >> 8;
+			b[4] = r->ticks >> 16;
+			b[5] = r->ticks >> 24;
+			sent = uart_try_write(b, 6);
+			if (sent)
+				trace_count--;
+		}
+		if (!sent)
+			return true;
+		trace_dump_left--;
+	}
+	trace_dumping = false;
+	return false;
+}
+
+#endif
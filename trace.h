@@ -0,0 +1,65 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+// Latency tracing: events are timestamped from free-running Timer1 into a
+// RAM ring buffer and dumped over the UART in a compact binary form, see
+// tools/tracedecode.c. Build with -DTRACE to enable, otherwise all
+// TRACE_... macros compile to nothing.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Number of events kept, the oldest ones are overwritten
+#ifndef TRACE_SIZE
+	#define TRACE_SIZE			64
+#endif
+
+// Timer1 runs at F_OSC / 8
+#define TRACE_TICK_HZ			(F_OSC / 8)
+
+// Events, ORed with TRACE_END when a phase ends
+#define TRACE_END				0x80
+// transaction phases (main.c), a tap begins and ends with the reader
+// as argument
+#define TRACE_TAP				0x01
+#define TRACE_GETTAGS			0x02
+#define TRACE_CONNECT			0x03
+#define TRACE_SELECT			0x04
+#define TRACE_GETUID			0x05
+#define TRACE_AUTH				0x06
+#define TRACE_DEBIT				0x07
+#define TRACE_COMMIT			0x08
+#define TRACE_DISCONNECT		0x09
+#define TRACE_KEYDIV			0x0A
+#define TRACE_PRESENCE			0x0B
+// PN532 command steps (nfcPN532.c), the argument is the command code
+#define TRACE_PN532_WRITE		0x10
+#define TRACE_PN532_ACK			0x11
+#define TRACE_PN532_READY		0x12
+#define TRACE_PN532_READ		0x13
+
+// Dump format: TRACE_SYNC1 TRACE_SYNC2 version tick_hz(4) count dropped,
+// then count records of event arg ticks(4), all little endian
+#define TRACE_SYNC1				0xA5
+#define TRACE_SYNC2				0x5A
+#define TRACE_VERSION			1
+
+#ifdef TRACE
+void trace_init(void);
+void trace_event(uint8_t event, uint8_t arg);
+// A piece of the dump per call, true until it is complete
+bool trace_dump(void);
+// Timer1 ticks since trace_init, also used by the scheduler's statistics
+uint32_t trace_now(void);
+	#define TRACE_INIT()				trace_init()
+	#define TRACE_BEGIN(event, arg)		trace_event((event), (arg))
+	#define TRACE_FINISH(event, arg)	trace_event((event) | TRACE_END, (arg))
+	#define TRACE_DUMP()				trace_dump()
+#else
+	#define TRACE_INIT()				do {} while (0)
+	#define TRACE_BEGIN(event, arg)		do {} while (0)
+	#define TRACE_FINISH(event, arg)	do {} while (0)
+	#define TRACE_DUMP()				false
+#endif
+
+#endif
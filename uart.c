@@ -0,0 +1,106 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include "uart.h"
+
+#define UART_UBRR	(F_OSC / 16 / UART_BAUD - 1)
+
+#if UART_TX_SIZE > 128 || (UART_TX_SIZE & (UART_TX_SIZE - 1))
+	#error "UART_TX_SIZE must be a power of two up to 128"
+#endif
+#if UART_RX_SIZE > 128 || (UART_RX_SIZE & (UART_RX_SIZE - 1))
+	#error "UART_RX_SIZE must be a power of two up to 128"
+#endif
+
+// Free running indices, the ISR takes bytes from the tail
+static uint8_t uart_ring[UART_TX_SIZE];
+static volatile uint8_t uart_head;
+static volatile uint8_t uart_tail;
+
+ISR(USART0_UDRE_vect) {
+	uint8_t tail = uart_tail;
+	
+	if (tail == uart_head) {
+		// all sent
+		UCSR0B &= ~_BV(UDRIE0);
+		return;
+	}
+	UDR0 = uart_ring[tail & (UART_TX_SIZE - 1)];
+	uart_tail = tail + 1;
+}
+
+// Received bytes, dropped when the ring is full
+static uint8_t uart_rx_ring[UART_RX_SIZE];
+static volatile uint8_t uart_rx_head;
+static volatile uint8_t uart_rx_tail;
+
+ISR(USART0_RX_vect) {
+	uint8_t head = uart_rx_head;
+	uint8_t c = UDR0;
+	
+	if ((uint8_t)(head - uart_rx_tail) == UART_RX_SIZE)
+		return;
+	uart_rx_ring[head & (UART_RX_SIZE - 1)] = c;
+	uart_rx_head = head + 1;
+}
+
+void uart_init(void){
+	UBRR0 = UART_UBRR;
+	UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+	UCSR0B = _BV(RXCIE0) | _BV(RXEN0) | _BV(TXEN0);
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	// bytes queued before are sent now
+	if (uart_head != uart_tail)
+		UCSR0B |= _BV(UDRIE0);
+	sei();
+}
+
+static uint8_t uart_room(void){
+	return UART_TX_SIZE - (uint8_t)(uart_head - uart_tail);
+}
+
+// The byte is in the ring before the interrupt is enabled, so the ISR
+// never disables it with bytes left
+static void uart_queue(uint8_t c){
+	uint8_t head = uart_head;
+	
+	uart_ring[head & (UART_TX_SIZE - 1)] = c;
+	uart_head = head + 1;
+}
+
+void uart_putc(uint8_t c){
+	// the ring is full, the next interrupt makes room
+	while (!uart_room())
+		sleep_mode();
+	uart_queue(c);
+	UCSR0B |= _BV(UDRIE0);
+}
+
+void uart_write(const void *data, uint16_t len){
+	const uint8_t *p = data;
+	
+	while (len--)
+		uart_putc(*p++);
+}
+
+bool uart_try_write(const void *data, uint8_t len){
+	const uint8_t *p = data;
+	
+	if (uart_room() < len)
+		return false;
+	while (len--)
+		uart_queue(*p++);
+	UCSR0B |= _BV(UDRIE0);
+	return true;
+}
+
+int16_t uart_getc(void){
+	uint8_t tail = uart_rx_tail;
+	uint8_t c;
+	
+	if (tail == uart_rx_head)
+		return -1;
+	c = uart_rx_ring[tail & (UART_RX_SIZE - 1)];
+	uart_rx_tail = tail + 1;
+	return c;
+}
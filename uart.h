@@ -0,0 +1,32 @@
+#ifndef _UART_H_
+#define _UART_H_
+
+// USART0, 8N1. Bytes to send are queued in a RAM ring buffer that the
+// data register empty interrupt drains, writers only wait when it is
+// full. Received bytes are buffered by the receive interrupt until they
+// are polled for.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define UART_BAUD	115200
+
+// Ring buffer sizes, powers of two up to 128
+#ifndef UART_TX_SIZE
+	#define UART_TX_SIZE	128
+#endif
+// Received bytes not yet taken, the serial commands are a few bytes each
+#ifndef UART_RX_SIZE
+	#define UART_RX_SIZE	16
+#endif
+
+void uart_init(void);
+// Wait for room in the ring buffer, interrupts must be enabled
+void uart_putc(uint8_t c);
+void uart_write(const void *data, uint16_t len);
+// Queues all of data or, if it does not fit, nothing. Never waits.
+bool uart_try_write(const void *data, uint8_t len);
+// The received byte, -1 if there is none
+int16_t uart_getc(void);
+
+#endif